@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+#define CMAKE_SYSTEM_NAME "Linux"
+#define CMAKE_SYSTEM_PROCESSOR "x86_64"
+
+#define CMAKE_CXX_COMPILER_ID "GNU"
+#define CMAKE_CXX_STANDARD 17
+
+#define PROJECT_VERSION_MAJOR 0
+#define PROJECT_VERSION_MINOR 0
+#define PROJECT_VERSION_PATCH 1
+#define PROJECT_VERSION_TWEAK 2501
+
+#define PROJECT_VERSION_STRING "0.0.1.2501"
+
+#define ENABLE_EXPERIMENTS 1
@@ -93,13 +93,58 @@ std::uint64_t PacketBuffer::read_UI64(PacketBuffer &buffer)
 
 std::string PacketBuffer::read_string(PacketBuffer &buffer)
 {
-    std::size_t size = PacketBuffer::read_UI16(buffer);
-    std::string result = std::string();
+    std::size_t size = PacketBuffer::read_VUI32(buffer);
+    std::size_t available = buffer.vector.size() - cxpr::min(buffer.read_position, buffer.vector.size());
+    std::string result = std::string(cxpr::min(size, available), char(0x00));
+    PacketBuffer::read_bytes(buffer, result.data(), result.size());
+    buffer.read_position += size - result.size();
+    return result;
+}
 
-    for(std::size_t i = 0; i < size; ++i) {
-        if(buffer.read_position < buffer.vector.size())
-            result.push_back(buffer.vector[buffer.read_position]);
-        buffer.read_position += 1U;
+void PacketBuffer::read_bytes(PacketBuffer &buffer, void *data, std::size_t size)
+{
+    auto data_p = reinterpret_cast<std::uint8_t *>(data);
+    auto available = buffer.vector.size() - cxpr::min(buffer.read_position, buffer.vector.size());
+    auto copy_size = cxpr::min(size, available);
+
+    // Whatever can't be read is zeroed out; this
+    // mirrors what the integer read functions do
+    if(copy_size)
+        std::copy_n(buffer.vector.data() + buffer.read_position, copy_size, data_p);
+    std::fill_n(data_p + copy_size, size - copy_size, UINT8_C(0x00));
+
+    buffer.read_position += size;
+}
+
+std::int32_t PacketBuffer::read_VI32(PacketBuffer &buffer)
+{
+    return static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+}
+
+std::int64_t PacketBuffer::read_VI64(PacketBuffer &buffer)
+{
+    const std::uint64_t value = PacketBuffer::read_VUI64(buffer);
+    return static_cast<std::int64_t>(value >> 1U) ^ -static_cast<std::int64_t>(value & 1U);
+}
+
+std::uint32_t PacketBuffer::read_VUI32(PacketBuffer &buffer)
+{
+    return static_cast<std::uint32_t>(PacketBuffer::read_VUI64(buffer));
+}
+
+std::uint64_t PacketBuffer::read_VUI64(PacketBuffer &buffer)
+{
+    std::uint64_t result = UINT64_C(0);
+
+    // Truncated values read as zero bytes past the end
+    // of the buffer which conveniently terminates the loop
+    for(unsigned int shift = 0U; shift < 64U; shift += 7U) {
+        const std::uint8_t byte = PacketBuffer::read_UI8(buffer);
+        result |= static_cast<std::uint64_t>(byte & UINT8_C(0x7F)) << shift;
+
+        if(!(byte & UINT8_C(0x80))) {
+            break;
+        }
     }
 
     return result;
@@ -137,35 +182,78 @@ void PacketBuffer::write_UI8(PacketBuffer &buffer, std::uint8_t value)
 
 void PacketBuffer::write_UI16(PacketBuffer &buffer, std::uint16_t value)
 {
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT16_C(0xFF00)) >> 8U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT16_C(0x00FF)) >> 0U));
+    const std::size_t position = buffer.vector.size();
+    buffer.vector.resize(position + 2U);
+
+    std::uint8_t *data = buffer.vector.data() + position;
+    data[0] = static_cast<std::uint8_t>((value & UINT16_C(0xFF00)) >> 8U);
+    data[1] = static_cast<std::uint8_t>((value & UINT16_C(0x00FF)) >> 0U);
 }
 
 void PacketBuffer::write_UI32(PacketBuffer &buffer, std::uint32_t value)
 {
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT32_C(0xFF000000)) >> 24U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT32_C(0x00FF0000)) >> 16U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT32_C(0x0000FF00)) >> 8U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT32_C(0x000000FF)) >> 0U));
+    const std::size_t position = buffer.vector.size();
+    buffer.vector.resize(position + 4U);
+
+    std::uint8_t *data = buffer.vector.data() + position;
+    data[0] = static_cast<std::uint8_t>((value & UINT32_C(0xFF000000)) >> 24U);
+    data[1] = static_cast<std::uint8_t>((value & UINT32_C(0x00FF0000)) >> 16U);
+    data[2] = static_cast<std::uint8_t>((value & UINT32_C(0x0000FF00)) >> 8U);
+    data[3] = static_cast<std::uint8_t>((value & UINT32_C(0x000000FF)) >> 0U);
 }
 
 void PacketBuffer::write_UI64(PacketBuffer &buffer, std::uint64_t value)
 {
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0xFF00000000000000)) >> 56U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x00FF000000000000)) >> 48U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x0000FF0000000000)) >> 40U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x000000FF00000000)) >> 32U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x00000000FF000000)) >> 24U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x0000000000FF0000)) >> 16U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x000000000000FF00)) >> 8U));
-    buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x00000000000000FF)) >> 0U));
+    const std::size_t position = buffer.vector.size();
+    buffer.vector.resize(position + 8U);
+
+    std::uint8_t *data = buffer.vector.data() + position;
+    data[0] = static_cast<std::uint8_t>((value & UINT64_C(0xFF00000000000000)) >> 56U);
+    data[1] = static_cast<std::uint8_t>((value & UINT64_C(0x00FF000000000000)) >> 48U);
+    data[2] = static_cast<std::uint8_t>((value & UINT64_C(0x0000FF0000000000)) >> 40U);
+    data[3] = static_cast<std::uint8_t>((value & UINT64_C(0x000000FF00000000)) >> 32U);
+    data[4] = static_cast<std::uint8_t>((value & UINT64_C(0x00000000FF000000)) >> 24U);
+    data[5] = static_cast<std::uint8_t>((value & UINT64_C(0x0000000000FF0000)) >> 16U);
+    data[6] = static_cast<std::uint8_t>((value & UINT64_C(0x000000000000FF00)) >> 8U);
+    data[7] = static_cast<std::uint8_t>((value & UINT64_C(0x00000000000000FF)) >> 0U);
 }
 
 void PacketBuffer::write_string(PacketBuffer &buffer, const std::string &value)
 {
     const std::size_t size = cxpr::min<std::size_t>(UINT16_MAX, value.size());
-    PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(size));
-    for(std::size_t i = 0; i < size; PacketBuffer::write_UI8(buffer, value[i++]));
+    PacketBuffer::write_VUI32(buffer, static_cast<std::uint32_t>(size));
+    PacketBuffer::write_bytes(buffer, value.data(), size);
+}
+
+void PacketBuffer::write_bytes(PacketBuffer &buffer, const void *data, std::size_t size)
+{
+    const std::uint8_t *data_p = reinterpret_cast<const std::uint8_t *>(data);
+    buffer.vector.insert(buffer.vector.end(), data_p, data_p + size);
+}
+
+void PacketBuffer::write_VI32(PacketBuffer &buffer, std::int32_t value)
+{
+    PacketBuffer::write_VI64(buffer, value);
+}
+
+void PacketBuffer::write_VI64(PacketBuffer &buffer, std::int64_t value)
+{
+    PacketBuffer::write_VUI64(buffer, (static_cast<std::uint64_t>(value) << 1U) ^ static_cast<std::uint64_t>(value >> 63U));
+}
+
+void PacketBuffer::write_VUI32(PacketBuffer &buffer, std::uint32_t value)
+{
+    PacketBuffer::write_VUI64(buffer, value);
+}
+
+void PacketBuffer::write_VUI64(PacketBuffer &buffer, std::uint64_t value)
+{
+    while(value >= UINT64_C(0x80)) {
+        buffer.vector.push_back(static_cast<std::uint8_t>(value | UINT64_C(0x80)));
+        value >>= 7U;
+    }
+
+    buffer.vector.push_back(static_cast<std::uint8_t>(value));
 }
 
 void PacketBuffer::setup(PacketBuffer &buffer)
@@ -180,3 +268,8 @@ void PacketBuffer::setup(PacketBuffer &buffer, const void *data, std::size_t siz
     const std::uint8_t *data_p = reinterpret_cast<const std::uint8_t *>(data);
     buffer.vector.assign(data_p, data_p + size);
 }
+
+void PacketBuffer::reserve(PacketBuffer &buffer, std::size_t size)
+{
+    buffer.vector.reserve(buffer.vector.size() + size);
+}
@@ -16,6 +16,16 @@ public:
     static std::uint32_t read_UI32(PacketBuffer &buffer);
     static std::uint64_t read_UI64(PacketBuffer &buffer);
     static std::string read_string(PacketBuffer &buffer);
+    static void read_bytes(PacketBuffer &buffer, void *data, std::size_t size);
+
+public:
+    // Variable-length integers; unsigned values are stored
+    // as LEB128 and signed values are zigzag-encoded first so
+    // that small negative values stay small on the wire too
+    static std::int32_t read_VI32(PacketBuffer &buffer);
+    static std::int64_t read_VI64(PacketBuffer &buffer);
+    static std::uint32_t read_VUI32(PacketBuffer &buffer);
+    static std::uint64_t read_VUI64(PacketBuffer &buffer);
     
 public:
     static void write_FP32(PacketBuffer &buffer, float value);
@@ -28,8 +38,16 @@ public:
     static void write_UI32(PacketBuffer &buffer, std::uint32_t value);
     static void write_UI64(PacketBuffer &buffer, std::uint64_t value);
     static void write_string(PacketBuffer &buffer, const std::string &value);
+    static void write_bytes(PacketBuffer &buffer, const void *data, std::size_t size);
+
+public:
+    static void write_VI32(PacketBuffer &buffer, std::int32_t value);
+    static void write_VI64(PacketBuffer &buffer, std::int64_t value);
+    static void write_VUI32(PacketBuffer &buffer, std::uint32_t value);
+    static void write_VUI64(PacketBuffer &buffer, std::uint64_t value);
 
 public:
     static void setup(PacketBuffer &buffer);
     static void setup(PacketBuffer &buffer, const void *data, std::size_t size);
+    static void reserve(PacketBuffer &buffer, std::size_t size);
 };
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "bench/precompiled.hh"
+
+#include "common/cmdline.hh"
+#include "common/epoch.hh"
+#include "common/fstools.hh"
+
+#include "shared/world/chunk_codec.hh"
+
+#include "shared/setup.hh"
+
+
+struct CodecResult final {
+    std::string name {};
+    std::uint64_t encode_us {};
+    std::uint64_t decode_us {};
+    std::size_t total_bytes {};
+};
+
+static void run_codec(CodecResult &result, const std::vector<VoxelStorage> &chunks, unsigned int level, bool legacy)
+{
+    std::vector<std::vector<std::uint8_t>> encoded = {};
+    encoded.resize(chunks.size());
+
+    auto encode_begin = epoch::microseconds();
+
+    for(std::size_t i = 0; i < chunks.size(); ++i) {
+        if(legacy)
+            chunk_codec::encode_legacy(chunks[i], encoded[i], level);
+        else chunk_codec::encode(chunks[i], encoded[i], level);
+    }
+
+    result.encode_us = epoch::microseconds() - encode_begin;
+    result.total_bytes = 0;
+
+    for(const auto &buffer : encoded)
+        result.total_bytes += buffer.size();
+
+    VoxelStorage voxels = {};
+
+    auto decode_begin = epoch::microseconds();
+
+    for(std::size_t i = 0; i < chunks.size(); ++i) {
+        if(!chunk_codec::decode(encoded[i], voxels) || (voxels != chunks[i])) {
+            spdlog::critical("bench_codec: {}: round-trip mismatch at chunk {}", result.name, i);
+            std::terminate();
+        }
+    }
+
+    result.decode_us = epoch::microseconds() - decode_begin;
+}
+
+int main(int argc, char **argv)
+{
+    cmdline::append(argc, argv);
+
+    shared::setup(argc, argv);
+
+    std::string universe_name = {};
+
+    if(!cmdline::get_value("universe", universe_name))
+        universe_name = "save";
+    auto chunk_dir = fmt::format("{}/chunk", universe_name);
+
+    std::vector<VoxelStorage> chunks = {};
+    std::vector<std::uint8_t> buffer = {};
+    std::size_t stored_bytes = 0;
+
+    char **filenames = PHYSFS_enumerateFiles(chunk_dir.c_str());
+
+    for(char **filename = filenames; filename && *filename; ++filename) {
+        auto path = fmt::format("{}/{}", chunk_dir, *filename);
+
+        if(!fstools::read_bytes(path, buffer))
+            continue;
+
+        VoxelStorage voxels = {};
+
+        if(!chunk_codec::decode(buffer, voxels)) {
+            spdlog::warn("bench_codec: {}: corrupted chunk data", path);
+            continue;
+        }
+
+        stored_bytes += buffer.size();
+        chunks.push_back(voxels);
+    }
+
+    PHYSFS_freeList(filenames);
+
+    if(chunks.empty()) {
+        spdlog::critical("bench_codec: {}: no chunks found", chunk_dir);
+        shared::desetup();
+        return 1;
+    }
+
+    spdlog::info("bench_codec: {} chunks, {} bytes on disk", chunks.size(), stored_bytes);
+
+    std::vector<CodecResult> results = {};
+
+    results.push_back(CodecResult());
+    results.back().name = "miniz (legacy)";
+    run_codec(results.back(), chunks, chunk_codec::LEVEL_DEFAULT, true);
+
+    results.push_back(CodecResult());
+    results.back().name = "palette RLE";
+    run_codec(results.back(), chunks, chunk_codec::LEVEL_RLE, false);
+
+    for(unsigned int level = 1U; level <= chunk_codec::LEVEL_MAX; level += 4U) {
+        results.push_back(CodecResult());
+        results.back().name = fmt::format("palette RLE + deflate {}", level);
+        run_codec(results.back(), chunks, level, false);
+    }
+
+    const auto raw_bytes = chunks.size() * sizeof(VoxelStorage);
+
+    for(const CodecResult &result : results) {
+        auto ratio = static_cast<double>(raw_bytes) / static_cast<double>(result.total_bytes);
+        auto encode_avg = static_cast<double>(result.encode_us) / static_cast<double>(chunks.size());
+        auto decode_avg = static_cast<double>(result.decode_us) / static_cast<double>(chunks.size());
+        spdlog::info("{:<28} {:>10} bytes ({:>6.02f}x) encode {:>8.02f} us/chunk decode {:>8.02f} us/chunk",
+            result.name, result.total_bytes, ratio, encode_avg, decode_avg);
+    }
+
+    shared::desetup();
+
+    return 0;
+}
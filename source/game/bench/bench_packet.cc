@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "bench/precompiled.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/cmdline.hh"
+#include "common/epoch.hh"
+#include "common/packet_buffer.hh"
+
+#include "shared/world/chunk_codec.hh"
+
+#include "shared/protocol.hh"
+#include "shared/setup.hh"
+
+
+constexpr static std::size_t DEFAULT_ITERATIONS = 100000;
+
+struct PacketResult final {
+    std::string name {};
+    std::uint64_t encode_us {};
+    std::uint64_t decode_us {};
+    std::size_t packet_size {};
+};
+
+// This is how ChunkVoxels used to be serialised: byte
+// by byte and then copied into a newly created ENet packet
+static ENetPacket *encode_bytewise(PacketBuffer &buffer, const protocol::ChunkVoxels &packet)
+{
+    PacketBuffer::setup(buffer);
+    PacketBuffer::write_UI16(buffer, protocol::ChunkVoxels::ID);
+    PacketBuffer::write_UI64(buffer, static_cast<std::uint64_t>(packet.entity));
+    PacketBuffer::write_I32(buffer, packet.chunk[0]);
+    PacketBuffer::write_I32(buffer, packet.chunk[1]);
+    PacketBuffer::write_I32(buffer, packet.chunk[2]);
+    PacketBuffer::write_UI64(buffer, static_cast<std::uint64_t>(packet.encoded.size()));
+    for(std::size_t i = 0; i < packet.encoded.size(); PacketBuffer::write_UI8(buffer, packet.encoded[i++]));
+    return enet_packet_create(buffer.vector.data(), buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE);
+}
+
+template<typename packet_type>
+static void run_packet(PacketResult &result, const packet_type &packet, std::size_t iterations)
+{
+    auto encode_begin = epoch::microseconds();
+
+    for(std::size_t i = 0; i < iterations; ++i) {
+        ENetPacket *encoded = protocol::encode(packet);
+        enet_packet_destroy(encoded);
+    }
+
+    result.encode_us = epoch::microseconds() - encode_begin;
+
+    ENetPacket *encoded = protocol::encode(packet);
+    result.packet_size = encoded->dataLength;
+
+    auto decode_begin = epoch::microseconds();
+
+    for(std::size_t i = 0; i < iterations; ++i) {
+        protocol::receive(encoded, nullptr);
+    }
+
+    result.decode_us = epoch::microseconds() - decode_begin;
+
+    enet_packet_destroy(encoded);
+}
+
+static void make_voxels(VoxelStorage &voxels)
+{
+    std::mt19937 twister = std::mt19937(42);
+    std::uniform_int_distribution<unsigned int> dist = std::uniform_int_distribution<unsigned int>(0U, 15U);
+
+    // Layered terrain-like chunk with a bit of noise
+    // sprinkled on top so it doesn't collapse into a few runs
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+        auto layer = static_cast<VoxelID>(i / (CHUNK_VOLUME / 4) + 1);
+        voxels[i] = dist(twister) ? layer : static_cast<VoxelID>(dist(twister) + 5);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    cmdline::append(argc, argv);
+
+    shared::setup(argc, argv);
+
+    std::string value = {};
+    std::size_t iterations = DEFAULT_ITERATIONS;
+
+    if(cmdline::get_value("iterations", value))
+        iterations = cxpr::max<std::size_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+
+    std::vector<PacketResult> results = {};
+
+    protocol::ChunkVoxels chunk_voxels = {};
+    chunk_voxels.entity = static_cast<entt::entity>(0x1234);
+    chunk_voxels.chunk = ChunkCoord(-12, 3, 40);
+    make_voxels(chunk_voxels.voxels);
+
+    results.push_back(PacketResult());
+    results.back().name = "ChunkVoxels (encode)";
+    run_packet(results.back(), chunk_voxels, iterations / 10);
+
+    chunk_codec::encode(chunk_voxels.voxels, chunk_voxels.encoded, protocol::chunk_level);
+
+    results.push_back(PacketResult());
+    results.back().name = "ChunkVoxels (forward)";
+    run_packet(results.back(), chunk_voxels, iterations);
+
+    PacketBuffer bytewise_buffer = {};
+
+    results.push_back(PacketResult());
+    results.back().name = "ChunkVoxels (bytewise)";
+    results.back().encode_us = epoch::microseconds();
+    for(std::size_t i = 0; i < iterations; ++i)
+        enet_packet_destroy(encode_bytewise(bytewise_buffer, chunk_voxels));
+    results.back().encode_us = epoch::microseconds() - results.back().encode_us;
+    results.back().packet_size = bytewise_buffer.vector.size();
+
+    protocol::EntityTransform entity_transform = {};
+    entity_transform.entity = static_cast<entt::entity>(0x1234);
+    entity_transform.coord.chunk = ChunkCoord(-12, 3, 40);
+    entity_transform.coord.local = Vec3f(1.0f, 2.0f, 3.0f);
+    entity_transform.angles = Vec3angles(0.1f, 0.2f, 0.3f);
+
+    results.push_back(PacketResult());
+    results.back().name = "EntityTransform";
+    run_packet(results.back(), entity_transform, iterations);
+
+    // A client with a bit of latency keeps
+    // a handful of commands unacknowledged
+    protocol::PlayerCommands player_commands = {};
+
+    for(std::uint32_t i = 0; i < 4; ++i) {
+        PlayerCommand command = {};
+        command.sequence = UINT32_C(12345) + i;
+        command.wish_dir = Vec3f(0.0f, 0.0f, 1.0f);
+        command.head = Vec3angles(0.4f, 0.5f, 0.0f);
+        player_commands.commands.push_back(command);
+    }
+
+    results.push_back(PacketResult());
+    results.back().name = "PlayerCommands (4)";
+    run_packet(results.back(), player_commands, iterations);
+
+    for(const PacketResult &result : results) {
+        // The first ChunkVoxels run does a tenth of iterations
+        // because each one of them goes through the chunk codec
+        auto count = (&result == &results.front()) ? (iterations / 10) : iterations;
+        auto encode_avg = 1000.0 * static_cast<double>(result.encode_us) / static_cast<double>(count);
+        auto decode_avg = 1000.0 * static_cast<double>(result.decode_us) / static_cast<double>(count);
+        spdlog::info("{:<24} {:>6} bytes encode {:>10.02f} ns/packet decode {:>10.02f} ns/packet",
+            result.name, result.packet_size, encode_avg, decode_avg);
+    }
+
+    shared::desetup();
+
+    return 0;
+}
@@ -0,0 +1,450 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "bot/precompiled.hh"
+#include "bot/bot.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/epoch.hh"
+
+#include "shared/world/game_voxels.hh"
+#include "shared/world/voxel_def.hh"
+
+#include "shared/globals.hh"
+#include "shared/protocol.hh"
+
+
+// Chunks are normally streamed by the server on its own;
+// whatever hasn't arrived in time is requested explicitly and,
+// just like chunk_visibility does, the nearest chunks go first
+constexpr static std::uint64_t REQUEST_DELAY = 1000000;
+constexpr static std::size_t MAX_REQUESTS_PER_TICK = 16;
+
+constexpr static std::uint64_t SAMPLE_INTERVAL = 1000000;
+
+std::uint64_t bot::password_hash = UINT64_MAX;
+unsigned int bot::view_distance = 4U;
+float bot::speed = 4.0f;
+float bot::radius = 24.0f;
+bool bot::is_jumping = false;
+std::uint64_t bot::edit_interval = 1000000;
+std::uint64_t bot::chat_interval = 10000000;
+unsigned int bot::flood = 0U;
+
+static Bot *find_bot(const ENetPeer *peer)
+{
+    if(peer)
+        return reinterpret_cast<Bot *>(peer->data);
+    return nullptr;
+}
+
+static WorldCoord offset_coord(const WorldCoord &origin, const Vec3f &offset)
+{
+    WorldCoord result = origin;
+
+    for(std::size_t i = 0; i < 3; ++i) {
+        const float local = origin.local[i] + offset[i];
+        const float chunk = std::floor(local / static_cast<float>(CHUNK_SIZE));
+        result.chunk[i] += static_cast<std::int32_t>(chunk);
+        result.local[i] = local - chunk * static_cast<float>(CHUNK_SIZE);
+    }
+
+    return result;
+}
+
+static void update_wanted(Bot &bot)
+{
+    const auto cpos = bot.position.chunk;
+    const auto dist = static_cast<std::int32_t>(bot::view_distance);
+    const auto curtime = epoch::microseconds();
+
+    for(auto it = bot.wanted.begin(); it != bot.wanted.end();) {
+        const auto dx = cxpr::abs(it->first[0] - cpos[0]);
+        const auto dy = cxpr::abs(it->first[1] - cpos[1]);
+        const auto dz = cxpr::abs(it->first[2] - cpos[2]);
+
+        if((dx <= dist) && (dy <= dist) && (dz <= dist))
+            ++it;
+        else it = bot.wanted.erase(it);
+    }
+
+    for(auto cx = cpos[0] - dist; cx <= cpos[0] + dist; ++cx)
+    for(auto cy = cpos[1] - dist; cy <= cpos[1] + dist; ++cy)
+    for(auto cz = cpos[2] - dist; cz <= cpos[2] + dist; ++cz) {
+        const ChunkCoord cvec = ChunkCoord(cx, cy, cz);
+
+        if(bot.chunks.count(cvec) || bot.wanted.contains(cvec))
+            continue;
+
+        WantedChunk chunk = {};
+        chunk.since = curtime;
+        chunk.is_requested = false;
+        bot.wanted.emplace(cvec, chunk);
+    }
+
+    bot.cached_cpos = cpos;
+}
+
+static void request_chunks(Bot &bot)
+{
+    const auto curtime = epoch::microseconds();
+    std::vector<ChunkCoord> requests = {};
+
+    for(const auto &it : bot.wanted) {
+        if(!it.second.is_requested && ((curtime - it.second.since) >= REQUEST_DELAY)) {
+            requests.push_back(it.first);
+        }
+    }
+
+    std::sort(requests.begin(), requests.end(), [&bot](const ChunkCoord &ca, const ChunkCoord &cb) {
+        auto dir_a = ca - bot.cached_cpos;
+        auto dir_b = cb - bot.cached_cpos;
+
+        const auto da = dir_a[0] * dir_a[0] + dir_a[1] * dir_a[1] + dir_a[2] * dir_a[2];
+        const auto db = dir_b[0] * dir_b[0] + dir_b[1] * dir_b[1] + dir_b[2] * dir_b[2];
+
+        return da < db;
+    });
+
+    const std::size_t count = cxpr::min(requests.size(), MAX_REQUESTS_PER_TICK);
+
+    for(std::size_t i = 0; i < count; ++i) {
+        protocol::RequestChunk packet = {};
+        packet.coord = requests[i];
+        protocol::send(bot.peer, nullptr, packet);
+
+        bot.wanted[requests[i]].is_requested = true;
+        bot.num_requests += 1;
+    }
+}
+
+static void receive_chunk(Bot &bot, const ChunkCoord &cpos)
+{
+    const auto it = bot.wanted.find(cpos);
+
+    if(it != bot.wanted.end()) {
+        bot.chunk_latency_us.push_back(static_cast<std::uint32_t>(epoch::microseconds() - it->second.since));
+        bot.wanted.erase(it);
+    }
+
+    bot.chunks.insert(cpos);
+}
+
+static void send_movement(Bot &bot)
+{
+    const float dt = 1.0f / static_cast<float>(bot.tickrate);
+    const float angular = bot::speed / cxpr::max(bot::radius, 1.0f);
+
+    bot.angle += angular * dt;
+
+    Vec3f offset = {};
+    offset[0] = bot::radius * std::cos(bot.phase + bot.angle);
+    offset[1] = 0.0f;
+    offset[2] = bot::radius * std::sin(bot.phase + bot.angle);
+
+    // The server moves the bot the way it'd move any other
+    // player so the bot just keeps chasing a point that goes
+    // around in circles; the position comes with acknowledgements
+    Vec3f direction = WorldCoord::to_vec3f(bot.position, offset_coord(bot.center, offset));
+    direction[1] = 0.0f;
+
+    PlayerCommand command = {};
+    command.sequence = ++bot.player_sequence;
+    command.head[1] = std::atan2(-direction[0], -direction[2]);
+    command.jump = bot::is_jumping;
+
+    if(Vec3f::normalize(direction) > 0.5f) {
+        Vec3f forward, right;
+        Vec3angles::vectors(command.head, &forward, &right, nullptr);
+        command.wish_dir[0] = Vec3f::dot(direction, right);
+        command.wish_dir[2] = Vec3f::dot(direction, forward);
+    }
+
+    // Bots never send anything twice so a lost
+    // packet is just a tick the bot has stood still
+    protocol::PlayerCommands packet = {};
+    packet.commands.push_back(command);
+    protocol::send(bot.peer, nullptr, packet);
+}
+
+static void send_flood(Bot &bot)
+{
+    for(unsigned int i = 0U; i < bot::flood; ++i) {
+        protocol::RequestChunk packet = {};
+        packet.coord = bot.cached_cpos;
+        protocol::send(bot.peer, nullptr, packet);
+    }
+}
+
+static void send_edit(Bot &bot)
+{
+    protocol::SetVoxel packet = {};
+
+    if(bot.has_edit) {
+        // Break whatever has been placed the last time
+        packet.coord = bot.edit_coord;
+        packet.voxel = NULL_VOXEL;
+        bot.has_edit = false;
+    }
+    else {
+        // Place a voxel right above the bot's head
+        bot.edit_coord = WorldCoord::to_voxel(offset_coord(bot.position, Vec3f(0.0f, 3.0f, 0.0f)));
+        packet.coord = bot.edit_coord;
+        packet.voxel = game_voxels::cobblestone;
+        bot.has_edit = true;
+    }
+
+    packet.flags = UINT16_C(0x0000);
+    protocol::send(bot.peer, nullptr, packet);
+
+    bot.num_edits += 1;
+}
+
+static void send_chat(Bot &bot)
+{
+    protocol::ChatMessage packet = {};
+    packet.type = protocol::ChatMessage::TEXT_MESSAGE;
+    packet.sender = bot.username;
+    packet.message = fmt::format("hello #{} from {}", bot.num_chats, bot.username);
+    protocol::send(bot.peer, nullptr, packet);
+
+    bot.num_chats += 1;
+}
+
+static void on_login_response_packet(const protocol::LoginResponse &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        bot->tickrate = cxpr::max<std::uint16_t>(packet.server_tickrate, 1);
+    }
+}
+
+static void on_disconnect_packet(const protocol::Disconnect &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        spdlog::warn("bot: {}: disconnected: {}", bot->username, packet.reason);
+        bot->reason = packet.reason;
+    }
+}
+
+static void on_spawn_player_packet(const protocol::SpawnPlayer &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        const auto curtime = epoch::microseconds();
+
+        bot->entity = packet.entity;
+        bot->state = BOT_PLAYING;
+        bot->spawn_time = curtime;
+        bot->join_bytes = bot->host->totalReceivedData;
+        bot->next_tick = curtime;
+        bot->next_sample = curtime;
+        bot->next_edit = curtime + bot::edit_interval;
+        bot->next_chat = curtime + bot::chat_interval;
+
+        // There's no chunk cache to validate, this
+        // makes the server start streaming chunks right away
+        protocol::ChunkHashes hashes = {};
+        hashes.is_final = true;
+        protocol::send(bot->peer, nullptr, hashes);
+
+        bot->position = bot->center;
+        update_wanted(*bot);
+    }
+}
+
+static void on_player_state_ack_packet(const protocol::PlayerStateAck &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        bot->position = packet.coord;
+    }
+}
+
+static void on_chunk_voxels_packet(const protocol::ChunkVoxels &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        receive_chunk(*bot, packet.chunk);
+        bot->num_chunks += 1;
+    }
+}
+
+static void on_chunk_absent_packet(const protocol::ChunkAbsent &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        for(const protocol::ChunkAbsent::Entry &entry : packet.entries) {
+            for(std::uint16_t i = 0; i < entry.height; ++i) {
+                receive_chunk(*bot, ChunkCoord(entry.coord[0], entry.coord[1] + i, entry.coord[2]));
+                bot->num_absent += 1;
+            }
+        }
+    }
+}
+
+static void on_entity_player_packet(const protocol::EntityPlayer &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        bot->entities.insert(packet.entity);
+        bot->num_introduced += 1;
+
+        if(bot->state != BOT_PLAYING) {
+            bot->join_entities += 1;
+        }
+    }
+}
+
+static void on_remove_entity_packet(const protocol::RemoveEntity &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        if(bot->entities.erase(packet.entity)) {
+            bot->num_removed += 1;
+        }
+    }
+}
+
+static void on_entity_snapshot_packet(const protocol::EntitySnapshot &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        bot->num_snapshots += 1;
+        bot->snapshot_bytes += packet.payload.size();
+
+        // Bots don't simulate anything; acknowledging
+        // snapshots is only there so that the server deltas
+        // them just like it would for a regular client
+        if(packet.sequence > bot->snapshot_sequence) {
+            bot->snapshot_sequence = packet.sequence;
+
+            protocol::SnapshotAck ack = {};
+            ack.sequence = packet.sequence;
+            protocol::send(bot->peer, nullptr, ack);
+        }
+    }
+}
+
+void bot::init(void)
+{
+    globals::dispatcher.sink<protocol::LoginResponse>().connect<&on_login_response_packet>();
+    globals::dispatcher.sink<protocol::Disconnect>().connect<&on_disconnect_packet>();
+    globals::dispatcher.sink<protocol::SpawnPlayer>().connect<&on_spawn_player_packet>();
+    globals::dispatcher.sink<protocol::PlayerStateAck>().connect<&on_player_state_ack_packet>();
+    globals::dispatcher.sink<protocol::ChunkVoxels>().connect<&on_chunk_voxels_packet>();
+    globals::dispatcher.sink<protocol::ChunkAbsent>().connect<&on_chunk_absent_packet>();
+    globals::dispatcher.sink<protocol::EntityPlayer>().connect<&on_entity_player_packet>();
+    globals::dispatcher.sink<protocol::RemoveEntity>().connect<&on_remove_entity_packet>();
+    globals::dispatcher.sink<protocol::EntitySnapshot>().connect<&on_entity_snapshot_packet>();
+}
+
+bool bot::connect(Bot &bot, const ENetAddress &address)
+{
+    bot.host = enet_host_create(nullptr, 1, protocol::NUM_CHANNELS, 0, 0);
+
+    if(!bot.host) {
+        spdlog::critical("bot: {}: unable to setup an ENet host", bot.username);
+        return false;
+    }
+
+    bot.peer = enet_host_connect(bot.host, &address, protocol::NUM_CHANNELS, 0);
+
+    if(!bot.peer) {
+        spdlog::critical("bot: {}: unable to setup an ENet peer", bot.username);
+        enet_host_destroy(bot.host);
+        bot.host = nullptr;
+        return false;
+    }
+
+    bot.peer->data = &bot;
+    bot.state = BOT_CONNECTING;
+    bot.tickrate = protocol::TICKRATE;
+    bot.connect_time = epoch::microseconds();
+
+    return true;
+}
+
+void bot::disconnect(Bot &bot)
+{
+    if(bot.host) {
+        if(bot.peer && (bot.state != BOT_DISCONNECTED)) {
+            enet_peer_disconnect(bot.peer, 0);
+            enet_host_flush(bot.host);
+        }
+
+        enet_host_destroy(bot.host);
+    }
+
+    bot.state = BOT_DISCONNECTED;
+    bot.host = nullptr;
+    bot.peer = nullptr;
+}
+
+void bot::service(Bot &bot)
+{
+    ENetEvent event = {};
+
+    if(bot.host == nullptr)
+        return;
+
+    while(enet_host_service(bot.host, &event, 0) > 0) {
+        if(event.type == ENET_EVENT_TYPE_CONNECT) {
+            protocol::LoginRequest packet = {};
+            packet.version = protocol::VERSION;
+            packet.voxel_def_checksum = voxel_def::calc_checksum();
+            packet.password_hash = bot::password_hash;
+            packet.username = bot.username;
+            protocol::send(bot.peer, nullptr, packet);
+
+            bot.state = BOT_LOGGING_IN;
+            continue;
+        }
+
+        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+            if(bot.reason.empty())
+                bot.reason = "connection lost";
+            bot.state = BOT_DISCONNECTED;
+            continue;
+        }
+
+        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+            protocol::receive(event.packet, event.peer);
+            enet_packet_destroy(event.packet);
+            continue;
+        }
+    }
+}
+
+void bot::update(Bot &bot)
+{
+    const auto curtime = epoch::microseconds();
+
+    if((bot.state != BOT_PLAYING) || (curtime < bot.next_tick))
+        return;
+
+    bot.next_tick += 1000000 / bot.tickrate;
+
+    if(bot.next_tick < curtime) {
+        // Don't try to catch up after a stall;
+        // real clients would just drop the frames too
+        bot.next_tick = curtime;
+    }
+
+    send_movement(bot);
+
+    if(bot.position.chunk != bot.cached_cpos)
+        update_wanted(bot);
+    request_chunks(bot);
+
+    if(bot.is_flooding)
+        send_flood(bot);
+
+    if(bot::edit_interval && (curtime >= bot.next_edit)) {
+        bot.next_edit += bot::edit_interval;
+        send_edit(bot);
+    }
+
+    if(bot::chat_interval && (curtime >= bot.next_chat)) {
+        bot.next_chat += bot::chat_interval;
+        send_chat(bot);
+    }
+
+    if(curtime >= bot.next_sample) {
+        bot.next_sample += SAMPLE_INTERVAL;
+        bot.rtt_sum += bot.peer->roundTripTime;
+        bot.rtt_samples += 1;
+        bot.rtt_max = cxpr::max<std::uint32_t>(bot.rtt_max, bot.peer->roundTripTime);
+    }
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk_coord.hh"
+#include "shared/world/world_coord.hh"
+
+constexpr static unsigned int BOT_CONNECTING    = 0x0000U;
+constexpr static unsigned int BOT_LOGGING_IN    = 0x0001U;
+constexpr static unsigned int BOT_PLAYING       = 0x0002U;
+constexpr static unsigned int BOT_DISCONNECTED  = 0x0003U;
+
+struct WantedChunk final {
+    std::uint64_t since {};
+    bool is_requested {};
+};
+
+struct Bot final {
+    std::string username {};
+    unsigned int state {};
+    std::string reason {};
+
+    ENetHost *host {};
+    ENetPeer *peer {};
+
+    entt::entity entity {};
+    std::uint16_t tickrate {};
+    std::uint64_t next_tick {};
+    std::uint32_t snapshot_sequence {};
+    std::uint32_t player_sequence {};
+
+    // Bots walk (or keep jumping) in circles around their
+    // centre; the phase keeps them from moving in sync
+    WorldCoord center {};
+    WorldCoord position {};
+    float phase {};
+    float angle {};
+
+    std::uint64_t connect_time {};
+    std::uint64_t spawn_time {};
+    std::uint64_t next_sample {};
+    std::uint64_t next_edit {};
+    std::uint64_t next_chat {};
+    VoxelCoord edit_coord {};
+    bool has_edit {};
+
+    // A misbehaving client; sends the same chunk request
+    // over and over to see how the server copes with that
+    bool is_flooding {};
+
+    // Chunks are what the bot has been sent so far; wanted
+    // chunks are the ones within its view that are missing,
+    // with the time they've become wanted at for latency stats
+    std::unordered_set<ChunkCoord> chunks {};
+    emhash8::HashMap<ChunkCoord, WantedChunk> wanted {};
+    ChunkCoord cached_cpos {};
+
+    std::vector<std::uint32_t> chunk_latency_us {};
+    std::uint64_t rtt_sum {};
+    std::uint64_t rtt_samples {};
+    std::uint32_t rtt_max {};
+
+    std::size_t num_chunks {};
+    std::size_t num_absent {};
+    std::size_t num_requests {};
+    std::size_t num_snapshots {};
+    std::size_t snapshot_bytes {};
+    std::size_t num_edits {};
+    std::size_t num_chats {};
+
+    // Non-chunk entities the server has told the bot about;
+    // what's been received before spawning is what the login
+    // itself has cost in both entities and bytes
+    std::unordered_set<entt::entity> entities {};
+    std::size_t num_introduced {};
+    std::size_t num_removed {};
+    std::size_t join_entities {};
+    std::size_t join_bytes {};
+};
+
+namespace bot
+{
+extern std::uint64_t password_hash;
+extern unsigned int view_distance;
+extern float speed;
+extern float radius;
+extern bool is_jumping;
+extern std::uint64_t edit_interval;
+extern std::uint64_t chat_interval;
+extern unsigned int flood;
+} // namespace bot
+
+namespace bot
+{
+void init(void);
+} // namespace bot
+
+namespace bot
+{
+bool connect(Bot &bot, const ENetAddress &address);
+void disconnect(Bot &bot);
+void service(Bot &bot);
+void update(Bot &bot);
+} // namespace bot
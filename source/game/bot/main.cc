@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "bot/precompiled.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/cmdline.hh"
+#include "common/crc64.hh"
+#include "common/epoch.hh"
+
+#include "shared/world/game_items.hh"
+#include "shared/world/game_voxels.hh"
+
+#include "shared/globals.hh"
+#include "shared/protocol.hh"
+#include "shared/setup.hh"
+
+#include "bot/bot.hh"
+
+
+constexpr static std::uint64_t STATUS_INTERVAL = 1000000;
+constexpr static std::uint64_t REPORT_INTERVAL = 5000000;
+
+// Packet types taking up less than that
+// share of the traffic are left out of the report
+constexpr static float MIN_TRAFFIC_SHARE = 0.01f;
+
+struct StatusProbe final {
+    ENetHost *host {};
+    ENetPeer *peer {};
+    bool is_connected {};
+    std::uint64_t next_request {};
+    std::vector<std::uint32_t> busy_time_us {};
+    std::uint16_t num_players {};
+};
+
+static bool is_running = false;
+static std::vector<Bot> bots = {};
+static StatusProbe status_probe = {};
+
+static void on_termination_signal(int)
+{
+    spdlog::warn("bot: received termination signal");
+    is_running = false;
+}
+
+static unsigned long get_unsigned(const std::string &option, unsigned long fallback)
+{
+    std::string value = {};
+
+    if(cmdline::get_value(option, value)) {
+        try {
+            return std::stoul(value);
+        }
+        catch(const std::exception &) {
+            spdlog::warn("bot: {}: invalid value for {}", value, option);
+        }
+    }
+
+    return fallback;
+}
+
+static float get_float(const std::string &option, float fallback)
+{
+    std::string value = {};
+
+    if(cmdline::get_value(option, value)) {
+        try {
+            return std::stof(value);
+        }
+        catch(const std::exception &) {
+            spdlog::warn("bot: {}: invalid value for {}", value, option);
+        }
+    }
+
+    return fallback;
+}
+
+static std::uint32_t percentile(std::vector<std::uint32_t> &samples, float fraction)
+{
+    if(samples.empty())
+        return 0;
+
+    const auto index = static_cast<std::size_t>(fraction * static_cast<float>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+static void on_status_response_packet(const protocol::StatusResponse &packet)
+{
+    if(packet.peer == status_probe.peer) {
+        status_probe.busy_time_us.push_back(packet.busy_time_us);
+        status_probe.num_players = packet.num_players;
+    }
+}
+
+static void service_status(void)
+{
+    ENetEvent event = {};
+
+    if(status_probe.host == nullptr)
+        return;
+
+    while(enet_host_service(status_probe.host, &event, 0) > 0) {
+        if(event.type == ENET_EVENT_TYPE_CONNECT) {
+            status_probe.is_connected = true;
+            continue;
+        }
+
+        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+            status_probe.is_connected = false;
+            continue;
+        }
+
+        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+            protocol::receive(event.packet, event.peer);
+            enet_packet_destroy(event.packet);
+            continue;
+        }
+    }
+
+    const auto curtime = epoch::microseconds();
+
+    if(status_probe.is_connected && (curtime >= status_probe.next_request)) {
+        status_probe.next_request = curtime + STATUS_INTERVAL;
+
+        protocol::StatusRequest packet = {};
+        packet.version = protocol::VERSION;
+        protocol::send(status_probe.peer, nullptr, packet);
+    }
+}
+
+static void print_progress(std::uint64_t elapsed)
+{
+    std::size_t num_playing = 0;
+    std::uint64_t rtt_sum = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+
+    for(const Bot &bot : bots) {
+        if(bot.state == BOT_PLAYING) {
+            rtt_sum += bot.peer->roundTripTime;
+            num_playing += 1;
+        }
+
+        if(bot.host) {
+            bytes_in += bot.host->totalReceivedData;
+            bytes_out += bot.host->totalSentData;
+        }
+    }
+
+    const float seconds = cxpr::max(1.0f, static_cast<float>(elapsed) / 1000000.0f);
+    const float busy_time = status_probe.busy_time_us.empty() ? 0.0f : static_cast<float>(status_probe.busy_time_us.back()) / 1000.0f;
+    const float rtt = num_playing ? static_cast<float>(rtt_sum) / static_cast<float>(num_playing) : 0.0f;
+
+    spdlog::info("bot: {:.0f}s: {}/{} playing, rtt {:.1f} ms, in {:.1f} KiB/s, out {:.1f} KiB/s, server {:.3f} MSPT",
+        seconds, num_playing, bots.size(), rtt, static_cast<float>(bytes_in) / 1024.0f / seconds,
+        static_cast<float>(bytes_out) / 1024.0f / seconds, busy_time);
+}
+
+static std::string describe_traffic(const PacketTraffic &traffic, float seconds)
+{
+    const std::uint64_t total = protocol::sum_bytes(traffic, PacketTraffic());
+
+    std::array<std::size_t, protocol::NUM_PACKET_IDS + 1> order = {};
+    std::iota(order.begin(), order.end(), std::size_t(0));
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return traffic.bytes[a] > traffic.bytes[b];
+    });
+
+    std::string result = fmt::format("{:.1f} KiB/s", static_cast<float>(total) / 1024.0f / seconds);
+
+    for(std::size_t index : order) {
+        const float share = static_cast<float>(traffic.bytes[index]) / static_cast<float>(cxpr::max<std::uint64_t>(total, 1U));
+
+        if(share < MIN_TRAFFIC_SHARE)
+            break;
+
+        result += fmt::format(", {} {:.1f}% ({} packets, {:.0f} bytes avg)", protocol::get_packet_name(static_cast<std::uint16_t>(index)),
+            100.0f * share, traffic.packets[index], static_cast<float>(traffic.bytes[index]) / static_cast<float>(traffic.packets[index]));
+    }
+
+    return result;
+}
+
+static void print_report(std::uint64_t elapsed)
+{
+    std::vector<std::uint32_t> latency = {};
+    std::vector<std::uint32_t> join_time = {};
+    std::size_t join_entities = 0;
+    std::size_t join_bytes = 0;
+    std::size_t num_introduced = 0;
+    std::size_t num_removed = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+    std::uint64_t snapshot_bytes = 0;
+    std::size_t num_playing = 0;
+    PacketTraffic traffic_in = {};
+    PacketTraffic traffic_out = {};
+
+    const float seconds = cxpr::max(1.0f, static_cast<float>(elapsed) / 1000000.0f);
+
+    spdlog::info("bot: {:<16} {:>6} {:>6} {:>6} {:>8} {:>8} {:>9} {:>9} {:>10} {:>6} {:>6}",
+        "name", "rtt", "rttmax", "chunks", "p50 ms", "p95 ms", "in KiB/s", "out KiB/s", "snap KiB/s", "edits", "chats");
+
+    for(Bot &bot : bots) {
+        const auto rtt = bot.rtt_samples ? bot.rtt_sum / bot.rtt_samples : 0;
+
+        if(bot.reason.empty() && (bot.state == BOT_CONNECTING))
+            bot.reason = "still connecting";
+        if(bot.reason.empty() && (bot.state == BOT_LOGGING_IN))
+            bot.reason = "still logging in";
+
+        const auto received = bot.host ? bot.host->totalReceivedData : 0;
+        const auto sent = bot.host ? bot.host->totalSentData : 0;
+
+        spdlog::info("bot: {:<16} {:>6} {:>6} {:>6} {:>8.1f} {:>8.1f} {:>9.1f} {:>9.1f} {:>10.2f} {:>6} {:>6}{}",
+            bot.username, rtt, bot.rtt_max, bot.num_chunks + bot.num_absent,
+            static_cast<float>(percentile(bot.chunk_latency_us, 0.50f)) / 1000.0f,
+            static_cast<float>(percentile(bot.chunk_latency_us, 0.95f)) / 1000.0f,
+            static_cast<float>(received) / 1024.0f / seconds, static_cast<float>(sent) / 1024.0f / seconds,
+            static_cast<float>(bot.snapshot_bytes) / 1024.0f / seconds, bot.num_edits, bot.num_chats, bot.reason.empty() ? std::string() : fmt::format(" ({})", bot.reason));
+
+        latency.insert(latency.end(), bot.chunk_latency_us.cbegin(), bot.chunk_latency_us.cend());
+        snapshot_bytes += bot.snapshot_bytes;
+        bytes_in += received;
+        bytes_out += sent;
+
+        if(bot.spawn_time) {
+            join_time.push_back(static_cast<std::uint32_t>(bot.spawn_time - bot.connect_time));
+            join_entities += bot.join_entities;
+            join_bytes += bot.join_bytes;
+        }
+
+        num_introduced += bot.num_introduced;
+        num_removed += bot.num_removed;
+
+        if(const PeerTraffic *traffic = protocol::find_traffic(bot.peer)) {
+            for(std::size_t i = 0; i < traffic_in.bytes.size(); ++i) {
+                traffic_in.packets[i] += traffic->received.packets[i];
+                traffic_in.bytes[i] += traffic->received.bytes[i];
+                traffic_out.packets[i] += traffic->sent.packets[i];
+                traffic_out.bytes[i] += traffic->sent.bytes[i];
+            }
+        }
+
+        if(bot.state == BOT_PLAYING) {
+            num_playing += 1;
+        }
+    }
+
+    spdlog::info("bot: {} of {} bots playing after {:.1f} seconds", num_playing, bots.size(), seconds);
+    spdlog::info("bot: chunk latency: p50 {:.1f} ms, p95 {:.1f} ms, p99 {:.1f} ms ({} chunks)",
+        static_cast<float>(percentile(latency, 0.50f)) / 1000.0f, static_cast<float>(percentile(latency, 0.95f)) / 1000.0f,
+        static_cast<float>(percentile(latency, 0.99f)) / 1000.0f, latency.size());
+    const float num_joins = cxpr::max(1.0f, static_cast<float>(join_time.size()));
+    spdlog::info("bot: join: p50 {:.1f} ms, max {:.1f} ms, {:.1f} entities and {:.0f} bytes per login; {} entities introduced, {} removed",
+        static_cast<float>(percentile(join_time, 0.50f)) / 1000.0f, static_cast<float>(percentile(join_time, 1.00f)) / 1000.0f,
+        static_cast<float>(join_entities) / num_joins, static_cast<float>(join_bytes) / num_joins, num_introduced, num_removed);
+    spdlog::info("bot: bandwidth: in {:.1f} KiB/s, out {:.1f} KiB/s, snapshots {:.2f} KiB/s", static_cast<float>(bytes_in) / 1024.0f / seconds,
+        static_cast<float>(bytes_out) / 1024.0f / seconds, static_cast<float>(snapshot_bytes) / 1024.0f / seconds);
+    spdlog::info("bot: traffic: in {}", describe_traffic(traffic_in, seconds));
+    spdlog::info("bot: traffic: out {}", describe_traffic(traffic_out, seconds));
+
+    const ChunkTraffic &chunks = protocol::chunk_traffic;
+    spdlog::info("bot: chunks: {} decoded, {:.1f} KiB from {:.1f} KiB ({:.1f}:1)", chunks.chunks,
+        static_cast<float>(chunks.raw_bytes) / 1024.0f, static_cast<float>(chunks.encoded_bytes) / 1024.0f,
+        static_cast<float>(chunks.raw_bytes) / static_cast<float>(cxpr::max<std::uint64_t>(chunks.encoded_bytes, 1U)));
+
+    if(status_probe.busy_time_us.empty()) {
+        spdlog::info("bot: server: no status responses");
+        return;
+    }
+
+    std::vector<std::uint32_t> &busy_time = status_probe.busy_time_us;
+    spdlog::info("bot: server: p50 {:.3f} MSPT, p95 {:.3f} MSPT, max {:.3f} MSPT ({} samples)",
+        static_cast<float>(percentile(busy_time, 0.50f)) / 1000.0f, static_cast<float>(percentile(busy_time, 0.95f)) / 1000.0f,
+        static_cast<float>(*std::max_element(busy_time.cbegin(), busy_time.cend())) / 1000.0f, busy_time.size());
+}
+
+int main(int argc, char **argv)
+{
+    cmdline::append(argc, argv);
+
+    shared::setup(argc, argv);
+
+    game_voxels::populate();
+    game_items::populate();
+
+    std::string hostname = {};
+    std::string password = {};
+    std::string prefix = {};
+
+    if(!cmdline::get_value("host", hostname))
+        hostname = "localhost";
+    if(!cmdline::get_value("name", prefix))
+        prefix = "bot";
+    if(cmdline::get_value("password", password))
+        bot::password_hash = crc64::get(password);
+    else bot::password_hash = crc64::get(std::string());
+
+    ENetAddress address = {};
+    address.port = static_cast<enet_uint16>(get_unsigned("port", protocol::PORT));
+
+    if(enet_address_set_host(&address, hostname.c_str()) < 0) {
+        spdlog::critical("bot: {}: unable to resolve host", hostname);
+        shared::desetup();
+        return 1;
+    }
+
+    const auto num_bots = get_unsigned("bots", 8);
+    const auto duration = 1000000 * static_cast<std::uint64_t>(get_unsigned("time", 60));
+    const auto ramp = 1000 * static_cast<std::uint64_t>(get_unsigned("ramp", 100));
+    const auto spread = static_cast<std::int32_t>(get_unsigned("spread", 1));
+
+    bot::view_distance = static_cast<unsigned int>(get_unsigned("view", bot::view_distance));
+    bot::speed = get_float("speed", bot::speed);
+    bot::radius = get_float("radius", bot::radius);
+    bot::is_jumping = cmdline::contains("jump");
+    bot::edit_interval = 1000 * static_cast<std::uint64_t>(get_unsigned("edits", bot::edit_interval / 1000));
+    bot::chat_interval = 1000 * static_cast<std::uint64_t>(get_unsigned("chat", bot::chat_interval / 1000));
+    bot::flood = static_cast<unsigned int>(get_unsigned("flood", bot::flood));
+
+    bot::init();
+
+    globals::dispatcher.sink<protocol::StatusResponse>().connect<&on_status_response_packet>();
+
+    // Bots refer to themselves through peer data
+    // so the vector must never reallocate from now on
+    bots.resize(num_bots);
+
+    for(std::size_t i = 0; i < bots.size(); ++i) {
+        bots[i].username = fmt::format("{}{}", prefix, i);
+        bots[i].state = BOT_DISCONNECTED;
+        bots[i].center.chunk = ChunkCoord(static_cast<std::int32_t>(i) * spread, 0, 0);
+        bots[i].center.local = Vec3f(0.5f * static_cast<float>(CHUNK_SIZE));
+        bots[i].phase = 2.0f * static_cast<float>(M_PI) * static_cast<float>(i) / static_cast<float>(bots.size());
+        bots[i].is_flooding = (i == 0) && (bot::flood != 0U);
+    }
+
+    status_probe.host = enet_host_create(nullptr, 1, protocol::NUM_CHANNELS, 0, 0);
+
+    if(status_probe.host) {
+        // Status queries go through their own connection
+        // just like the play menu's; the server doesn't count
+        // it as a player so it doesn't skew the results
+        status_probe.peer = enet_host_connect(status_probe.host, &address, protocol::NUM_CHANNELS, 0);
+    }
+
+    spdlog::info("bot: {} bots against {}:{}", bots.size(), hostname, address.port);
+
+    std::signal(SIGINT, &on_termination_signal);
+    std::signal(SIGTERM, &on_termination_signal);
+
+    is_running = true;
+
+    const auto start_time = epoch::microseconds();
+    std::uint64_t next_report = start_time + REPORT_INTERVAL;
+    std::size_t num_started = 0;
+
+    while(is_running) {
+        const auto curtime = epoch::microseconds();
+
+        if((curtime - start_time) >= duration)
+            break;
+
+        // Bots join one after another instead of all
+        // at once; a server is rarely hit by a whole swarm
+        while((num_started < bots.size()) && ((curtime - start_time) >= (num_started * ramp))) {
+            bot::connect(bots[num_started], address);
+            num_started += 1;
+        }
+
+        for(Bot &bot : bots) {
+            bot::service(bot);
+            bot::update(bot);
+        }
+
+        service_status();
+
+        if(curtime >= next_report) {
+            next_report += REPORT_INTERVAL;
+            print_progress(curtime - start_time);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    print_report(epoch::microseconds() - start_time);
+
+    for(Bot &bot : bots) {
+        bot::disconnect(bot);
+    }
+
+    if(status_probe.host) {
+        if(status_probe.peer)
+            enet_peer_disconnect(status_probe.peer, 0);
+        enet_host_flush(status_probe.host);
+        enet_host_destroy(status_probe.host);
+    }
+
+    shared::desetup();
+
+    return 0;
+}
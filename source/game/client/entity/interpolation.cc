@@ -2,15 +2,134 @@
 #include "client/precompiled.hh"
 #include "client/entity/interpolation.hh"
 
+#include "mathlib/constexpr.hh"
+
 #include "shared/entity/head.hh"
 #include "shared/entity/transform.hh"
+#include "shared/entity/velocity.hh"
+
+#include "shared/protocol.hh"
 
 #include "client/globals.hh"
 
 
+// Arrival jitter is smoothed the same way RTP does it;
+// the clock offset is smoothed just as slowly so that the
+// render time never jumps around with individual packets
+constexpr static std::int64_t JITTER_GAIN = 16;
+constexpr static std::int64_t OFFSET_GAIN = 16;
+constexpr static std::int64_t DELAY_GAIN = 32;
+
+// Anything further off than that is not jitter; the
+// server has either stalled or the clock went somewhere else
+constexpr static std::int64_t RESYNC_THRESHOLD = INT64_C(1000000);
+
+// The render delay covers a single tick between two samples
+// and twice the jitter on top of that, within reasonable limits
+constexpr static std::int64_t MAX_DELAY = INT64_C(250000);
+
+// States are extrapolated past the newest sample
+// for this long at most; after that entities just stop
+constexpr static std::int64_t MAX_EXTRAPOLATION = INT64_C(200000);
+
+// The server leaves unchanged states out; a state that comes
+// after a longer silence than the server's longest update interval
+// means the entity has been standing still up until just now
+constexpr static std::uint64_t MAX_SAMPLE_GAP = UINT64_C(8);
+
+float interpolation::delay = 0.0f;
+float interpolation::jitter = 0.0f;
+std::size_t interpolation::num_extrapolated = 0;
+
+static bool has_clock = false;
+static std::int64_t clock_offset = INT64_C(0);
+static std::int64_t last_sample = INT64_C(0);
+static std::int64_t jitter_us = INT64_C(0);
+static std::int64_t delay_us = INT64_C(0);
+
+static std::int64_t tick_time(std::uint64_t tick)
+{
+    return static_cast<std::int64_t>(tick * globals::fixed_frametime_us);
+}
+
+static void blend(const InterpolationSample &a, const InterpolationSample &b, float alpha, TransformComponentIntr &transform, HeadComponentIntr &head)
+{
+    // Same as below; the older position is transformed into
+    // the newer one's chunk domain before being interpolated
+    const auto a_local = b.position.local + WorldCoord::to_vec3f(b.position, a.position);
+    const auto angles = Vec3angles::wrap_180(b.angles - a.angles);
+    const auto head_angles = Vec3angles::wrap_180(b.head - a.head);
+
+    transform.position.chunk = b.position.chunk;
+
+    for(std::size_t i = 0; i < 3; ++i) {
+        transform.position.local[i] = cxpr::lerp(a_local[i], b.position.local[i], alpha);
+        transform.angles[i] = a.angles[i] + angles[i] * alpha;
+        head.angles[i] = a.head[i] + head_angles[i] * alpha;
+    }
+}
+
+static void extrapolate(const InterpolationSample &sample, std::int64_t time, TransformComponentIntr &transform, HeadComponentIntr &head)
+{
+    const float seconds = static_cast<float>(time) / 1000000.0f;
+
+    transform.position.chunk = sample.position.chunk;
+    transform.position.local = sample.position.local + sample.linear * seconds;
+    transform.angles = sample.angles;
+    head.angles = sample.head;
+}
+
+static void buffer_interpolate(std::int64_t render_time)
+{
+    auto view = globals::registry.view<InterpolationBuffer, HeadComponent, HeadComponentIntr, TransformComponentIntr>();
+
+    for(auto [entity, buffer, current_head, head, transform] : view.each()) {
+        if(buffer.count == 0)
+            continue;
+
+        const std::size_t first = buffer.count - cxpr::min(buffer.count, interpolation::BUFFER_SIZE);
+        const std::size_t last = buffer.count - 1;
+
+        head.position = current_head.position;
+
+        const InterpolationSample &newest = buffer.samples[last % interpolation::BUFFER_SIZE];
+        const std::int64_t newest_time = tick_time(newest.tick);
+
+        if(!has_clock || (render_time >= newest_time)) {
+            const std::int64_t late = has_clock ? (render_time - newest_time) : INT64_C(0);
+
+            if(late && (newest.linear != Vec3f::zero()))
+                interpolation::num_extrapolated += 1;
+            extrapolate(newest, cxpr::min(late, MAX_EXTRAPOLATION), transform, head);
+            continue;
+        }
+
+        std::size_t index = last;
+
+        while((index > first) && (tick_time(buffer.samples[(index - 1) % interpolation::BUFFER_SIZE].tick) > render_time)) {
+            index -= 1;
+        }
+
+        const InterpolationSample &b = buffer.samples[index % interpolation::BUFFER_SIZE];
+
+        if(index == first) {
+            // Everything buffered is still in the
+            // future; hold on to the oldest state there is
+            extrapolate(b, INT64_C(0), transform, head);
+            continue;
+        }
+
+        const InterpolationSample &a = buffer.samples[(index - 1) % interpolation::BUFFER_SIZE];
+        const std::int64_t a_time = tick_time(a.tick);
+        const float alpha = static_cast<float>(render_time - a_time) / static_cast<float>(tick_time(b.tick) - a_time);
+
+        blend(a, b, alpha, transform, head);
+    }
+}
+
 static void head_interpolate(float alpha)
 {
-    auto group = globals::registry.group<HeadComponentIntr>(entt::get<HeadComponent, HeadComponentPrev>);
+    auto group = globals::registry.group<HeadComponentIntr>(entt::get<HeadComponent, HeadComponentPrev>, entt::exclude<InterpolationBuffer>);
 
     for(auto [entity, interp, current, previous] : group.each()) {
         interp.angles[0] = cxpr::lerp(previous.angles[0], current.angles[0], alpha);
@@ -25,7 +144,7 @@ static void head_interpolate(float alpha)
 
 static void transform_interpolate(float alpha)
 {
-    auto group = globals::registry.group<TransformComponentIntr>(entt::get<TransformComponent, TransformComponentPrev>);
+    auto group = globals::registry.group<TransformComponentIntr>(entt::get<TransformComponent, TransformComponentPrev>, entt::exclude<InterpolationBuffer>);
 
     for(auto [entity, interp, current, previous] : group.each()) {
         interp.angles[0] = cxpr::lerp(previous.angles[0], current.angles[0], alpha);
@@ -48,6 +167,24 @@ static void transform_interpolate(float alpha)
     }
 }
 
+static void on_login_response_packet(const protocol::LoginResponse &packet)
+{
+    has_clock = false;
+    clock_offset = INT64_C(0);
+    last_sample = INT64_C(0);
+    jitter_us = INT64_C(0);
+    delay_us = INT64_C(0);
+
+    interpolation::delay = 0.0f;
+    interpolation::jitter = 0.0f;
+    interpolation::num_extrapolated = 0;
+}
+
+void interpolation::init(void)
+{
+    globals::dispatcher.sink<protocol::LoginResponse>().connect<&on_login_response_packet>();
+}
+
 void interpolation::update(void)
 {
     const auto alpha = static_cast<float>(globals::fixed_accumulator) / static_cast<float>(globals::fixed_frametime_us);
@@ -55,4 +192,75 @@ void interpolation::update(void)
     head_interpolate(alpha);
 
     transform_interpolate(alpha);
+
+    interpolation::num_extrapolated = 0;
+
+    buffer_interpolate(static_cast<std::int64_t>(globals::curtime) + clock_offset - delay_us);
+}
+
+void interpolation::receive(std::uint64_t tick)
+{
+    if(globals::fixed_frametime_us == UINT64_MAX) {
+        // Not in a session
+        return;
+    }
+
+    const std::int64_t tick_us = static_cast<std::int64_t>(globals::fixed_frametime_us);
+    const std::int64_t sample = tick_time(tick) - static_cast<std::int64_t>(globals::curtime);
+
+    if(!has_clock || (std::abs(sample - clock_offset) > RESYNC_THRESHOLD)) {
+        has_clock = true;
+        clock_offset = sample;
+        last_sample = sample;
+        jitter_us = INT64_C(0);
+        delay_us = tick_us;
+    }
+    else {
+        // The difference between two consecutive samples is how
+        // much later (or sooner) the second one has arrived than
+        // the server ticks between them alone would suggest
+        jitter_us += (std::abs(sample - last_sample) - jitter_us) / JITTER_GAIN;
+        clock_offset += (sample - clock_offset) / OFFSET_GAIN;
+        last_sample = sample;
+
+        const std::int64_t target = cxpr::clamp(tick_us + 2 * jitter_us, tick_us, MAX_DELAY);
+        delay_us += (target - delay_us) / DELAY_GAIN;
+    }
+
+    interpolation::delay = static_cast<float>(delay_us) / 1000.0f;
+    interpolation::jitter = static_cast<float>(jitter_us) / 1000.0f;
+}
+
+void interpolation::push(entt::entity entity, std::uint64_t tick)
+{
+    const auto &transform = globals::registry.get<TransformComponent>(entity);
+    const auto &head = globals::registry.get<HeadComponent>(entity);
+    const auto velocity = globals::registry.try_get<VelocityComponent>(entity);
+
+    auto &buffer = globals::registry.get_or_emplace<InterpolationBuffer>(entity);
+
+    if(buffer.count) {
+        const InterpolationSample newest = buffer.samples[(buffer.count - 1) % interpolation::BUFFER_SIZE];
+
+        if(tick <= newest.tick) {
+            // Snapshots are sequenced
+            return;
+        }
+
+        if((tick - newest.tick) > MAX_SAMPLE_GAP) {
+            InterpolationSample &rest = buffer.samples[buffer.count % interpolation::BUFFER_SIZE];
+            rest = newest;
+            rest.tick = tick - 1U;
+            rest.linear = Vec3f::zero();
+            buffer.count += 1;
+        }
+    }
+
+    InterpolationSample &sample = buffer.samples[buffer.count % interpolation::BUFFER_SIZE];
+    sample.tick = tick;
+    sample.position = transform.position;
+    sample.angles = transform.angles;
+    sample.head = head.angles;
+    sample.linear = velocity ? velocity->linear : Vec3f::zero();
+    buffer.count += 1;
 }
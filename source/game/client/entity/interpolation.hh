@@ -1,7 +1,52 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
+#include "mathlib/vec3angles.hh"
+#include "shared/world/world_coord.hh"
 
 namespace interpolation
 {
+constexpr static std::size_t BUFFER_SIZE = 16;
+} // namespace interpolation
+
+struct InterpolationSample final {
+    std::uint64_t tick {};
+    WorldCoord position {};
+    Vec3angles angles {};
+    Vec3angles head {};
+    Vec3f linear {};
+};
+
+// Remote entities' states are buffered together with the
+// server tick they've been captured at and rendered a little
+// in the past so that there's nearly always a pair of them
+// to blend between regardless of how the packets arrived
+struct InterpolationBuffer final {
+    std::array<InterpolationSample, interpolation::BUFFER_SIZE> samples {};
+    std::size_t count {};
+};
+
+namespace interpolation
+{
+// Render delay and arrival jitter are in milliseconds;
+// the number of extrapolated entities is from the last frame
+extern float delay;
+extern float jitter;
+extern std::size_t num_extrapolated;
+} // namespace interpolation
+
+namespace interpolation
+{
+void init(void);
 void update(void);
 } // namespace interpolation
+
+namespace interpolation
+{
+// Synchronises the server clock with
+// a snapshot that has just been received
+void receive(std::uint64_t tick);
+
+// Captures the entity's current state
+// into its buffer as of the server tick
+void push(entt::entity entity, std::uint64_t tick);
+} // namespace interpolation
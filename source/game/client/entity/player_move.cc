@@ -9,12 +9,13 @@
 #include "mathlib/constexpr.hh"
 #include "mathlib/vec2f.hh"
 
-#include "shared/entity/gravity.hh"
-#include "shared/entity/grounded.hh"
 #include "shared/entity/head.hh"
+#include "shared/entity/pmove.hh"
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
+#include "client/entity/player_state.hh"
+
 #include "client/gui/gui_screen.hh"
 #include "client/gui/settings.hh"
 
@@ -36,40 +37,6 @@ static std::uint64_t next_jump = UINT64_C(0);
 
 static std::shared_ptr<const SoundEffect> sfx_jump = nullptr;
 
-static Vec3f accelerate(const Vec3f &wish_dir, const Vec3f &velocity, float wish_speed, float accel)
-{
-    const auto current_speed = Vec3f::dot(velocity, wish_dir);
-    const auto add_speed = wish_speed - current_speed;
-
-    if(add_speed <= 0.0f) {
-        // Not accelerating
-        return velocity;
-    }
-
-    const auto accel_speed = cxpr::min(add_speed, accel * globals::fixed_frametime * wish_speed);
-
-    auto result = Vec3f(velocity);
-    result[0] += accel_speed * wish_dir[0];
-    result[2] += accel_speed * wish_dir[2];
-    return result;
-}
-
-static Vec3f air_move(const Vec3f &wish_dir, const Vec3f &velocity)
-{
-    return accelerate(wish_dir, velocity, PMOVE_ACCELERATION_AIR, PMOVE_MAX_SPEED_AIR);
-}
-
-static Vec3f ground_move(const Vec3f &wish_dir, const Vec3f &velocity)
-{
-    if(const auto speed = Vec3f::length(velocity)) {
-        const auto speed_drop = speed * PMOVE_FRICTION_GROUND * globals::fixed_frametime;
-        const auto speed_factor = cxpr::max(speed - speed_drop, 0.0f) / speed;
-        return accelerate(wish_dir, velocity * speed_factor, PMOVE_ACCELERATION_GROUND, PMOVE_MAX_SPEED_GROUND);
-    }
-
-    return accelerate(wish_dir, velocity, PMOVE_ACCELERATION_GROUND, PMOVE_MAX_SPEED_GROUND);
-}
-
 void player_move::init(void)
 {
     prev_speed_xz = 0.0f;
@@ -102,44 +69,31 @@ void player_move::fixed_update(void)
     }
 
     const auto &head = globals::registry.get<HeadComponent>(globals::player);
-    auto &transform = globals::registry.get<TransformComponent>(globals::player);
-    auto &velocity = globals::registry.get<VelocityComponent>(globals::player);
+    const auto &transform = globals::registry.get<TransformComponent>(globals::player);
+    const auto &velocity = globals::registry.get<VelocityComponent>(globals::player);
 
     // Interpolation - preserve current component states
     globals::registry.emplace_or_replace<TransformComponentPrev>(globals::player, transform);
 
-    Vec3f forward, right;
-    Vec3angles::vectors(Vec3angles(0.0f, head.angles[1], 0.0f), &forward, &right, nullptr);
-
-    Vec3f wish_dir = Vec3f::zero();
-    Vec3f move_vars_xz = Vec3f(pmove_wish_dir.get_x(), 0.0f, pmove_wish_dir.get_z());
-    wish_dir.set_x(Vec3f::dot(move_vars_xz, right));
-    wish_dir.set_z(Vec3f::dot(move_vars_xz, forward));
-
-    const auto is_grounded = globals::registry.any_of<GroundedComponent>(globals::player);
-    const auto velocity_xz = Vec3f(velocity.linear.get_x(), 0.0f, velocity.linear.get_z());
-
-    if(is_grounded) {
-        const auto xz = ground_move(wish_dir, velocity_xz);
-        velocity.linear.set_x(xz.get_x());
-        velocity.linear.set_z(xz.get_z());
-    }
-    else {
-        const auto xz = air_move(wish_dir, velocity_xz);
-        velocity.linear.set_x(xz.get_x());
-        velocity.linear.set_z(xz.get_z());
-    }
-
     if(pmove_wish_dir.get_y() == 0.0f) {
         // Allow players to spam the jump key to
         // bunnyhop, otherwise jumping is done on a cooldown
         next_jump = UINT64_C(0);
-        return;
     }
 
-    if(is_grounded && (pmove_wish_dir.get_y() > 0.0f) && (globals::curtime >= next_jump)) {
-        velocity.linear.set_y(GravityComponent::acceleration * 0.275f);
+    PlayerCommand command = {};
+    command.wish_dir = Vec3f(pmove_wish_dir.get_x(), 0.0f, pmove_wish_dir.get_z());
+    command.head = head.angles;
+    command.jump = (pmove_wish_dir.get_y() > 0.0f) && (globals::curtime >= next_jump);
+    pmove::quantise(command);
+
+    // Movement is predicted right away; the command
+    // is then remembered so it can be sent to the server
+    // and replayed if the server happens to disagree with us
+    const bool has_jumped = pmove::simulate(globals::player, command);
+    player_state::push(command);
 
+    if(has_jumped) {
         auto new_speed_xz = Vec2f::length(Vec2f(velocity.linear.get_x(), velocity.linear.get_z()));
         auto new_speed_text = fmt::format("{:.02f} M/S", new_speed_xz);
         auto speed_change_xz = new_speed_xz - prev_speed_xz;
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "client/precompiled.hh"
+#include "client/entity/player_state.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/epoch.hh"
+
+#include "shared/entity/grounded.hh"
+#include "shared/entity/pmove.hh"
+#include "shared/entity/transform.hh"
+#include "shared/entity/velocity.hh"
+
+#include "shared/protocol.hh"
+
+#include "client/globals.hh"
+#include "client/session.hh"
+
+
+// Commands are kept around for a few seconds; anything
+// older than that can't be acknowledged in any sensible time
+constexpr static std::size_t HISTORY_SIZE = 256;
+
+// The server state is taken as is only if it's
+// further than that from what has been predicted
+constexpr static float POSITION_TOLERANCE = 1.0f / 256.0f;
+constexpr static float VELOCITY_TOLERANCE = 1.0f / 64.0f;
+
+// A command that is the same as the previous one and
+// didn't change anything is not sent; the server doesn't
+// run it and ends up in the very same state regardless
+constexpr static float IDLE_EPSILON = 1.0e-4f;
+
+// Unacknowledged commands are repeated every so
+// often even if there's nothing new to be sent
+constexpr static std::uint64_t RESEND_INTERVAL = UINT64_C(100000);
+
+struct PredictedCommand final {
+    PlayerCommand command {};
+    WorldCoord position {};
+    Vec3f linear {};
+    bool is_sent {};
+};
+
+std::size_t player_state::num_corrections = 0;
+float player_state::correction_distance = 0.0f;
+std::size_t player_state::replay_commands = 0;
+std::uint64_t player_state::replay_time_us = 0;
+
+static std::array<PredictedCommand, HISTORY_SIZE> history = {};
+static std::uint32_t sequence = UINT32_C(0);
+static std::uint32_t acknowledged = UINT32_C(0);
+static std::uint32_t last_sent = UINT32_C(0);
+static std::uint64_t last_send_time = UINT64_C(0);
+
+static PredictedCommand *find(std::uint32_t value)
+{
+    PredictedCommand &entry = history[value % HISTORY_SIZE];
+    if(value && (entry.command.sequence == value))
+        return &entry;
+    return nullptr;
+}
+
+// Commands are quantised before they're pushed so the
+// comparison is exact; any head turn the server would see
+// makes the command different and gets it sent over
+static bool is_same(const PlayerCommand &a, const PlayerCommand &b)
+{
+    return (a.wish_dir == b.wish_dir) && (a.head == b.head) && (a.jump == b.jump);
+}
+
+static bool is_idle(const PredictedCommand &previous, const PredictedCommand &entry)
+{
+    if(!is_same(previous.command, entry.command))
+        return false;
+    if(Vec3f::length(WorldCoord::to_vec3f(previous.position, entry.position)) > IDLE_EPSILON)
+        return false;
+    return Vec3f::length(entry.linear - previous.linear) <= IDLE_EPSILON;
+}
+
+static void on_login_response_packet(const protocol::LoginResponse &packet)
+{
+    history.fill(PredictedCommand());
+    sequence = UINT32_C(0);
+    acknowledged = UINT32_C(0);
+    last_sent = UINT32_C(0);
+    last_send_time = UINT64_C(0);
+
+    player_state::num_corrections = 0;
+    player_state::correction_distance = 0.0f;
+    player_state::replay_commands = 0;
+    player_state::replay_time_us = 0;
+}
+
+static void on_player_state_ack_packet(const protocol::PlayerStateAck &packet)
+{
+    if(!globals::registry.valid(globals::player))
+        return;
+    if((packet.sequence <= acknowledged) || (packet.sequence > sequence))
+        return;
+
+    acknowledged = packet.sequence;
+
+    auto &transform = globals::registry.get<TransformComponent>(globals::player);
+    auto &velocity = globals::registry.get<VelocityComponent>(globals::player);
+
+    PredictedCommand *entry = find(packet.sequence);
+    const WorldCoord &predicted = entry ? entry->position : transform.position;
+    const float distance = Vec3f::length(WorldCoord::to_vec3f(predicted, packet.coord));
+
+    if(entry && (distance <= POSITION_TOLERANCE) && (Vec3f::length(entry->linear - packet.linear) <= VELOCITY_TOLERANCE)) {
+        // The prediction was right
+        return;
+    }
+
+    const std::uint64_t begin = epoch::microseconds();
+
+    transform.position = packet.coord;
+    velocity.linear = packet.linear;
+
+    if(packet.is_grounded)
+        globals::registry.emplace_or_replace<GroundedComponent>(globals::player);
+    else globals::registry.remove<GroundedComponent>(globals::player);
+
+    std::size_t count = 0;
+
+    for(std::uint32_t i = packet.sequence + 1U; i <= sequence; ++i) {
+        if(PredictedCommand *later = find(i)) {
+            if(later->is_sent) {
+                pmove::simulate(globals::player, later->command);
+                count += 1;
+            }
+
+            later->position = transform.position;
+            later->linear = velocity.linear;
+        }
+    }
+
+    if(entry) {
+        entry->position = packet.coord;
+        entry->linear = packet.linear;
+    }
+
+    player_state::num_corrections += 1;
+    player_state::correction_distance = distance;
+    player_state::replay_commands = count;
+    player_state::replay_time_us = epoch::microseconds() - begin;
+}
+
+void player_state::init(void)
+{
+    history.fill(PredictedCommand());
+    sequence = UINT32_C(0);
+    acknowledged = UINT32_C(0);
+    last_sent = UINT32_C(0);
+
+    globals::dispatcher.sink<protocol::LoginResponse>().connect<&on_login_response_packet>();
+    globals::dispatcher.sink<protocol::PlayerStateAck>().connect<&on_player_state_ack_packet>();
+}
+
+void player_state::fixed_update_late(void)
+{
+    if(!session::peer || !globals::registry.valid(globals::player))
+        return;
+
+    protocol::PlayerCommands packet = {};
+
+    const std::uint32_t window = static_cast<std::uint32_t>(protocol::MAX_PLAYER_COMMANDS);
+    const std::uint32_t first = cxpr::max(acknowledged + 1U, (sequence > window) ? (sequence - window + 1U) : 1U);
+
+    for(std::uint32_t i = first; i <= sequence; ++i) {
+        if(const PredictedCommand *entry = find(i)) {
+            if(entry->is_sent) {
+                packet.commands.push_back(entry->command);
+            }
+        }
+    }
+
+    if(packet.commands.empty())
+        return;
+
+    const std::uint32_t newest = packet.commands.back().sequence;
+
+    if((newest <= last_sent) && ((globals::curtime - last_send_time) < RESEND_INTERVAL))
+        return;
+
+    protocol::send(session::peer, nullptr, packet);
+
+    last_sent = newest;
+    last_send_time = globals::curtime;
+}
+
+void player_state::push(const PlayerCommand &command)
+{
+    const auto &transform = globals::registry.get<TransformComponent>(globals::player);
+    const auto &velocity = globals::registry.get<VelocityComponent>(globals::player);
+
+    sequence += 1U;
+
+    PredictedCommand &entry = history[sequence % HISTORY_SIZE];
+    entry.command = command;
+    entry.command.sequence = sequence;
+    entry.position = transform.position;
+    entry.linear = velocity.linear;
+
+    const PredictedCommand *previous = find(sequence - 1U);
+    entry.is_sent = !previous || !is_idle(*previous, entry);
+}
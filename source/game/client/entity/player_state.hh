@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+struct PlayerCommand;
+
+// Local player movement is predicted by running player commands
+// right away; commands are uploaded to the server which runs them
+// as well and acknowledges the result. Whenever the result differs
+// from what has been predicted, the server state is taken as is and
+// the commands the server hasn't acknowledged yet are run on top of it
+namespace player_state
+{
+extern std::size_t num_corrections;
+extern float correction_distance;
+extern std::size_t replay_commands;
+extern std::uint64_t replay_time_us;
+} // namespace player_state
+
+namespace player_state
+{
+void init(void);
+void fixed_update_late(void);
+} // namespace player_state
+
+namespace player_state
+{
+// Remembers a command that has just been run
+// on the local player together with its outcome
+void push(const PlayerCommand &command);
+} // namespace player_state
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "client/precompiled.hh"
+#include "client/entity/snapshots.hh"
+
+#include "common/packet_buffer.hh"
+
+#include "shared/entity/head.hh"
+#include "shared/entity/snapshot.hh"
+#include "shared/entity/transform.hh"
+
+#include "shared/protocol.hh"
+
+#include "client/entity/interpolation.hh"
+
+#include "client/globals.hh"
+#include "client/session.hh"
+
+
+static SnapshotHistory history = {};
+static std::vector<entt::entity> changed = {};
+static std::unordered_set<entt::entity> synced = {};
+
+static void on_login_response_packet(const protocol::LoginResponse &packet)
+{
+    snapshot::reset(history);
+    synced.clear();
+}
+
+static void on_entity_snapshot_packet(const protocol::EntitySnapshot &packet)
+{
+    if(!session::peer)
+        return;
+
+    if(packet.sequence <= history.sequence) {
+        // Snapshots are sequenced on the channel level
+        // but a stale one never hurts to be checked for
+        return;
+    }
+
+    const Snapshot *baseline = snapshot::find(history, packet.baseline);
+
+    if(packet.baseline && !baseline) {
+        // The baseline has fallen out of the history; the
+        // server will eventually notice the lack of acknowledgements
+        // and encode snapshots against something we still have
+        return;
+    }
+
+    interpolation::receive(packet.tick);
+
+    PacketBuffer reader = {};
+    PacketBuffer::setup(reader, packet.payload.data(), packet.payload.size());
+
+    Snapshot current = {};
+
+    if(!snapshot::decode(reader, baseline, current, changed)) {
+        spdlog::warn("snapshots: malformed snapshot {}", packet.sequence);
+        return;
+    }
+
+    std::sort(changed.begin(), changed.end());
+
+    for(const SnapshotEntry &entry : current) {
+        if((entry.entity == globals::player) || !globals::registry.valid(entry.entity)) {
+            // Entities are introduced with reliable packets which
+            // may still be on their way here; the snapshot is kept
+            // around as a baseline regardless of that
+            continue;
+        }
+
+        if(!std::binary_search(changed.cbegin(), changed.cend(), entry.entity) && synced.count(entry.entity)) {
+            // Unchanged since the last time
+            continue;
+        }
+
+        snapshot::apply(entry.entity, entry.state);
+        interpolation::push(entry.entity, packet.tick);
+    }
+
+    // Entities that were not valid when their state was first
+    // received are caught up with the next snapshot; this also covers
+    // unreliable introduction packets that never made it here
+    synced.clear();
+
+    for(const SnapshotEntry &entry : current) {
+        if(globals::registry.valid(entry.entity)) {
+            synced.insert(entry.entity);
+        }
+    }
+
+    snapshot::store(history, packet.sequence) = std::move(current);
+    history.sequence = packet.sequence;
+
+    protocol::SnapshotAck response = {};
+    response.sequence = packet.sequence;
+    protocol::send(session::peer, nullptr, response);
+}
+
+void client_snapshots::init(void)
+{
+    snapshot::reset(history);
+
+    globals::dispatcher.sink<protocol::LoginResponse>().connect<&on_login_response_packet>();
+    globals::dispatcher.sink<protocol::EntitySnapshot>().connect<&on_entity_snapshot_packet>();
+}
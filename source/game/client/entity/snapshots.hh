@@ -0,0 +1,7 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+namespace client_snapshots
+{
+void init(void);
+} // namespace client_snapshots
@@ -31,7 +31,9 @@
 #include "client/entity/interpolation.hh"
 #include "client/entity/player_look.hh"
 #include "client/entity/player_move.hh"
+#include "client/entity/player_state.hh"
 #include "client/entity/player_target.hh"
+#include "client/entity/snapshots.hh"
 #include "client/entity/sound_emitter.hh"
 
 #include "client/event/glfw_framebuffer_size.hh"
@@ -58,6 +60,7 @@
 #include "client/sound/listener.hh"
 #include "client/sound/sound.hh"
 
+#include "client/world/chunk_cache.hh"
 #include "client/world/chunk_mesher.hh"
 #include "client/world/chunk_renderer.hh"
 #include "client/world/chunk_visibility.hh"
@@ -201,7 +204,7 @@ void client_game::init(void)
     settings::add_stepper(3, settings::VIDEO, "game.fog_mode", client_game::fog_mode, 3U, false);
     settings::add_input(1, settings::GENERAL, "game.username", client_game::username, true, false);
 
-    globals::client_host = enet_host_create(nullptr, 1, 1, 0, 0);
+    globals::client_host = enet_host_create(nullptr, 1, protocol::NUM_CHANNELS, 0, 0);
 
     if(!globals::client_host) {
         spdlog::critical("game: unable to setup an ENet host");
@@ -213,8 +216,13 @@ void client_game::init(void)
     session::init();
 
     player_move::init();
+    player_state::init();
     player_target::init();
 
+    client_snapshots::init();
+
+    interpolation::init();
+
     keynames::init();
     keyboard::init();
     mouse::init();
@@ -225,8 +233,11 @@ void client_game::init(void)
 
     voxel_anims::init();
 
+    client_chunk_cache::init();
+
     chunk_mesher::init();
     chunk_renderer::init();
+    chunk_visibility::init();
 
     skybox::init();
 
@@ -410,6 +421,8 @@ void client_game::deinit(void)
 
     session::deinit();
 
+    client_chunk_cache::deinit();
+
     sound::deinit();
 
     hotbar::deinit();
@@ -470,11 +483,9 @@ void client_game::fixed_update(void)
 
 void client_game::fixed_update_late(void)
 {
-    if(globals::registry.valid(globals::player)) {
-        protocol::send_entity_head(session::peer, nullptr, globals::player);
-        protocol::send_entity_transform(session::peer, nullptr, globals::player);
-        protocol::send_entity_velocity(session::peer, nullptr, globals::player);
-    }
+    protocol::begin_frame();
+    player_state::fixed_update_late();
+    protocol::end_frame();
 }
 
 void client_game::update(void)
@@ -499,6 +510,8 @@ void client_game::update(void)
 
     voxel_anims::update();
 
+    client_chunk_cache::update();
+
     chunk_mesher::update();
 
     chunk_visibility::update();
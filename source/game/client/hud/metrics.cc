@@ -4,23 +4,81 @@
 
 #include "cmake/config.hh"
 
+#include "mathlib/constexpr.hh"
+
+#include "common/epoch.hh"
+
 #include "shared/entity/grounded.hh"
 #include "shared/entity/head.hh"
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
+#include "shared/protocol.hh"
+
+#include "client/entity/interpolation.hh"
+#include "client/entity/player_state.hh"
+
 #include "client/gui/imdraw_ext.hh"
 
 #include "client/game.hh"
 #include "client/globals.hh"
+#include "client/session.hh"
 #include "client/view.hh"
 
 
 constexpr static ImGuiWindowFlags WINDOW_FLAGS = ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoNav;
 
+// Traffic rates are averaged over that many
+// microseconds so that the numbers are readable
+constexpr static std::uint64_t TRAFFIC_INTERVAL = UINT64_C(1000000);
+
 static std::string gl_version = {};
 static std::string gl_renderer = {};
 
+static std::uint64_t traffic_time = 0;
+static PeerTraffic last_traffic = {};
+static std::string traffic_line = {};
+
+static void update_traffic(const PeerTraffic &traffic)
+{
+    const std::uint64_t curtime = epoch::microseconds();
+
+    if(last_traffic.connect_id != traffic.connect_id) {
+        last_traffic = traffic;
+        traffic_time = curtime;
+        traffic_line = "net: in 0.0 KiB/s, out 0.0 KiB/s";
+        return;
+    }
+
+    if((curtime - traffic_time) < TRAFFIC_INTERVAL)
+        return;
+
+    const auto seconds = static_cast<float>(curtime - traffic_time) / 1000000.0f;
+    const std::uint64_t bytes_in = protocol::sum_bytes(traffic.received, last_traffic.received);
+    const std::uint64_t bytes_out = protocol::sum_bytes(traffic.sent, last_traffic.sent);
+
+    // Whatever takes up most of the downlink
+    // is what's usually worth looking at
+    std::size_t top = 0;
+
+    for(std::size_t i = 1; i < traffic.received.bytes.size(); ++i) {
+        if((traffic.received.bytes[i] - last_traffic.received.bytes[i]) > (traffic.received.bytes[top] - last_traffic.received.bytes[top])) {
+            top = i;
+        }
+    }
+
+    traffic_line = fmt::format("net: in {:.1f} KiB/s, out {:.1f} KiB/s", static_cast<float>(bytes_in) / 1024.0f / seconds,
+        static_cast<float>(bytes_out) / 1024.0f / seconds);
+
+    if(bytes_in) {
+        const auto percent = 100.0f * static_cast<float>(traffic.received.bytes[top] - last_traffic.received.bytes[top]) / static_cast<float>(bytes_in);
+        traffic_line += fmt::format(", {:.0f}% {}", percent, protocol::get_packet_name(static_cast<std::uint16_t>(top)));
+    }
+
+    last_traffic = traffic;
+    traffic_time = curtime;
+}
+
 void metrics::init(void)
 {
     gl_version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
@@ -87,4 +145,40 @@ void metrics::layout(void)
     auto angle_line = fmt::format("angle: [{: .03f} {: .03f} {: .03f}]", angles.get_x(), angles.get_y(), angles.get_z());
     imdraw_ext::text_shadow(angle_line, position, text_color, shadow_color, globals::font_debug, draw_list);
     position.y += y_step;
+
+    // Draw movement prediction metrics
+    auto prediction_line = fmt::format("pred: {} corrections, last {:.03f} M, replayed {} cmds in {} us",
+        player_state::num_corrections, player_state::correction_distance, player_state::replay_commands, player_state::replay_time_us);
+    imdraw_ext::text_shadow(prediction_line, position, text_color, shadow_color, globals::font_debug, draw_list);
+    position.y += y_step;
+
+    // Draw remote entity interpolation metrics
+    auto interpolation_line = fmt::format("interp: delay {:.01f} ms, jitter {:.01f} ms, {} extrapolated",
+        interpolation::delay, interpolation::jitter, interpolation::num_extrapolated);
+    imdraw_ext::text_shadow(interpolation_line, position, text_color, shadow_color, globals::font_debug, draw_list);
+    position.y += y_step;
+
+    if(session::peer == nullptr)
+        return;
+
+    // Draw ENet connection metrics
+    auto loss = 100.0f * static_cast<float>(session::peer->packetLoss) / static_cast<float>(ENET_PEER_PACKET_LOSS_SCALE);
+    auto connection_line = fmt::format("net: rtt {}±{} ms, loss {:.1f}%, {} B in transit",
+        session::peer->roundTripTime, session::peer->roundTripTimeVariance, loss, session::peer->reliableDataInTransit);
+    imdraw_ext::text_shadow(connection_line, position, text_color, shadow_color, globals::font_debug, draw_list);
+    position.y += y_step;
+
+    // Draw per-packet traffic metrics
+    if(const PeerTraffic *traffic = protocol::find_traffic(session::peer)) {
+        update_traffic(*traffic);
+        imdraw_ext::text_shadow(traffic_line, position, text_color, shadow_color, globals::font_debug, draw_list);
+        position.y += y_step;
+    }
+
+    // Draw chunk compression metrics
+    const ChunkTraffic &chunks = protocol::chunk_traffic;
+    auto ratio = static_cast<float>(chunks.raw_bytes) / static_cast<float>(cxpr::max<std::uint64_t>(chunks.encoded_bytes, 1U));
+    auto chunk_line = fmt::format("net: {} chunks, {:.1f} KiB at {:.1f}:1", chunks.chunks, static_cast<float>(chunks.encoded_bytes) / 1024.0f, ratio);
+    imdraw_ext::text_shadow(chunk_line, position, text_color, shadow_color, globals::font_debug, draw_list);
+    position.y += y_step;
 }
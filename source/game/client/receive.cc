@@ -2,6 +2,7 @@
 #include "client/precompiled.hh"
 #include "client/receive.hh"
 
+#include "shared/entity/commanded.hh"
 #include "shared/entity/head.hh"
 #include "shared/entity/player.hh"
 #include "shared/entity/transform.hh"
@@ -12,14 +13,19 @@
 #include "shared/protocol.hh"
 
 #include "client/entity/factory.hh"
+#include "client/entity/interpolation.hh"
 
 #include "client/gui/chat.hh"
 #include "client/gui/gui_screen.hh"
 
 #include "client/sound/sound.hh"
 
+#include "client/world/chunk_cache.hh"
+#include "client/world/chunk_visibility.hh"
+
 #include "client/globals.hh"
 #include "client/session.hh"
+#include "client/view.hh"
 
 
 static bool synchronize_entity(entt::entity entity)
@@ -54,15 +60,55 @@ static void on_chunk_voxels_packet(const protocol::ChunkVoxels &packet)
         Chunk *chunk = Chunk::create();
         chunk->entity = packet.entity;
         chunk->voxels = packet.voxels;
+        chunk->encoded = packet.encoded;
+
+        client_chunk_cache::store(packet.chunk, chunk);
 
         world::emplace_or_replace(packet.chunk, chunk);
     }
 }
 
+static void on_chunk_unchanged_packet(const protocol::ChunkUnchanged &packet)
+{
+    if(session::peer) {
+        for(const protocol::ChunkUnchanged::Entry &entry : packet.entries) {
+            Chunk *chunk = client_chunk_cache::take(entry.coord);
+
+            if(!chunk) {
+                spdlog::warn("receive: chunk [{} {} {}] is not cached", entry.coord[0], entry.coord[1], entry.coord[2]);
+                continue;
+            }
+
+            if(!synchronize_entity(entry.entity)) {
+                Chunk::destroy(chunk);
+                return;
+            }
+
+            chunk->entity = entry.entity;
+
+            world::emplace_or_replace(entry.coord, chunk);
+        }
+    }
+}
+
+static void on_chunk_absent_packet(const protocol::ChunkAbsent &packet)
+{
+    if(session::peer) {
+        for(const protocol::ChunkAbsent::Entry &entry : packet.entries) {
+            for(std::uint16_t i = 0; i < entry.height; ++i) {
+                chunk_visibility::mark_absent(ChunkCoord(entry.coord[0], entry.coord[1] + i, entry.coord[2]));
+            }
+        }
+    }
+}
+
 static void on_entity_head_packet(const protocol::EntityHead &packet)
 {
     if(session::peer) {
-        if(!synchronize_entity(packet.entity))
+        // Movement packets are unreliable and can arrive
+        // after the entity has been removed; they never
+        // bring entities into existence on their own
+        if(!globals::registry.valid(packet.entity))
             return;
         auto &component = globals::registry.get_or_emplace<HeadComponent>(packet.entity);
         auto &prev = globals::registry.get_or_emplace<HeadComponentPrev>(packet.entity);
@@ -81,11 +127,15 @@ static void on_entity_head_packet(const protocol::EntityHead &packet)
 static void on_entity_transform_packet(const protocol::EntityTransform &packet)
 {
     if(session::peer) {
-        if(!synchronize_entity(packet.entity))
-            static_cast<void>(globals::registry.create(packet.entity));
+        if(!globals::registry.valid(packet.entity))
+            return;
         auto &component = globals::registry.get_or_emplace<TransformComponent>(packet.entity);
         auto &prev = globals::registry.get_or_emplace<TransformComponentPrev>(packet.entity);
 
+        // The entity has been (re)placed; whatever has been
+        // buffered so far shouldn't be blended into the new state
+        globals::registry.remove<InterpolationBuffer>(packet.entity);
+
         // Store the previous component state
         prev.position = component.position;
         prev.angles = component.angles;
@@ -99,8 +149,8 @@ static void on_entity_transform_packet(const protocol::EntityTransform &packet)
 static void on_entity_velocity_packet(const protocol::EntityVelocity &packet)
 {
     if(session::peer) {
-        if(!synchronize_entity(packet.entity))
-            static_cast<void>(globals::registry.create(packet.entity));
+        if(!globals::registry.valid(packet.entity))
+            return;
         auto &component = globals::registry.emplace_or_replace<VelocityComponent>(packet.entity);
         component.angular = packet.angular;
         component.linear = packet.linear;
@@ -123,10 +173,18 @@ static void on_spawn_player_packet(const protocol::SpawnPlayer &packet)
             return;
         client_entity_factory::create_player(packet.entity);
 
+        // The local player is moved by player_move
+        // and is reconciled with the server by player_state
+        globals::registry.emplace_or_replace<CommandedComponent>(packet.entity);
+
         globals::player = packet.entity;
         globals::gui_screen = GUI_SCREEN_NONE;
 
         client_chat::refresh_timings();
+
+        if(const TransformComponent *transform = globals::registry.try_get<TransformComponent>(packet.entity))
+            client_chunk_cache::send_hashes(transform->position.chunk, view::max_distance);
+        else client_chunk_cache::send_hashes(ChunkCoord(), view::max_distance);
     }
 }
 
@@ -139,6 +197,13 @@ static void on_remove_entity_packet(const protocol::RemoveEntity &packet)
     }
 }
 
+static void on_remove_chunk_packet(const protocol::RemoveChunk &packet)
+{
+    if(globals::registry.valid(packet.entity)) {
+        globals::registry.destroy(packet.entity);
+    }
+}
+
 static void on_generic_sound_packet(const protocol::GenericSound &packet)
 {
     sound::play_generic(packet.sound, packet.looping, packet.pitch);
@@ -152,12 +217,15 @@ static void on_entity_sound_packet(const protocol::EntitySound &packet)
 void client_receive::init(void)
 {
     globals::dispatcher.sink<protocol::ChunkVoxels>().connect<&on_chunk_voxels_packet>();
+    globals::dispatcher.sink<protocol::ChunkUnchanged>().connect<&on_chunk_unchanged_packet>();
+    globals::dispatcher.sink<protocol::ChunkAbsent>().connect<&on_chunk_absent_packet>();
     globals::dispatcher.sink<protocol::EntityHead>().connect<&on_entity_head_packet>();
     globals::dispatcher.sink<protocol::EntityTransform>().connect<&on_entity_transform_packet>();
     globals::dispatcher.sink<protocol::EntityVelocity>().connect<&on_entity_velocity_packet>();
     globals::dispatcher.sink<protocol::EntityPlayer>().connect<&on_entity_player_packet>();
     globals::dispatcher.sink<protocol::SpawnPlayer>().connect<&on_spawn_player_packet>();
     globals::dispatcher.sink<protocol::RemoveEntity>().connect<&on_remove_entity_packet>();
+    globals::dispatcher.sink<protocol::RemoveChunk>().connect<&on_remove_chunk_packet>();
     globals::dispatcher.sink<protocol::GenericSound>().connect<&on_generic_sound_packet>();
     globals::dispatcher.sink<protocol::EntitySound>().connect<&on_entity_sound_packet>();
 }
@@ -5,6 +5,7 @@
 #include "common/config.hh"
 #include "common/crc64.hh"
 
+#include "shared/entity/commanded.hh"
 #include "shared/entity/head.hh"
 #include "shared/entity/player.hh"
 #include "shared/entity/transform.hh"
@@ -32,6 +33,7 @@
 #include "client/gui/message_box.hh"
 #include "client/gui/progress.hh"
 
+#include "client/world/chunk_cache.hh"
 #include "client/world/chunk_visibility.hh"
 
 #include "client/game.hh"
@@ -109,6 +111,7 @@ static void on_set_voxel_packet(const protocol::SetVoxel &packet)
     if(Chunk *chunk = world::find(cpos)) {
         if(chunk->voxels[index] != packet.voxel) {
             chunk->voxels[index] = packet.voxel;
+            chunk->encoded.clear();
             
             ChunkUpdateEvent event = {};
             event.coord = cpos;
@@ -216,7 +219,7 @@ void session::mp::connect(const std::string &host, std::uint16_t port, const std
     enet_address_set_host(&address, host.c_str());
     address.port = port;
     
-    session::peer = enet_host_connect(globals::client_host, &address, 1, 0);
+    session::peer = enet_host_connect(globals::client_host, &address, protocol::NUM_CHANNELS, 0);
     session::client_index = UINT16_MAX;
     session::client_identity = UINT64_MAX;
 
@@ -228,6 +231,8 @@ void session::mp::connect(const std::string &host, std::uint16_t port, const std
 
     globals::is_singleplayer = false;
 
+    client_chunk_cache::setup(fmt::format("{}:{}", host, port));
+
     if(!session::peer) {
         server_password_hash = UINT64_MAX;
 
@@ -324,6 +329,7 @@ void session::sp::update_late(void)
 {
     if(globals::is_singleplayer && globals::registry.valid(globals::player)) {
         unloader::update_late();
+        universe::update_late();
     }
 }
 
@@ -338,6 +344,7 @@ void session::sp::load_world(const std::string &universe_directory)
     globals::player = globals::registry.create();
 
     client_entity_factory::create_player(globals::player);
+    globals::registry.emplace_or_replace<CommandedComponent>(globals::player);
 
     set_fixed_tickrate(protocol::TICKRATE);
 
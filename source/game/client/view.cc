@@ -4,14 +4,13 @@
 
 #include "common/config.hh"
 
-#include "client/entity/player_move.hh"
-
 #include "client/gui/settings.hh"
 
 #include "client/globals.hh"
 
 #include "shared/entity/grounded.hh"
 #include "shared/entity/head.hh"
+#include "shared/entity/pmove.hh"
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
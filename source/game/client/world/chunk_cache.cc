@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "client/precompiled.hh"
+#include "client/world/chunk_cache.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/config.hh"
+#include "common/crc64.hh"
+#include "common/epoch.hh"
+#include "common/fstools.hh"
+
+#include "shared/world/chunk_codec.hh"
+#include "shared/world/universe.hh"
+
+#include "shared/protocol.hh"
+
+#include "client/globals.hh"
+#include "client/session.hh"
+
+
+// Once there are more cached chunks than the limit, the
+// least recently used ones are deleted until there's this
+// much room left so eviction doesn't run on every store
+constexpr static unsigned int EVICT_SLACK_DIVISOR = 8U;
+
+struct CachedHashes final {
+    std::vector<protocol::ChunkHashes::Entry> entries {};
+    emhash8::HashMap<ChunkCoord, std::vector<std::uint8_t>> buffers {};
+};
+
+bool client_chunk_cache::enabled = true;
+unsigned int client_chunk_cache::max_chunks = 32768U;
+
+// Disk access, decoding and hashing is done on the worker
+// thread; the main thread only ever sees the finished results
+static BS::thread_pool worker_pool = BS::thread_pool(1);
+static std::future<CachedHashes> hashes_future = {};
+
+static std::string cache_dir = {};
+static emhash8::HashMap<ChunkCoord, std::vector<std::uint8_t>> pending = {};
+
+// Cached chunks with the time they were last used;
+// this one is only ever touched by the worker thread
+static emhash8::HashMap<ChunkCoord, std::uint64_t> worker_index = {};
+
+static std::string get_path(const std::string &directory, const ChunkCoord &cpos)
+{
+    return fmt::format("{}/{}", directory, universe::get_chunk_filename(cpos));
+}
+
+static void scan_directory(const std::string &directory)
+{
+    worker_index.clear();
+
+    char **filenames = PHYSFS_enumerateFiles(directory.c_str());
+
+    for(char **filename = filenames; filename && *filename; ++filename) {
+        ChunkCoord cpos = {};
+        PHYSFS_Stat stat = {};
+
+        if(!universe::parse_chunk_filename(*filename, cpos))
+            continue;
+        if(!PHYSFS_stat(get_path(directory, cpos).c_str(), &stat))
+            continue;
+        worker_index.insert_or_assign(cpos, static_cast<std::uint64_t>(cxpr::max<PHYSFS_sint64>(stat.modtime, 0)));
+    }
+
+    PHYSFS_freeList(filenames);
+
+    spdlog::debug("chunk_cache: {}: {} chunks", directory, worker_index.size());
+}
+
+static void evict_chunks(const std::string &directory, std::size_t limit)
+{
+    if(worker_index.size() <= limit)
+        return;
+
+    std::vector<std::pair<std::uint64_t, ChunkCoord>> chunks = {};
+    chunks.reserve(worker_index.size());
+
+    for(const auto &it : worker_index) {
+        chunks.emplace_back(it.second, it.first);
+    }
+
+    const std::size_t count = chunks.size() - (limit - limit / EVICT_SLACK_DIVISOR);
+
+    std::nth_element(chunks.begin(), chunks.begin() + count, chunks.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+
+    for(std::size_t i = 0; i < count; ++i) {
+        PHYSFS_delete(get_path(directory, chunks[i].second).c_str());
+        worker_index.erase(chunks[i].second);
+    }
+
+    spdlog::debug("chunk_cache: {}: evicted {} chunks", directory, count);
+}
+
+static void write_chunk(const std::string &directory, const ChunkCoord &cpos, const std::vector<std::uint8_t> &buffer, std::size_t limit)
+{
+    if(fstools::write_bytes(get_path(directory, cpos), buffer)) {
+        worker_index.insert_or_assign(cpos, epoch::seconds());
+        evict_chunks(directory, limit);
+    }
+}
+
+static CachedHashes hash_chunks(const std::string &directory, const ChunkCoord &cpos, ChunkCoord::value_type distance)
+{
+    CachedHashes result = {};
+    VoxelStorage voxels = {};
+
+    for(auto &it : worker_index) {
+        if(cxpr::abs(it.first[0] - cpos[0]) > distance)
+            continue;
+        if(cxpr::abs(it.first[1] - cpos[1]) > distance)
+            continue;
+        if(cxpr::abs(it.first[2] - cpos[2]) > distance)
+            continue;
+
+        std::vector<std::uint8_t> buffer = {};
+
+        if(!fstools::read_bytes(get_path(directory, it.first), buffer) || !chunk_codec::decode(buffer, voxels)) {
+            // Whatever is stored there is not going to
+            // be overwritten until the server sends the chunk
+            continue;
+        }
+
+        protocol::ChunkHashes::Entry entry = {};
+        entry.coord = it.first;
+        entry.hash = chunk_codec::hash(voxels);
+        result.entries.push_back(entry);
+        result.buffers.emplace(it.first, std::move(buffer));
+
+        // Chunks around the player are likely
+        // to be needed again next time around
+        it.second = epoch::seconds();
+    }
+
+    return result;
+}
+
+static void send_packets(CachedHashes &hashes)
+{
+    protocol::ChunkHashes packet = {};
+
+    for(const protocol::ChunkHashes::Entry &entry : hashes.entries) {
+        packet.entries.push_back(entry);
+
+        if(packet.entries.size() >= protocol::MAX_CHUNK_HASHES) {
+            protocol::send(session::peer, nullptr, packet);
+            packet.entries.clear();
+        }
+    }
+
+    packet.is_final = true;
+    protocol::send(session::peer, nullptr, packet);
+
+    pending = std::move(hashes.buffers);
+}
+
+void client_chunk_cache::init(void)
+{
+    Config::add(globals::client_config, "chunk_cache.enabled", client_chunk_cache::enabled);
+    Config::add(globals::client_config, "chunk_cache.max_chunks", client_chunk_cache::max_chunks);
+}
+
+void client_chunk_cache::deinit(void)
+{
+    worker_pool.wait();
+    hashes_future = std::future<CachedHashes>();
+}
+
+void client_chunk_cache::update(void)
+{
+    if(!hashes_future.valid())
+        return;
+    if(hashes_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    CachedHashes hashes = hashes_future.get();
+    hashes_future = std::future<CachedHashes>();
+
+    if(session::peer) {
+        send_packets(hashes);
+    }
+}
+
+void client_chunk_cache::setup(const std::string &server)
+{
+    // Results of whatever was being done
+    // for the previous server are of no use now
+    client_chunk_cache::deinit();
+
+    cache_dir = fmt::format("cache/chunks/{:016X}", crc64::get(server));
+    pending.clear();
+
+    if(!PHYSFS_mkdir(cache_dir.c_str())) {
+        spdlog::warn("chunk_cache: mkdir {}: {}", cache_dir, fstools::error());
+        cache_dir.clear();
+        return;
+    }
+
+    worker_pool.detach_task([directory = cache_dir](void) {
+        scan_directory(directory);
+    });
+}
+
+void client_chunk_cache::store(const ChunkCoord &cpos, const Chunk *chunk)
+{
+    pending.erase(cpos);
+
+    if(!client_chunk_cache::enabled || cache_dir.empty())
+        return;
+
+    const std::size_t limit = cxpr::max(client_chunk_cache::max_chunks, 1U);
+
+    if(chunk->encoded.empty()) {
+        worker_pool.detach_task([directory = cache_dir, cpos, voxels = chunk->voxels, limit](void) {
+            std::vector<std::uint8_t> buffer = {};
+            if(chunk_codec::encode(voxels, buffer, chunk_codec::LEVEL_DEFAULT))
+                write_chunk(directory, cpos, buffer, limit);
+        });
+    }
+    else {
+        // Server-encoded data can be
+        // written to the disk as-is
+        worker_pool.detach_task([directory = cache_dir, cpos, buffer = chunk->encoded, limit](void) {
+            write_chunk(directory, cpos, buffer, limit);
+        });
+    }
+}
+
+void client_chunk_cache::send_hashes(const ChunkCoord &cpos, unsigned int distance)
+{
+    pending.clear();
+
+    if(!client_chunk_cache::enabled || cache_dir.empty()) {
+        CachedHashes hashes = {};
+        send_packets(hashes);
+        return;
+    }
+
+    const auto dist = static_cast<ChunkCoord::value_type>(distance);
+
+    // The scan for the current server, if it's still
+    // running, is guaranteed to finish before this starts
+    hashes_future = worker_pool.submit_task([directory = cache_dir, cpos, dist](void) {
+        return hash_chunks(directory, cpos, dist);
+    });
+}
+
+Chunk *client_chunk_cache::take(const ChunkCoord &cpos)
+{
+    const auto it = pending.find(cpos);
+
+    if(it == pending.cend())
+        return nullptr;
+
+    Chunk *chunk = Chunk::create();
+    chunk_codec::decode(it->second, chunk->voxels);
+    chunk->encoded = std::move(it->second);
+
+    pending.erase(it);
+
+    return chunk;
+}
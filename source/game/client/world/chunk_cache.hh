@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk.hh"
+#include "shared/world/chunk_coord.hh"
+
+namespace client_chunk_cache
+{
+extern bool enabled;
+extern unsigned int max_chunks;
+} // namespace client_chunk_cache
+
+namespace client_chunk_cache
+{
+void init(void);
+void deinit(void);
+void update(void);
+void setup(const std::string &server);
+} // namespace client_chunk_cache
+
+namespace client_chunk_cache
+{
+void store(const ChunkCoord &cpos, const Chunk *chunk);
+
+// Tells the server which chunks around the given position are
+// cached; the hashes are computed in the background and sent
+// from update, and the packet with the final flag is always sent
+// even if there's nothing cached since the server waits for it
+void send_hashes(const ChunkCoord &cpos, unsigned int distance);
+
+// Creates a chunk out of the cached data that has
+// been confirmed by the server to be up to date
+Chunk *take(const ChunkCoord &cpos);
+} // namespace client_chunk_cache
@@ -4,33 +4,18 @@
 
 #include "shared/entity/chunk.hh"
 
+#include "shared/event/chunk_create.hh"
+
 #include "shared/world/universe.hh"
 #include "shared/world/world.hh"
 
-#include "shared/protocol.hh"
-
 #include "client/globals.hh"
-#include "client/session.hh"
 #include "client/view.hh"
 
 static ChunkCoord cached_cpos = {};
 static unsigned int cached_dist = {};
 static std::vector<ChunkCoord> requests = {};
-
-static void request_chunk(const ChunkCoord &cpos)
-{
-    if(globals::is_singleplayer) {
-        universe::load_chunk(cpos);
-        return;
-    }
-
-    protocol::RequestChunk packet = {};
-    packet.coord[0] = cpos[0];
-    packet.coord[1] = cpos[1];
-    packet.coord[2] = cpos[2];
-
-    protocol::send(session::peer, nullptr, packet);
-}
+static std::unordered_set<ChunkCoord> absent = {};
 
 // Go through the list of chunk positions that should
 // be visible client-side but seem to not exist yet
@@ -41,6 +26,22 @@ static void request_new_chunks(void)
 
     requests.clear();
 
+    for(auto it = absent.begin(); it != absent.end();) {
+        const auto dx = cxpr::abs((*it)[0] - cached_cpos[0]);
+        const auto dy = cxpr::abs((*it)[1] - cached_cpos[1]);
+        const auto dz = cxpr::abs((*it)[2] - cached_cpos[2]);
+
+        if((dx <= cached_dist) && (dy <= cached_dist) && (dz <= cached_dist))
+            ++it;
+        else it = absent.erase(it);
+    }
+
+    if(!globals::is_singleplayer) {
+        // Multiplayer servers stream chunks
+        // on their own; there's nothing to request
+        return;
+    }
+
     for(auto cx = cmin[0]; cx <= cmax[0]; ++cx)
     for(auto cy = cmin[1]; cy <= cmax[1]; ++cy)
     for(auto cz = cmin[2]; cz <= cmax[2]; ++cz) {
@@ -50,6 +51,11 @@ static void request_new_chunks(void)
             continue;
         }
 
+        if(absent.count(ChunkCoord(cx, cy, cz))) {
+            // There's nothing there
+            continue;
+        }
+
         requests.push_back(ChunkCoord(cx, cy, cz));
     }
 
@@ -64,6 +70,11 @@ static void request_new_chunks(void)
     });
 }
 
+static void on_chunk_create(const ChunkCreateEvent &event)
+{
+    absent.erase(event.coord);
+}
+
 static bool is_chunk_visible(const ChunkCoord &cvec)
 {
     const auto dx = cxpr::abs(cvec[0] - cached_cpos[0]);
@@ -105,11 +116,17 @@ void chunk_visibility::update_chunks(void)
     request_new_chunks();
 }
 
+void chunk_visibility::init(void)
+{
+    globals::dispatcher.sink<ChunkCreateEvent>().connect<&on_chunk_create>();
+}
+
 void chunk_visibility::cleanup(void)
 {
     cached_cpos = view::position.chunk + 1;
     cached_dist = view::max_distance + 1;
     requests.clear();
+    absent.clear();
 }
 
 void chunk_visibility::update(void)
@@ -128,7 +145,8 @@ void chunk_visibility::update(void)
                     break;
                 }
 
-                request_chunk(requests.back());
+                if(!universe::load_chunk(requests.back()))
+                    absent.insert(requests.back());
 
                 requests.pop_back();
             }
@@ -142,3 +160,8 @@ void chunk_visibility::update(void)
     cached_cpos = view::position.chunk + 1;
     cached_dist = view::max_distance + 1;
 }
+
+void chunk_visibility::mark_absent(const ChunkCoord &cvec)
+{
+    absent.insert(cvec);
+}
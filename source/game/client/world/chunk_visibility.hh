@@ -13,6 +13,14 @@ void update_chunks(void);
 
 namespace chunk_visibility
 {
+void init(void);
 void cleanup(void);
 void update(void);
 } // namespace chunk_visibility
+
+namespace chunk_visibility
+{
+// Positions known to have no chunk at all; these
+// are not requested again until a chunk gets created
+void mark_absent(const ChunkCoord &cvec);
+} // namespace chunk_visibility
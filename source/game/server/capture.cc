@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "server/precompiled.hh"
+#include "server/capture.hh"
+
+#include "common/cmdline.hh"
+#include "common/fstools.hh"
+#include "common/packet_buffer.hh"
+
+#include "shared/protocol.hh"
+
+#include "server/globals.hh"
+
+
+// The file starts with the magic, the protocol version and
+// the tickrate; then go the events, each of them starting with
+// the number of ticks passed since the previous one, the peer
+// slot and the event type; received events also carry the packet
+constexpr static std::uint32_t CAPTURE_MAGIC = UINT32_C(0x50414356);
+constexpr static std::uint8_t EVENT_RECEIVE = 0x01;
+constexpr static std::uint8_t EVENT_DISCONNECT = 0x02;
+
+static std::string capture_path = {};
+static std::string replay_path = {};
+
+static PHYSFS_File *capture_file = nullptr;
+static PacketBuffer writer = {};
+static std::uint64_t last_tick = 0;
+static std::size_t num_events = 0;
+
+static PacketBuffer reader = {};
+static bool has_next = false;
+static std::uint64_t next_tick = 0;
+static enet_uint32 next_connect_id = 0;
+
+static void read_next(void)
+{
+    if(reader.read_position >= reader.vector.size()) {
+        has_next = false;
+        return;
+    }
+
+    next_tick += PacketBuffer::read_VUI64(reader);
+    has_next = true;
+}
+
+static void open_recording(void)
+{
+    capture_file = PHYSFS_openWrite(capture_path.c_str());
+
+    if(!capture_file) {
+        spdlog::warn("capture: {}: {}", capture_path, fstools::error());
+        return;
+    }
+
+    PacketBuffer::setup(writer);
+    PacketBuffer::write_UI32(writer, CAPTURE_MAGIC);
+    PacketBuffer::write_UI32(writer, protocol::VERSION);
+    PacketBuffer::write_UI16(writer, static_cast<std::uint16_t>(globals::tickrate));
+    PHYSFS_writeBytes(capture_file, writer.vector.data(), writer.vector.size());
+
+    spdlog::info("capture: recording inbound traffic to {}", capture_path);
+}
+
+static void open_replay(void)
+{
+    reader.read_position = 0;
+
+    if(!fstools::read_bytes(replay_path, reader.vector)) {
+        spdlog::critical("capture: {}: {}", replay_path, fstools::error());
+        std::terminate();
+    }
+
+    const std::uint32_t magic = PacketBuffer::read_UI32(reader);
+    const std::uint32_t version = PacketBuffer::read_UI32(reader);
+    const std::uint16_t tickrate = PacketBuffer::read_UI16(reader);
+
+    if((magic != CAPTURE_MAGIC) || (version != protocol::VERSION) || (tickrate == 0)) {
+        spdlog::critical("capture: {}: not a recording or recorded by a different protocol version", replay_path);
+        std::terminate();
+    }
+
+    // Ticks have to be just as long as they were
+    // at the time of recording for timers to line up
+    globals::tickrate = tickrate;
+    globals::tickrate_dt = static_cast<std::uint64_t>(1000000.0f / static_cast<float>(globals::tickrate));
+
+    protocol::discard_sends = true;
+
+    next_tick = 0;
+    next_connect_id = 0;
+    read_next();
+
+    spdlog::info("capture: replaying {} ({} bytes) at {} TPS", replay_path, reader.vector.size(), tickrate);
+}
+
+void capture::init(void)
+{
+    capture_path.clear();
+    replay_path.clear();
+
+    cmdline::get_value("capture", capture_path);
+    cmdline::get_value("replay", replay_path);
+
+    if(!capture_path.empty() && !replay_path.empty()) {
+        spdlog::warn("capture: can't record while replaying; not recording");
+        capture_path.clear();
+    }
+}
+
+void capture::init_late(void)
+{
+    num_events = 0;
+    last_tick = 0;
+    has_next = false;
+
+    if(!capture_path.empty())
+        open_recording();
+    if(!replay_path.empty())
+        open_replay();
+}
+
+void capture::deinit(void)
+{
+    if(capture_file) {
+        PHYSFS_close(capture_file);
+        capture_file = nullptr;
+
+        spdlog::info("capture: recorded {} events to {}", num_events, capture_path);
+    }
+
+    if(!replay_path.empty())
+        spdlog::info("capture: replayed {} events", num_events);
+
+    protocol::discard_sends = false;
+}
+
+bool capture::is_recording(void)
+{
+    return capture_file != nullptr;
+}
+
+bool capture::is_replaying(void)
+{
+    return !replay_path.empty();
+}
+
+bool capture::is_finished(void)
+{
+    return !has_next;
+}
+
+void capture::record(const std::vector<ENetEvent> &events)
+{
+    if(!capture_file || events.empty())
+        return;
+
+    PacketBuffer::setup(writer);
+
+    for(const ENetEvent &event : events) {
+        if((event.type != ENET_EVENT_TYPE_RECEIVE) && (event.type != ENET_EVENT_TYPE_DISCONNECT))
+            continue;
+
+        PacketBuffer::write_VUI64(writer, globals::fixed_framecount - last_tick);
+        last_tick = globals::fixed_framecount;
+
+        PacketBuffer::write_VUI32(writer, static_cast<std::uint32_t>(event.peer - globals::server_host->peers));
+
+        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+            PacketBuffer::write_UI8(writer, EVENT_RECEIVE);
+            PacketBuffer::write_VUI32(writer, static_cast<std::uint32_t>(event.packet->dataLength));
+            PacketBuffer::write_bytes(writer, event.packet->data, event.packet->dataLength);
+        }
+        else {
+            PacketBuffer::write_UI8(writer, EVENT_DISCONNECT);
+        }
+
+        num_events += 1;
+    }
+
+    PHYSFS_writeBytes(capture_file, writer.vector.data(), writer.vector.size());
+}
+
+void capture::replay(std::vector<ENetEvent> &events)
+{
+    events.clear();
+
+    while(has_next && (next_tick <= globals::fixed_framecount)) {
+        const std::size_t index = PacketBuffer::read_VUI32(reader);
+        const std::uint8_t type = PacketBuffer::read_UI8(reader);
+
+        ENetEvent event = {};
+        ENetPeer *peer = nullptr;
+
+        if(index < globals::server_host->peerCount)
+            peer = &globals::server_host->peers[index];
+
+        if(type == EVENT_RECEIVE) {
+            const std::size_t size = PacketBuffer::read_VUI32(reader);
+
+            if((reader.read_position + size) > reader.vector.size()) {
+                spdlog::warn("capture: {}: truncated at tick {}", replay_path, next_tick);
+                has_next = false;
+                break;
+            }
+
+            if(peer) {
+                if(peer->state != ENET_PEER_STATE_CONNECTED) {
+                    // The peer has just connected as far as the
+                    // server is concerned; a new connection identifier
+                    // makes sure nothing addressed to its predecessor
+                    // in the very same slot ends up being delivered to it
+                    peer->state = ENET_PEER_STATE_CONNECTED;
+                    peer->connectID = ++next_connect_id;
+                    peer->data = nullptr;
+                }
+
+                event.type = ENET_EVENT_TYPE_RECEIVE;
+                event.peer = peer;
+                event.packet = enet_packet_create(reader.vector.data() + reader.read_position, size, ENET_PACKET_FLAG_RELIABLE);
+                events.push_back(event);
+            }
+
+            reader.read_position += size;
+        }
+        else if(type == EVENT_DISCONNECT) {
+            if(peer && (peer->state == ENET_PEER_STATE_CONNECTED)) {
+                peer->state = ENET_PEER_STATE_DISCONNECTED;
+
+                event.type = ENET_EVENT_TYPE_DISCONNECT;
+                event.peer = peer;
+                events.push_back(event);
+            }
+        }
+        else {
+            spdlog::warn("capture: {}: unknown event type {} at tick {}", replay_path, type, next_tick);
+            has_next = false;
+            break;
+        }
+
+        num_events += 1;
+
+        read_next();
+    }
+}
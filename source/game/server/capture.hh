@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+// Inbound traffic can be recorded into a file together
+// with the tick it has been handled at and the peer slot it
+// came from; a recording is replayed by feeding the very same
+// events to the very same ticks without any real peers around
+namespace capture
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+} // namespace capture
+
+namespace capture
+{
+bool is_recording(void);
+bool is_replaying(void);
+bool is_finished(void);
+} // namespace capture
+
+namespace capture
+{
+void record(const std::vector<ENetEvent> &events);
+void replay(std::vector<ENetEvent> &events);
+} // namespace capture
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "server/precompiled.hh"
+#include "server/chunk_cache.hh"
+
+#include "shared/entity/chunk.hh"
+
+#include "shared/protocol.hh"
+
+#include "server/globals.hh"
+#include "server/net_thread.hh"
+
+
+struct CachedChunk final {
+    std::uint64_t version {};
+    ENetPacket *packet {};
+};
+
+std::uint64_t chunk_cache::num_hits = 0;
+std::uint64_t chunk_cache::num_misses = 0;
+
+static emhash8::HashMap<ChunkCoord, CachedChunk> cache = {};
+
+static void release(CachedChunk &cached)
+{
+    if(cached.packet) {
+        // The cache holds its own reference to the packet
+        // so that ENet doesn't destroy it after it's sent;
+        // the I/O thread drops the others as they're acked
+        std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+        cached.packet->referenceCount -= 1;
+
+        if(cached.packet->referenceCount == 0)
+            enet_packet_destroy(cached.packet);
+        cached.packet = nullptr;
+    }
+}
+
+static void on_destroy_chunk(const entt::registry &registry, entt::entity entity)
+{
+    const auto &component = registry.get<ChunkComponent>(entity);
+    const auto it = cache.find(component.coord);
+
+    if(it != cache.cend()) {
+        release(it->second);
+        cache.erase(it);
+    }
+}
+
+void chunk_cache::init(void)
+{
+    chunk_cache::num_hits = 0;
+    chunk_cache::num_misses = 0;
+
+    globals::registry.on_destroy<ChunkComponent>().connect<&on_destroy_chunk>();
+}
+
+void chunk_cache::deinit(void)
+{
+    for(auto &it : cache)
+        release(it.second);
+    cache.clear();
+
+    auto num_lookups = chunk_cache::num_hits + chunk_cache::num_misses;
+    auto hit_rate = num_lookups ? 100.0 * static_cast<double>(chunk_cache::num_hits) / static_cast<double>(num_lookups) : 0.0;
+    spdlog::info("chunk_cache: {} hits, {} misses ({:.02f}% hit rate)", chunk_cache::num_hits, chunk_cache::num_misses, hit_rate);
+}
+
+ENetPacket *chunk_cache::find(entt::entity entity)
+{
+    if(const ChunkComponent *component = globals::registry.try_get<ChunkComponent>(entity)) {
+        CachedChunk &cached = cache[component->coord];
+
+        if(cached.packet && (cached.version == component->chunk->version)) {
+            chunk_cache::num_hits += 1;
+            return cached.packet;
+        }
+
+        release(cached);
+
+        protocol::ChunkVoxels packet = {};
+        packet.entity = entity;
+        packet.chunk = component->coord;
+        packet.voxels = component->chunk->voxels;
+        packet.encoded = component->chunk->encoded;
+
+        cached.version = component->chunk->version;
+        cached.packet = protocol::encode(packet);
+        cached.packet->referenceCount += 1;
+
+        chunk_cache::num_misses += 1;
+
+        return cached.packet;
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+namespace chunk_cache
+{
+extern std::uint64_t num_hits;
+extern std::uint64_t num_misses;
+} // namespace chunk_cache
+
+namespace chunk_cache
+{
+void init(void);
+void deinit(void);
+} // namespace chunk_cache
+
+namespace chunk_cache
+{
+// Returns the up-to-date ChunkVoxels packet for a chunk
+// entity; the cache keeps its own reference to the packet
+ENetPacket *find(entt::entity entity);
+} // namespace chunk_cache
@@ -0,0 +1,506 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "server/precompiled.hh"
+#include "server/chunk_stream.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/config.hh"
+
+#include "shared/entity/head.hh"
+#include "shared/entity/transform.hh"
+
+#include "shared/event/chunk_create.hh"
+
+#include "shared/world/chunk_codec.hh"
+#include "shared/world/universe.hh"
+#include "shared/world/world.hh"
+
+#include "shared/protocol.hh"
+
+#include "server/chunk_cache.hh"
+#include "server/game.hh"
+#include "server/globals.hh"
+#include "server/net_thread.hh"
+#include "server/sessions.hh"
+
+
+// Queues are re-sorted at least this often so
+// that the look direction is eventually respected
+constexpr static std::uint64_t REBUILD_INTERVAL = UINT64_C(500000);
+
+// Chunks behind the player are treated as if
+// they were this many times further away than they are
+constexpr static float BEHIND_WEIGHT = 2.0f;
+
+// Clients that never report their cached
+// chunks still get them streamed after this long
+constexpr static std::uint64_t RESUME_TIMEOUT = UINT64_C(1000000);
+
+// Round trip time past which the budget starts to shrink
+constexpr static float REFERENCE_RTT = 100.0f;
+
+// Unused budget is allowed to accumulate
+// for this many ticks worth of bandwidth
+constexpr static float BURST_TICKS = 4.0f;
+
+// Absent coordinates nobody can see anymore are
+// forgotten once there are at least this many of them
+constexpr static std::size_t MIN_ABSENT_PRUNE = 4096;
+
+unsigned int chunk_stream::bandwidth = 2048U;
+unsigned int chunk_stream::max_loads = 64U;
+
+// Coordinates that universe::load_chunk has nothing
+// for; this saves both a disk lookup and a worldgen run
+// for every single session that has them within its view
+static std::unordered_set<ChunkCoord> absent_chunks = {};
+static std::size_t absent_prune_size = MIN_ABSENT_PRUNE;
+
+static std::vector<Session *> streaming = {};
+static std::size_t first_session = 0;
+static unsigned int num_loads = 0U;
+
+static void sort_queue(Session *session, const TransformComponent &transform)
+{
+    ChunkStream &stream = session->stream;
+    auto angles = transform.angles;
+
+    if(const HeadComponent *head = globals::registry.try_get<HeadComponent>(session->player_entity))
+        angles = angles + head->angles;
+
+    Vec3f forward = {};
+    Vec3angles::vectors(angles, forward);
+
+    std::vector<std::pair<float, ChunkCoord>> scored = {};
+    scored.reserve(stream.queue.size());
+
+    for(const ChunkCoord &cpos : stream.queue) {
+        const Vec3f delta = Vec3f(cpos - stream.origin);
+        const float length2 = Vec3f::dot(delta, delta);
+        const float facing = (length2 > 0.0f) ? Vec3f::dot(delta, forward) / std::sqrt(length2) : 1.0f;
+        const float weight = 1.0f + 0.5f * (BEHIND_WEIGHT - 1.0f) * (1.0f - facing);
+        scored.emplace_back(length2 * weight * weight, cpos);
+    }
+
+    std::sort(scored.begin(), scored.end(), [](const auto &a, const auto &b) {
+        return a.first > b.first;
+    });
+
+    for(std::size_t i = 0; i < scored.size(); ++i) {
+        stream.queue[i] = scored[i].second;
+    }
+
+    stream.rebuild_time = globals::curtime + REBUILD_INTERVAL;
+}
+
+static void refill_queue(Session *session, const TransformComponent &transform)
+{
+    ChunkStream &stream = session->stream;
+
+    stream.origin = transform.position.chunk;
+    stream.queue.clear();
+
+    for(auto it = stream.absent.begin(); it != stream.absent.end();) {
+        if(sessions::is_in_view(session, *it))
+            ++it;
+        else it = stream.absent.erase(it);
+    }
+
+    const auto dist = static_cast<ChunkCoord::value_type>(server_game::view_distance);
+    const auto cmin = stream.origin - dist;
+    const auto cmax = stream.origin + dist;
+
+    for(auto cx = cmin[0]; cx <= cmax[0]; ++cx)
+    for(auto cy = cmin[1]; cy <= cmax[1]; ++cy)
+    for(auto cz = cmin[2]; cz <= cmax[2]; ++cz) {
+        const ChunkCoord cpos = ChunkCoord(cx, cy, cz);
+
+        if(!session->chunks.count(cpos) && !stream.absent.count(cpos)) {
+            // The client doesn't know anything
+            // about the chunk at this position yet
+            stream.queue.push_back(cpos);
+        }
+    }
+
+    sort_queue(session, transform);
+}
+
+static float calc_budget(const ENetPeer *peer)
+{
+    float budget = static_cast<float>(chunk_stream::bandwidth) * 1024.0f / static_cast<float>(globals::tickrate);
+
+    // ENet lowers the throttle value whenever it
+    // sees packets being lost or the RTT going up
+    budget *= static_cast<float>(peer->packetThrottle) / static_cast<float>(ENET_PEER_PACKET_THROTTLE_SCALE);
+
+    if(peer->roundTripTime > REFERENCE_RTT)
+        budget *= cxpr::max(0.25f, REFERENCE_RTT / static_cast<float>(peer->roundTripTime));
+    return budget;
+}
+
+static void send_absent(Session *session, std::vector<ChunkCoord> &absent)
+{
+    if(absent.empty())
+        return;
+
+    std::sort(absent.begin(), absent.end(), [](const ChunkCoord &ca, const ChunkCoord &cb) {
+        if(ca[0] != cb[0])
+            return ca[0] < cb[0];
+        if(ca[2] != cb[2])
+            return ca[2] < cb[2];
+        return ca[1] < cb[1];
+    });
+
+    protocol::ChunkAbsent packet = {};
+
+    for(const ChunkCoord &cpos : absent) {
+        session->stream.absent.insert(cpos);
+
+        if(!packet.entries.empty()) {
+            protocol::ChunkAbsent::Entry &last = packet.entries.back();
+
+            if((last.coord[0] == cpos[0]) && (last.coord[2] == cpos[2]) && ((last.coord[1] + last.height) == cpos[1]) && (last.height < UINT16_MAX)) {
+                last.height += 1;
+                continue;
+            }
+        }
+
+        protocol::ChunkAbsent::Entry entry = {};
+        entry.coord = cpos;
+        entry.height = 1;
+        packet.entries.push_back(entry);
+    }
+
+    protocol::send(session->peer, nullptr, packet);
+}
+
+static bool prepare_session(Session *session)
+{
+    ChunkStream &stream = session->stream;
+    const TransformComponent *transform = globals::registry.try_get<TransformComponent>(session->player_entity);
+
+    if(!transform) {
+        // Not spawned yet
+        return false;
+    }
+
+    if(globals::curtime < stream.resume_time) {
+        // Waiting for ChunkHashes
+        return false;
+    }
+
+    if(!stream.is_valid || (stream.origin != transform->position.chunk)) {
+        refill_queue(session, *transform);
+        stream.is_valid = true;
+    }
+    else if(globals::curtime >= stream.rebuild_time) {
+        // Only the look direction could have changed
+        sort_queue(session, *transform);
+    }
+
+    // Peer statistics are kept up to date by the I/O thread
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    const float budget = calc_budget(session->peer);
+    stream.budget = cxpr::min(stream.budget + budget, budget * BURST_TICKS);
+
+    if(session->peer->reliableDataInTransit >= session->peer->windowSize) {
+        // The reliable window is full; whatever we
+        // send now is just going to pile up in ENet queues
+        return false;
+    }
+
+    return true;
+}
+
+static void send_unchanged(Session *session, std::vector<ChunkCoord> &unchanged)
+{
+    if(unchanged.empty())
+        return;
+
+    protocol::ChunkUnchanged packet = {};
+
+    for(const ChunkCoord &cpos : unchanged) {
+        // Nothing gets unloaded halfway through the
+        // tick but better safe than leaving the client
+        // believe in a chunk the server no longer has
+        if(const Chunk *chunk = world::find(cpos)) {
+            protocol::ChunkUnchanged::Entry entry = {};
+            entry.entity = chunk->entity;
+            entry.coord = cpos;
+            packet.entries.push_back(entry);
+            continue;
+        }
+
+        session->chunks.erase(cpos);
+    }
+
+    if(!packet.entries.empty()) {
+        protocol::send(session->peer, nullptr, packet);
+    }
+}
+
+static bool pop_next(ChunkStream &stream, ChunkCoord &cpos)
+{
+    if(!stream.urgent.empty()) {
+        cpos = stream.urgent.back();
+        stream.urgent.pop_back();
+        stream.urgent_set.erase(cpos);
+        return true;
+    }
+
+    if(!stream.queue.empty()) {
+        cpos = stream.queue.back();
+        stream.queue.pop_back();
+        return true;
+    }
+
+    return false;
+}
+
+// Sends whatever is already loaded until either the budget
+// runs out or a chunk has to be loaded; loading counts against
+// the limit shared with the other sessions so it's their turn then
+static bool stream_next(Session *session)
+{
+    ChunkStream &stream = session->stream;
+    ChunkCoord cpos = {};
+
+    while(!stream.hashes.empty()) {
+        const auto [hash_cpos, hash] = stream.hashes.back();
+
+        if(session->chunks.count(hash_cpos) || absent_chunks.count(hash_cpos) || !sessions::is_in_view(session, hash_cpos)) {
+            stream.hashes.pop_back();
+            continue;
+        }
+
+        Chunk *chunk = world::find(hash_cpos);
+        bool is_load = false;
+
+        if(chunk == nullptr) {
+            if(num_loads >= chunk_stream::max_loads) {
+                // Hashes are checked before anything is
+                // streamed so nothing the client has cached
+                // is sent over again while it waits for a load
+                return false;
+            }
+
+            num_loads += 1U;
+            is_load = true;
+
+            chunk = universe::load_chunk(hash_cpos);
+        }
+
+        stream.hashes.pop_back();
+
+        if(chunk == nullptr) {
+            // The client's cached copy is stale; the
+            // queue is going to report the chunk as absent
+            absent_chunks.insert(hash_cpos);
+        }
+        else if(chunk_codec::hash(chunk->voxels) == hash) {
+            session->chunks.insert(hash_cpos);
+            stream.found_unchanged.push_back(hash_cpos);
+        }
+        else {
+            // The chunk has changed since the client has
+            // cached it; just send the whole thing over again
+            chunk_stream::enqueue(session, hash_cpos);
+        }
+
+        if(is_load) {
+            // Give the other sessions their turn
+            return true;
+        }
+    }
+
+    while((stream.budget > 0.0f) && pop_next(stream, cpos)) {
+        if(session->chunks.count(cpos) || stream.absent.count(cpos) || !sessions::is_in_view(session, cpos))
+            continue;
+
+        if(absent_chunks.count(cpos)) {
+            stream.found_absent.push_back(cpos);
+            continue;
+        }
+
+        Chunk *chunk = world::find(cpos);
+        bool is_load = false;
+
+        if(chunk == nullptr) {
+            if(num_loads >= chunk_stream::max_loads) {
+                // Try again next tick
+                stream.queue.push_back(cpos);
+                return false;
+            }
+
+            num_loads += 1U;
+            is_load = true;
+
+            chunk = universe::load_chunk(cpos);
+
+            if(chunk == nullptr) {
+                absent_chunks.insert(cpos);
+                stream.found_absent.push_back(cpos);
+                return true;
+            }
+        }
+
+        if(ENetPacket *packet = chunk_cache::find(chunk->entity)) {
+            stream.budget -= static_cast<float>(packet->dataLength);
+            sessions::send_chunk(session, chunk->entity);
+        }
+
+        if(is_load) {
+            // Give the other sessions their turn
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void prune_absent(void)
+{
+    if(absent_chunks.size() < absent_prune_size)
+        return;
+
+    for(auto it = absent_chunks.begin(); it != absent_chunks.end();) {
+        bool is_visible = false;
+
+        for(unsigned int i = 0U; (i < sessions::max_players) && !is_visible; ++i) {
+            if(const Session *session = sessions::find(static_cast<std::uint16_t>(i))) {
+                is_visible = sessions::is_in_view(session, *it);
+            }
+        }
+
+        if(is_visible)
+            ++it;
+        else it = absent_chunks.erase(it);
+    }
+
+    // Whatever is still in view of somebody stays; the
+    // next prune waits until there's as much again on top
+    absent_prune_size = cxpr::max(MIN_ABSENT_PRUNE, 2 * absent_chunks.size());
+}
+
+static void on_chunk_create(const ChunkCreateEvent &event)
+{
+    absent_chunks.erase(event.coord);
+
+    for(unsigned int i = 0U; i < sessions::max_players; ++i) {
+        if(Session *session = sessions::find(static_cast<std::uint16_t>(i))) {
+            // Whatever the client has been told
+            // about the position is no longer true
+            session->stream.absent.erase(event.coord);
+
+            if(sessions::is_in_view(session, event.coord)) {
+                chunk_stream::enqueue(session, event.coord);
+            }
+        }
+    }
+}
+
+void chunk_stream::init(void)
+{
+    Config::add(globals::server_config, "chunk_stream.bandwidth", chunk_stream::bandwidth);
+    Config::add(globals::server_config, "chunk_stream.max_loads", chunk_stream::max_loads);
+
+    globals::dispatcher.sink<ChunkCreateEvent>().connect<&on_chunk_create>();
+}
+
+void chunk_stream::init_late(void)
+{
+    chunk_stream::bandwidth = cxpr::max(chunk_stream::bandwidth, 16U);
+    chunk_stream::max_loads = cxpr::max(chunk_stream::max_loads, 1U);
+
+    absent_chunks.clear();
+    absent_prune_size = MIN_ABSENT_PRUNE;
+}
+
+void chunk_stream::update_late(void)
+{
+    streaming.clear();
+
+    for(unsigned int i = 0U; i < sessions::max_players; ++i) {
+        if(Session *session = sessions::find(static_cast<std::uint16_t>(i))) {
+            if(prepare_session(session)) {
+                streaming.push_back(session);
+            }
+        }
+    }
+
+    // Sessions take turns, one chunk load at a time, and
+    // a different one goes first every tick so that the same
+    // sessions don't always end up with whatever is left over
+    num_loads = 0U;
+
+    if(!streaming.empty()) {
+        std::rotate(streaming.begin(), streaming.begin() + (first_session++ % streaming.size()), streaming.end());
+    }
+
+    while(!streaming.empty()) {
+        std::size_t count = 0;
+
+        for(Session *session : streaming) {
+            if(stream_next(session)) {
+                streaming[count++] = session;
+            }
+        }
+
+        streaming.resize(count);
+    }
+
+    for(unsigned int i = 0U; i < sessions::max_players; ++i) {
+        if(Session *session = sessions::find(static_cast<std::uint16_t>(i))) {
+            send_unchanged(session, session->stream.found_unchanged);
+            send_absent(session, session->stream.found_absent);
+            session->stream.found_unchanged.clear();
+            session->stream.found_absent.clear();
+        }
+    }
+
+    prune_absent();
+}
+
+void chunk_stream::enqueue(Session *session, const ChunkCoord &cpos)
+{
+    if(!session->chunks.count(cpos)) {
+        session->stream.absent.erase(cpos);
+
+        if(session->stream.urgent_set.insert(cpos).second) {
+            session->stream.urgent.push_back(cpos);
+        }
+    }
+}
+
+void chunk_stream::validate(Session *session, const ChunkCoord &cpos, std::uint64_t hash)
+{
+    const std::size_t view_size = 2U * server_game::view_distance + 1U;
+
+    // Each chunk within the view is reported at most once
+    // by a well-behaved client; anything past that is junk
+    if(session->stream.hashes.size() < (view_size * view_size * view_size)) {
+        session->stream.hashes.emplace_back(cpos, hash);
+    }
+}
+
+void chunk_stream::reset(Session *session)
+{
+    session->stream.queue.clear();
+    session->stream.absent.clear();
+    session->stream.urgent.clear();
+    session->stream.urgent_set.clear();
+    session->stream.hashes.clear();
+    session->stream.found_absent.clear();
+    session->stream.found_unchanged.clear();
+    session->stream.origin = ChunkCoord();
+    session->stream.rebuild_time = UINT64_C(0);
+    session->stream.resume_time = globals::curtime + RESUME_TIMEOUT;
+    session->stream.budget = 0.0f;
+    session->stream.is_valid = false;
+}
+
+void chunk_stream::resume(Session *session)
+{
+    session->stream.resume_time = UINT64_C(0);
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk_coord.hh"
+
+struct Session;
+
+// Chunks are pushed to clients without them having
+// to ask; the queue is sorted so that the most important
+// chunk is always at the back and is sent the first
+struct ChunkStream final {
+    std::vector<ChunkCoord> queue {};
+    std::unordered_set<ChunkCoord> absent {};
+
+    // Chunks explicitly asked for go ahead of the sorted
+    // queue; a coordinate is never in there more than once
+    // no matter how many times it has been asked for
+    std::vector<ChunkCoord> urgent {};
+    std::unordered_set<ChunkCoord> urgent_set {};
+
+    // Content hashes of chunks the client has cached; they're
+    // checked before anything else is streamed, under the same
+    // load limit, since checking them might mean loading the chunk
+    std::vector<std::pair<ChunkCoord, std::uint64_t>> hashes {};
+
+    // Absent and unchanged chunks found during the current
+    // tick; they're all sent together once the tick is done
+    std::vector<ChunkCoord> found_absent {};
+    std::vector<ChunkCoord> found_unchanged {};
+
+    ChunkCoord origin {};
+    std::uint64_t rebuild_time {};
+    std::uint64_t resume_time {};
+    float budget {};
+    bool is_valid {};
+};
+
+namespace chunk_stream
+{
+// The load limit is shared by all the sessions; it
+// caps the number of chunks that are read from the disk
+// or generated during a single tick for the whole server
+extern unsigned int bandwidth;
+extern unsigned int max_loads;
+} // namespace chunk_stream
+
+namespace chunk_stream
+{
+void init(void);
+void init_late(void);
+void update_late(void);
+} // namespace chunk_stream
+
+namespace chunk_stream
+{
+// Pushes a chunk in front of everything else that
+// is still queued to be sent to the session, unless it
+// has already been pushed there and is yet to be sent
+void enqueue(Session *session, const ChunkCoord &cpos);
+void reset(Session *session);
+
+// Queues a cached chunk's hash to be checked against
+// the chunk on the server; the client is told the chunk
+// is unchanged if it matches or is sent the chunk otherwise
+void validate(Session *session, const ChunkCoord &cpos, std::uint64_t hash);
+
+// Streaming to a freshly reset session is held back
+// until the client reports the chunks it has cached
+void resume(Session *session);
+} // namespace chunk_stream
@@ -17,6 +17,7 @@
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
+#include "shared/world/chunk_codec.hh"
 #include "shared/world/game_items.hh"
 #include "shared/world/game_voxels.hh"
 #include "shared/world/universe.hh"
@@ -28,10 +29,16 @@
 #include "shared/motd.hh"
 #include "shared/protocol.hh"
 
+#include "server/capture.hh"
 #include "server/chat.hh"
+#include "server/chunk_cache.hh"
+#include "server/chunk_stream.hh"
 #include "server/globals.hh"
+#include "server/inbound.hh"
+#include "server/net_thread.hh"
 #include "server/receive.hh"
 #include "server/sessions.hh"
+#include "server/snapshots.hh"
 #include "server/status.hh"
 #include "server/whitelist.hh"
 
@@ -45,17 +52,29 @@ static std::string password_string = std::string();
 
 static std::uint64_t worldgen_seed = UINT64_C(42);
 
+static std::vector<ENetEvent> events = {};
+
 void server_game::init(void)
 {
     Config::add(globals::server_config, "game.listen_port", listen_port);
     Config::add(globals::server_config, "game.status_peers", status_peers);
     Config::add(globals::server_config, "game.password", password_string);
     Config::add(globals::server_config, "game.view_distance", server_game::view_distance);
+    Config::add(globals::server_config, "game.chunk_level", protocol::chunk_level);
 
     Config::add(globals::server_config, "worldgen.seed", worldgen_seed);
 
+    capture::init();
+
+    inbound::init();
+
     sessions::init();
 
+    chunk_cache::init();
+    chunk_stream::init();
+
+    server_snapshots::init();
+
     whitelist::init();
 
     motd::init("motds/server.txt");
@@ -74,8 +93,12 @@ void server_game::init_late(void)
     server_game::view_distance = cxpr::clamp(server_game::view_distance, 2U, 32U);
     server_game::password_hash = crc64::get(password_string);
 
+    protocol::chunk_level = cxpr::min(protocol::chunk_level, chunk_codec::LEVEL_MAX);
+
     sessions::init_late();
 
+    chunk_stream::init_late();
+
     whitelist::init_late();
 
     listen_port = cxpr::clamp<unsigned int>(listen_port, 1024U, UINT16_MAX);
@@ -85,7 +108,14 @@ void server_game::init_late(void)
     address.host = ENET_HOST_ANY;
     address.port = listen_port;
 
-    globals::server_host = enet_host_create(&address, sessions::max_players + status_peers, 1, 0, 0);
+    if(capture::is_replaying()) {
+        // Replays don't need the host to be
+        // reachable; only its peers are ever used
+        globals::server_host = enet_host_create(nullptr, sessions::max_players + status_peers, protocol::NUM_CHANNELS, 0, 0);
+    }
+    else {
+        globals::server_host = enet_host_create(&address, sessions::max_players + status_peers, protocol::NUM_CHANNELS, 0, 0);
+    }
 
     if(!globals::server_host) {
         spdlog::critical("game: unable to setup an ENet host");
@@ -95,30 +125,66 @@ void server_game::init_late(void)
     spdlog::info("game: host: {} player + {} status peers", sessions::max_players, status_peers);
     spdlog::info("game: host: listening on UDP port {}", address.port);
 
+    capture::init_late();
+
+    inbound::init_late();
+
+    status::init_late();
+
     game_voxels::populate();
     game_items::populate();
 
     std::string universe_name = {};
 
-    if(!cmdline::get_value("universe", universe_name))
+    if(capture::is_replaying()) {
+        // Replays run against a copy of the world as it was
+        // when the recording started; defaulting to the live save
+        // would replay on top of whatever it has turned into since
+        if(!cmdline::get_value("universe", universe_name)) {
+            spdlog::critical("game: replays need an explicit -universe");
+            std::terminate();
+        }
+
+        universe::is_read_only = true;
+    }
+    else if(!cmdline::get_value("universe", universe_name)) {
         universe_name = "save";
+    }
+
     universe::setup(universe_name);
 
     unloader::init_late(server_game::view_distance);
+
+    if(!capture::is_replaying()) {
+        // Replays are fed with recorded events
+        // and have nothing to receive from the network
+        net_thread::init_late();
+    }
 }
 
 void server_game::deinit(void)
 {
+    net_thread::deinit();
+
+    inbound::deinit();
+
     protocol::send_disconnect(nullptr, globals::server_host, "protocol.server_shutdown");
 
     whitelist::deinit();
 
     sessions::deinit();
 
-    enet_host_flush(globals::server_host);
-    enet_host_service(globals::server_host, nullptr, 500);
+    if(!capture::is_replaying()) {
+        enet_host_flush(globals::server_host);
+        enet_host_service(globals::server_host, nullptr, 500);
+    }
+
     enet_host_destroy(globals::server_host);
 
+    capture::deinit();
+
+    chunk_cache::deinit();
+
     universe::save_everything();
 }
 
@@ -137,21 +203,53 @@ void server_game::fixed_update(void)
 
 void server_game::fixed_update_late(void)
 {
-    ENetEvent event = {};
-
-    while(enet_host_service(globals::server_host, &event, 0) > 0) {
-        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
-            sessions::destroy(sessions::find(event.peer));
-            sessions::refresh_player_list();
-            continue;
-        }
-
-        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
-            protocol::receive(event.packet, event.peer);
-            enet_packet_destroy(event.packet);
-            continue;
+    // Everything sent during the tick is coalesced
+    // into as few datagrams per peer as possible
+    protocol::begin_frame();
+
+    // Events must be handled before anything is sent;
+    // it's only the disconnect that invalidates a session
+    // and lets the peer's slot go to a new connection
+    {
+        std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+        if(capture::is_replaying())
+            capture::replay(events);
+        else net_thread::drain(events);
+
+        capture::record(events);
+
+        for(const ENetEvent &event : events) {
+            if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+                inbound::forget(event.peer);
+                sessions::destroy(sessions::find(event.peer));
+                sessions::refresh_player_list();
+                net_thread::release(event.peer);
+                continue;
+            }
+
+            if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+                inbound::push(event.packet, event.peer);
+                continue;
+            }
         }
     }
 
+    inbound::update();
+
+    chunk_stream::update_late();
+
+    server_snapshots::update_late();
+
     unloader::update_late();
+    universe::update_late();
+
+    status::update_late();
+
+    protocol::end_frame();
+
+    if(!capture::is_replaying()) {
+        std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+        enet_host_flush(globals::server_host);
+    }
 }
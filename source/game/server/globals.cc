@@ -14,3 +14,5 @@ ENetHost *globals::server_host = {};
 bool globals::is_running = false;
 unsigned int globals::tickrate = protocol::TICKRATE;
 std::uint64_t globals::tickrate_dt = 0;
+
+float globals::fixed_busytime_avg = 0.0f;
@@ -13,4 +13,6 @@ extern ENetHost *server_host;
 extern bool is_running;
 extern unsigned int tickrate;
 extern std::uint64_t tickrate_dt;
+
+extern float fixed_busytime_avg;
 } // namespace globals
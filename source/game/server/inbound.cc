@@ -0,0 +1,357 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "server/precompiled.hh"
+#include "server/inbound.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/config.hh"
+#include "common/epoch.hh"
+
+#include "shared/protocol.hh"
+
+#include "server/capture.hh"
+#include "server/globals.hh"
+#include "server/net_thread.hh"
+#include "server/sessions.hh"
+
+
+constexpr static std::size_t CLASS_DEFAULT = 0;
+constexpr static std::size_t CLASS_MOVEMENT = 1;
+constexpr static std::size_t CLASS_CHAT = 2;
+constexpr static std::size_t CLASS_WORLD = 3;
+constexpr static std::size_t CLASS_CHUNKS = 4;
+constexpr static std::size_t NUM_CLASSES = 5;
+
+// Buckets refill at the rate (in messages per second)
+// and hold up to the burst amount of tokens; a message
+// takes a single token of its class to be handled
+struct MessageClass final {
+    float rate {};
+    float burst {};
+};
+
+constexpr static std::array<MessageClass, NUM_CLASSES> CLASSES = {
+    MessageClass { 600.0f, 256.0f },    // CLASS_DEFAULT: logins, status requests, acknowledgements
+    MessageClass { 600.0f, 64.0f },     // CLASS_MOVEMENT: player commands
+    MessageClass { 4.0f, 8.0f },        // CLASS_CHAT: chat messages
+    MessageClass { 60.0f, 32.0f },      // CLASS_WORLD: voxel edits and sounds
+    MessageClass { 2048.0f, 4096.0f },  // CLASS_CHUNKS: chunk requests and cache hashes
+};
+
+struct QueuedMessage final {
+    ENetPacket *packet {};
+    protocol::Message message {};
+    std::uint64_t order {};
+    std::uint64_t tick {};
+};
+
+struct PeerQueue final {
+    ENetPeer *peer {};
+    enet_uint32 connect_id {};
+    std::array<std::deque<QueuedMessage>, NUM_CLASSES> queues {};
+    std::array<float, NUM_CLASSES> tokens {};
+    std::uint64_t refill_tick {};
+    std::size_t backlog {};
+    bool is_kicked {};
+    bool is_disconnecting {};
+    InboundStats stats {};
+};
+
+unsigned int inbound::budget = 4000U;
+unsigned int inbound::max_backlog = 4096U;
+
+static std::vector<PeerQueue> peers = {};
+static std::vector<protocol::Message> messages = {};
+static std::size_t cursor = 0;
+static std::uint64_t next_order = 0;
+
+static std::size_t classify(std::uint16_t id)
+{
+    switch(id) {
+        case protocol::PlayerCommands::ID:
+            return CLASS_MOVEMENT;
+        case protocol::ChatMessage::ID:
+            return CLASS_CHAT;
+        case protocol::SetVoxel::ID:
+        case protocol::EntitySound::ID:
+            return CLASS_WORLD;
+        case protocol::RequestChunk::ID:
+        case protocol::ChunkHashes::ID:
+            return CLASS_CHUNKS;
+        default:
+            return CLASS_DEFAULT;
+    }
+}
+
+static void release(ENetPacket *packet)
+{
+    // Every queued message holds a reference
+    if(--packet->referenceCount == 0) {
+        enet_packet_destroy(packet);
+    }
+}
+
+static std::size_t drop_all(PeerQueue &queue)
+{
+    std::size_t count = 0;
+
+    for(std::deque<QueuedMessage> &fifo : queue.queues) {
+        for(const QueuedMessage &message : fifo)
+            release(message.packet);
+        count += fifo.size();
+        fifo.clear();
+    }
+
+    queue.backlog = 0;
+    queue.stats.dropped += count;
+
+    return count;
+}
+
+static void reset(PeerQueue &queue, ENetPeer *peer)
+{
+    drop_all(queue);
+
+    queue.peer = peer;
+    queue.connect_id = peer ? peer->connectID : 0;
+    queue.refill_tick = globals::fixed_framecount;
+    queue.is_kicked = false;
+    queue.is_disconnecting = false;
+    queue.stats = InboundStats();
+
+    for(std::size_t i = 0; i < NUM_CLASSES; ++i) {
+        queue.tokens[i] = CLASSES[i].burst;
+    }
+}
+
+static PeerQueue *find_queue(const ENetPeer *peer)
+{
+    if(peer) {
+        const std::size_t index = static_cast<std::size_t>(peer - globals::server_host->peers);
+        if(index < peers.size())
+            return &peers[index];
+        return nullptr;
+    }
+
+    return nullptr;
+}
+
+static const char *describe(const PeerQueue &queue)
+{
+    if(const Session *session = sessions::find(queue.peer))
+        return session->client_username.c_str();
+    return "unknown peer";
+}
+
+static void kick(PeerQueue &queue)
+{
+    spdlog::warn("inbound: {}: {} messages queued; disconnecting", describe(queue), queue.backlog);
+
+    drop_all(queue);
+
+    // The peer is told why it's being kicked right away; the
+    // connection itself is closed the next tick once the frame
+    // carrying the disconnect packet has been sent out
+    protocol::send_disconnect(queue.peer, nullptr, "protocol.flooding");
+    queue.is_kicked = true;
+    queue.is_disconnecting = true;
+}
+
+static void refill(PeerQueue &queue)
+{
+    if(queue.refill_tick == globals::fixed_framecount)
+        return;
+
+    // Ticks are counted instead of measuring time so
+    // that replays run out of tokens the same way as well
+    const auto ticks = static_cast<float>(globals::fixed_framecount - queue.refill_tick);
+    const auto seconds = ticks * static_cast<float>(globals::tickrate_dt) / 1000000.0f;
+    queue.refill_tick = globals::fixed_framecount;
+
+    for(std::size_t i = 0; i < NUM_CLASSES; ++i) {
+        queue.tokens[i] = cxpr::min(queue.tokens[i] + CLASSES[i].rate * seconds, CLASSES[i].burst);
+    }
+}
+
+static bool handle_next(PeerQueue &queue)
+{
+    if((queue.backlog == 0) || queue.is_kicked)
+        return false;
+
+    refill(queue);
+
+    // The oldest message of any class that still has
+    // a token left goes first; messages of the same class
+    // are always handled in the order they've arrived in
+    std::size_t best = NUM_CLASSES;
+
+    for(std::size_t i = 0; i < NUM_CLASSES; ++i) {
+        if(queue.queues[i].empty() || (queue.tokens[i] < 1.0f))
+            continue;
+        if((best == NUM_CLASSES) || (queue.queues[i].front().order < queue.queues[best].front().order)) {
+            best = i;
+        }
+    }
+
+    if(best == NUM_CLASSES)
+        return false;
+
+    const QueuedMessage message = queue.queues[best].front();
+    queue.queues[best].pop_front();
+    queue.tokens[best] -= 1.0f;
+    queue.backlog -= 1;
+
+    if(message.tick != globals::fixed_framecount)
+        queue.stats.deferred += 1;
+    queue.stats.handled += 1;
+
+    protocol::receive(message.packet, message.message, queue.peer);
+
+    release(message.packet);
+
+    return true;
+}
+
+void inbound::init(void)
+{
+    Config::add(globals::server_config, "inbound.budget", inbound::budget);
+    Config::add(globals::server_config, "inbound.max_backlog", inbound::max_backlog);
+}
+
+void inbound::init_late(void)
+{
+    inbound::max_backlog = cxpr::max(inbound::max_backlog, 64U);
+
+    peers.clear();
+    peers.resize(globals::server_host->peerCount);
+
+    cursor = 0;
+    next_order = 0;
+}
+
+void inbound::deinit(void)
+{
+    for(PeerQueue &queue : peers) {
+        drop_all(queue);
+    }
+
+    peers.clear();
+}
+
+void inbound::update(void)
+{
+    for(PeerQueue &queue : peers) {
+        if(queue.is_disconnecting) {
+            queue.is_disconnecting = false;
+
+            if(!capture::is_replaying()) {
+                std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+                enet_peer_disconnect_later(queue.peer, 0);
+            }
+        }
+    }
+
+    if(peers.empty())
+        return;
+
+    // Replays have to handle the very same messages
+    // every tick no matter how fast the machine is
+    const bool is_limited = (inbound::budget != 0U) && !capture::is_replaying();
+    const std::uint64_t start = epoch::microseconds();
+
+    bool has_handled = true;
+
+    while(has_handled) {
+        has_handled = false;
+
+        // The cursor carries over to the next tick so
+        // that whoever hasn't been served by the time
+        // the budget runs out goes first next time
+        for(std::size_t i = 0; i < peers.size(); ++i) {
+            PeerQueue &queue = peers[cursor];
+            cursor = (cursor + 1) % peers.size();
+
+            if(!handle_next(queue))
+                continue;
+            has_handled = true;
+
+            if(is_limited && ((epoch::microseconds() - start) >= inbound::budget)) {
+                return;
+            }
+        }
+    }
+}
+
+void inbound::push(ENetPacket *packet, ENetPeer *peer)
+{
+    PeerQueue *queue = find_queue(peer);
+
+    if(queue == nullptr) {
+        enet_packet_destroy(packet);
+        return;
+    }
+
+    // ENet resets the peer as soon as it's disconnected, which
+    // can happen before its last packets get here; those still
+    // belong to the connection that's currently in the slot
+    if((queue->peer != peer) || (peer->connectID && (queue->connect_id != peer->connectID))) {
+        // The slot now belongs to a different connection
+        reset(*queue, peer);
+    }
+
+    protocol::split(packet, messages);
+
+    if(queue->is_kicked || messages.empty()) {
+        queue->stats.dropped += messages.size();
+        enet_packet_destroy(packet);
+        return;
+    }
+
+    packet->referenceCount = messages.size();
+
+    for(const protocol::Message &message : messages) {
+        QueuedMessage queued = {};
+        queued.packet = packet;
+        queued.message = message;
+        queued.order = next_order++;
+        queued.tick = globals::fixed_framecount;
+        queue->queues[classify(message.id)].push_back(queued);
+    }
+
+    queue->backlog += messages.size();
+
+    if(queue->backlog > inbound::max_backlog) {
+        kick(*queue);
+    }
+}
+
+void inbound::forget(ENetPeer *peer)
+{
+    if(PeerQueue *queue = find_queue(peer)) {
+        // ENet resets the peer before the disconnect
+        // is handled here so its connection identifier
+        // is long gone and can't be compared against
+        if(queue->peer == peer) {
+            const std::size_t count = drop_all(*queue);
+            const InboundStats &stats = queue->stats;
+
+            if(stats.deferred || (stats.dropped > count)) {
+                spdlog::info("inbound: {}: {} messages handled, {} deferred, {} dropped ({} on disconnect)", describe(*queue),
+                    stats.handled, stats.deferred, stats.dropped, count);
+            }
+        }
+
+        reset(*queue, nullptr);
+    }
+}
+
+const InboundStats *inbound::find(const ENetPeer *peer)
+{
+    if(const PeerQueue *queue = find_queue(peer)) {
+        if((queue->peer == peer) && (queue->connect_id == peer->connectID))
+            return &queue->stats;
+        return nullptr;
+    }
+
+    return nullptr;
+}
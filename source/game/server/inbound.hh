@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+// Messages that had to wait for a later tick are counted
+// as deferred once they're handled; dropped ones are the ones
+// thrown away because the peer has been kicked or disconnected
+struct InboundStats final {
+    std::uint64_t handled {};
+    std::uint64_t deferred {};
+    std::uint64_t dropped {};
+};
+
+// Received messages are queued per peer and handled in
+// rounds, a single message per peer every round, until either
+// the queues run dry or the tick's time budget runs out. Every
+// peer has a token bucket for each class of messages so that no
+// one can flood the server with expensive requests; messages that
+// don't fit wait for the following ticks and a peer whose backlog
+// grows past the hard limit is disconnected altogether
+namespace inbound
+{
+extern unsigned int budget;
+extern unsigned int max_backlog;
+} // namespace inbound
+
+namespace inbound
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+void update(void);
+} // namespace inbound
+
+namespace inbound
+{
+// The packet is owned by the queue
+// from now on and destroyed once handled
+void push(ENetPacket *packet, ENetPeer *peer);
+
+// Drops whatever the peer still has queued; must
+// be called whenever the peer has been disconnected
+void forget(ENetPeer *peer);
+} // namespace inbound
+
+namespace inbound
+{
+const InboundStats *find(const ENetPeer *peer);
+} // namespace inbound
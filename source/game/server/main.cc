@@ -14,6 +14,7 @@
 
 #include "shared/setup.hh"
 
+#include "server/capture.hh"
 #include "server/game.hh"
 #include "server/globals.hh"
 
@@ -24,6 +25,67 @@ static void on_termination_signal(int)
     globals::is_running = false;
 }
 
+static void run_replay(void)
+{
+    std::vector<std::uint64_t> tick_times = {};
+    std::uint64_t total_time = 0;
+
+    while(globals::is_running && !capture::is_finished()) {
+        // Simulated time advances by exactly one tick no
+        // matter how long the tick itself has actually taken
+        globals::curtime += globals::tickrate_dt;
+
+        globals::fixed_frametime_us = globals::tickrate_dt;
+        globals::fixed_frametime = static_cast<float>(globals::fixed_frametime_us) / 1000000.0f;
+        globals::fixed_frametime_avg = globals::fixed_frametime;
+
+        const std::uint64_t tick_start = epoch::microseconds();
+
+        server_game::fixed_update();
+        server_game::fixed_update_late();
+
+        globals::dispatcher.update();
+
+        const std::uint64_t tick_time = epoch::microseconds() - tick_start;
+
+        globals::fixed_busytime_avg += static_cast<float>(tick_time) / 1000000.0f;
+        globals::fixed_busytime_avg *= 0.5f;
+
+        tick_times.push_back(tick_time);
+        total_time += tick_time;
+
+        globals::fixed_framecount += 1;
+
+        resource::soft_cleanup<BinaryFile>();
+        resource::soft_cleanup<Image>();
+    }
+
+    if(tick_times.empty())
+        return;
+
+    std::vector<std::size_t> slowest = {};
+    slowest.resize(tick_times.size());
+    std::iota(slowest.begin(), slowest.end(), std::size_t(0));
+    std::sort(slowest.begin(), slowest.end(), [&tick_times](std::size_t a, std::size_t b) {
+        return tick_times[a] > tick_times[b];
+    });
+
+    std::vector<std::uint64_t> sorted = tick_times;
+    std::sort(sorted.begin(), sorted.end());
+
+    const auto p50 = sorted[(sorted.size() - 1) * 50 / 100];
+    const auto p99 = sorted[(sorted.size() - 1) * 99 / 100];
+    const auto mean = static_cast<float>(total_time) / static_cast<float>(tick_times.size());
+
+    spdlog::info("server: replayed {} ticks in {:.03f} s", tick_times.size(), static_cast<float>(total_time) / 1000000.0f);
+    spdlog::info("server: tick time: mean {:.03f} ms, p50 {:.03f} ms, p99 {:.03f} ms, max {:.03f} ms", mean / 1000.0f,
+        static_cast<float>(p50) / 1000.0f, static_cast<float>(p99) / 1000.0f, static_cast<float>(sorted.back()) / 1000.0f);
+
+    for(std::size_t i = 0; i < cxpr::min<std::size_t>(5, slowest.size()); ++i) {
+        spdlog::info("server: slowest tick #{}: {:.03f} ms", slowest[i], static_cast<float>(tick_times[slowest[i]]) / 1000.0f);
+    }
+}
+
 int main(int argc, char **argv)
 {
     cmdline::append(argc, argv);
@@ -36,6 +98,7 @@ int main(int argc, char **argv)
     globals::fixed_frametime_avg = 0.0f;
     globals::fixed_frametime_us = 0;
     globals::fixed_framecount = 0;
+    globals::fixed_busytime_avg = 0.0f;
 
     globals::curtime = epoch::microseconds();
 
@@ -54,6 +117,13 @@ int main(int argc, char **argv)
 
     server_game::init_late();
 
+    if(capture::is_replaying()) {
+        // Replays run as fast as they can and
+        // then shut the server down as usual
+        run_replay();
+        globals::is_running = false;
+    }
+
     std::uint64_t last_curtime = globals::curtime;
     
     while(globals::is_running) {
@@ -65,11 +135,16 @@ int main(int argc, char **argv)
         globals::fixed_frametime_avg *= 0.5f;
 
         last_curtime = globals::curtime;
-        
+
         server_game::fixed_update();
         server_game::fixed_update_late();
 
         globals::dispatcher.update();
+
+        // Unlike the frametime this doesn't include the sleep
+        // and shows how close the server is to falling behind
+        globals::fixed_busytime_avg += static_cast<float>(epoch::microseconds() - globals::curtime) / 1000000.0f;
+        globals::fixed_busytime_avg *= 0.5f;
         
         globals::fixed_framecount += 1;
 
@@ -87,6 +162,7 @@ int main(int argc, char **argv)
     spdlog::info("server: shutdown after {} frames", globals::fixed_framecount);
     spdlog::info("server: average framerate: {:.03f} TPS", 1.0f / globals::fixed_frametime_avg);
     spdlog::info("server: average frametime: {:.03f} MSPT", 1000.0f * globals::fixed_frametime_avg);
+    spdlog::info("server: average busytime: {:.03f} MSPT", 1000.0f * globals::fixed_busytime_avg);
 
     Config::save(globals::server_config, "server.conf");
 
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "server/precompiled.hh"
+#include "server/net_thread.hh"
+
+#include "shared/protocol.hh"
+
+#include "server/globals.hh"
+
+
+// How long the I/O thread waits for the socket to become
+// readable before it services the host again anyway; this also
+// bounds the delay of ENet's own resends and pings
+constexpr static enet_uint32 WAIT_TIMEOUT_MS = 1;
+
+std::recursive_mutex net_thread::host_mutex = {};
+
+static std::thread io_thread = {};
+static std::atomic<bool> is_servicing = false;
+static std::vector<ENetEvent> pending_events = {};
+
+static void service_host(void)
+{
+    ENetEvent event = {};
+
+    while(enet_host_service(globals::server_host, &event, 0) > 0) {
+        if(event.type == ENET_EVENT_TYPE_CONNECT) {
+            // Sessions are created when the login
+            // request is received; there's nothing to do
+            continue;
+        }
+
+        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+            // ENet has reset the peer by now; zombie
+            // peers are skipped by ENet entirely and aren't
+            // handed out to new connections until released
+            event.peer->state = ENET_PEER_STATE_ZOMBIE;
+        }
+
+        pending_events.push_back(event);
+    }
+}
+
+static void thread_main(void)
+{
+    while(is_servicing) {
+        {
+            std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+            service_host();
+        }
+
+        // The socket itself never changes during
+        // the lifetime of the host so it's safe to wait on
+        // it without keeping the tick thread locked out
+        enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE | ENET_SOCKET_WAIT_INTERRUPT;
+        enet_socket_wait(globals::server_host->socket, &condition, WAIT_TIMEOUT_MS);
+    }
+}
+
+void net_thread::init_late(void)
+{
+    pending_events.clear();
+
+    protocol::host_mutex = &net_thread::host_mutex;
+
+    is_servicing = true;
+    io_thread = std::thread(&thread_main);
+}
+
+void net_thread::deinit(void)
+{
+    is_servicing = false;
+
+    if(io_thread.joinable())
+        io_thread.join();
+
+    protocol::host_mutex = nullptr;
+
+    for(const ENetEvent &event : pending_events) {
+        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+            enet_packet_destroy(event.packet);
+        }
+    }
+
+    pending_events.clear();
+}
+
+void net_thread::drain(std::vector<ENetEvent> &events)
+{
+    // Whatever has arrived since the I/O thread
+    // serviced the host the last time is picked up too
+    service_host();
+
+    events.clear();
+    events.swap(pending_events);
+}
+
+void net_thread::release(ENetPeer *peer)
+{
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    if(peer->state == ENET_PEER_STATE_ZOMBIE) {
+        peer->state = ENET_PEER_STATE_DISCONNECTED;
+    }
+}
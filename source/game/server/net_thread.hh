@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+// ENet hosts are not thread-safe so anything that touches the
+// host or its peers holds the host mutex, and only for as long
+// as it needs to; the I/O thread services the host whenever the
+// mutex is free, the tick included, so that acknowledgements,
+// pings, incoming packets and whatever the tick has just sent
+// don't have to wait for the tick to be over
+namespace net_thread
+{
+extern std::recursive_mutex host_mutex;
+} // namespace net_thread
+
+namespace net_thread
+{
+void init_late(void);
+void deinit(void);
+} // namespace net_thread
+
+namespace net_thread
+{
+// Moves every event received since the last call into
+// the vector; must only be called while holding the lock
+void drain(std::vector<ENetEvent> &events);
+
+// Disconnected peers keep their slot until the tick has
+// handled the disconnect; a new connection could otherwise
+// take the slot over while the tick still sends to the old one
+void release(ENetPeer *peer);
+} // namespace net_thread
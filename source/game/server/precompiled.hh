@@ -9,8 +9,12 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <numeric>
 #include <random>
 #include <sstream>
 #include <string>
@@ -19,6 +23,7 @@
 #include <typeinfo>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -2,65 +2,73 @@
 #include "server/precompiled.hh"
 #include "server/receive.hh"
 
-#include "mathlib/box3base.hh"
+#include "mathlib/constexpr.hh"
 
+#include "shared/entity/grounded.hh"
 #include "shared/entity/head.hh"
+#include "shared/entity/pmove.hh"
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
-#include "shared/world/universe.hh"
 #include "shared/world/world.hh"
 
 #include "shared/protocol.hh"
 
-#include "server/game.hh"
+#include "server/chunk_stream.hh"
 #include "server/globals.hh"
 #include "server/sessions.hh"
 
 
-static void on_entity_transform_packet(const protocol::EntityTransform &packet)
-{
-    if(auto session = sessions::find(packet.peer)) {
-        if(globals::registry.valid(session->player_entity)) {
-            auto &component = globals::registry.emplace_or_replace<TransformComponent>(session->player_entity);
-            component.position = packet.coord;
-            component.angles = packet.angles;
-
-            // Propagate changes to the rest of the world
-            // except the peer that has sent the packet in the first place
-            protocol::send_entity_transform(packet.peer, globals::server_host, session->player_entity);
-        }
-    }
-}
+// Commands that are allowed to be run at once after
+// the client hasn't sent any for a while; enough to cover
+// for a hiccup without letting anyone speed up for long
+constexpr static std::uint64_t MAX_COMMAND_BURST = 16;
 
-static void on_entity_velocity_packet(const protocol::EntityVelocity &packet)
+static void on_player_commands_packet(const protocol::PlayerCommands &packet)
 {
     if(auto session = sessions::find(packet.peer)) {
-        if(globals::registry.valid(session->player_entity)) {
-            auto &component = globals::registry.emplace_or_replace<VelocityComponent>(session->player_entity);
-            component.angular = packet.angular;
-            component.linear = packet.linear;
-
-            // Propagate changes to the rest of the world
-            // except the peer that has sent the packet in the first place
-            // UNDONE: pass nullptr instead of packet.peer when we want to correct the client
-            protocol::send_entity_velocity(packet.peer, globals::server_host, session->player_entity);
+        if(!globals::registry.valid(session->player_entity)) {
+            // De-spawned sessions have nothing to move
+            return;
         }
-    }
-}
 
-static void on_entity_head_packet(const protocol::EntityHead &packet)
-{
-    if(auto session = sessions::find(packet.peer)) {
-        if(globals::registry.valid(session->player_entity)) {
-            auto &component = globals::registry.emplace_or_replace<HeadComponent>(session->player_entity);
-            component.angles = packet.angles;
-
-            // Propagate changes to the rest of the world
-            // except the peer that has sent the packet in the first place
-            // UNDONE: pass nullptr instead of packet.peer when we want to correct the client
-            protocol::send_entity_head(packet.peer, globals::server_host, session->player_entity);
+        const auto ticks = globals::fixed_framecount - session->command_tick;
+        session->command_tick = globals::fixed_framecount;
+        session->command_budget = static_cast<unsigned int>(cxpr::min<std::uint64_t>(session->command_budget + ticks, MAX_COMMAND_BURST));
+
+        for(const PlayerCommand &command : packet.commands) {
+            if(command.sequence <= session->player_sequence) {
+                // Commands are repeated until they're
+                // acknowledged; this one has been run already
+                continue;
+            }
+
+            if(session->command_budget == 0U) {
+                // The rest is going to be sent again
+                // and will be run on some later tick
+                break;
+            }
+
+            pmove::simulate(session->player_entity, command);
+
+            auto &head = globals::registry.get<HeadComponent>(session->player_entity);
+            head.angles = command.head;
+
+            session->player_sequence = command.sequence;
+            session->command_budget -= 1U;
         }
+
+        // Other clients learn about the change
+        // with the next entity snapshot they're sent
+        const auto &transform = globals::registry.get<TransformComponent>(session->player_entity);
+        const auto &velocity = globals::registry.get<VelocityComponent>(session->player_entity);
+
+        protocol::PlayerStateAck response = {};
+        response.sequence = session->player_sequence;
+        response.coord = transform.position;
+        response.linear = velocity.linear;
+        response.is_grounded = globals::registry.any_of<GroundedComponent>(session->player_entity);
+        protocol::send(packet.peer, nullptr, response);
     }
 }
 
@@ -75,10 +83,9 @@ static void on_set_voxel_packet(const protocol::SetVoxel &packet)
         chunk->entity = globals::registry.create();
         chunk->voxels[index] = packet.voxel;
 
+        // ChunkCreateEvent sends the newly created
+        // chunk to peers that have it within their view
         world::emplace_or_replace(cpos, chunk);
-        
-        // Broadcast the newly created chunk to peers
-        protocol::send_chunk_voxels(nullptr, globals::server_host, chunk->entity);
     }
 }
 
@@ -91,16 +98,35 @@ static void on_request_chunk_packet(const protocol::RequestChunk &packet)
             return;
         }
 
-        if(auto transform = globals::registry.try_get<TransformComponent>(session->player_entity)) {
-            auto view_box = Box3base<ChunkCoord::value_type>();
-            view_box.min = transform->position.chunk - server_game::view_distance;
-            view_box.max = transform->position.chunk + server_game::view_distance;
+        if(session->chunks.count(packet.coord)) {
+            // The chunk is either already held by the
+            // client or the packet is still on its way there
+            return;
+        }
 
-            if(Box3base<ChunkCoord::value_type>::contains(view_box, packet.coord)) {
-                if(auto chunk = universe::load_chunk(packet.coord)) {
-                    protocol::send_chunk_voxels(packet.peer, nullptr, chunk->entity);
-                }
-            }
+        // Chunks are streamed to clients without being
+        // asked for; an explicit request just bumps the chunk
+        // to the front of the session's streaming queue
+        if(sessions::is_in_view(session, packet.coord)) {
+            chunk_stream::enqueue(session, packet.coord);
+        }
+    }
+}
+
+static void on_chunk_hashes_packet(const protocol::ChunkHashes &packet)
+{
+    if(auto session = sessions::find(packet.peer)) {
+        if(!globals::registry.valid(session->player_entity)) {
+            // De-spawned sessions don't get chunks
+            return;
+        }
+
+        for(const protocol::ChunkHashes::Entry &entry : packet.entries) {
+            chunk_stream::validate(session, entry.coord, entry.hash);
+        }
+
+        if(packet.is_final) {
+            chunk_stream::resume(session);
         }
     }
 }
@@ -118,16 +144,15 @@ static void on_entity_sound_packet(const protocol::EntitySound &packet)
         response.sound = packet.sound;
         response.looping = packet.looping;
         response.pitch = packet.pitch;
-        protocol::send(packet.peer, globals::server_host, response);
+        sessions::broadcast_interested(response.entity, protocol::encode(response), packet.peer);
     }
 }
 
 void server_recieve::init(void)
 {
-    globals::dispatcher.sink<protocol::EntityTransform>().connect<&on_entity_transform_packet>();
-    globals::dispatcher.sink<protocol::EntityVelocity>().connect<&on_entity_velocity_packet>();
-    globals::dispatcher.sink<protocol::EntityHead>().connect<&on_entity_head_packet>();
+    globals::dispatcher.sink<protocol::PlayerCommands>().connect<&on_player_commands_packet>();
     globals::dispatcher.sink<protocol::SetVoxel>().connect<&on_set_voxel_packet>();
     globals::dispatcher.sink<protocol::RequestChunk>().connect<&on_request_chunk_packet>();
     globals::dispatcher.sink<protocol::EntitySound>().connect<&on_entity_sound_packet>();
+    globals::dispatcher.sink<protocol::ChunkHashes>().connect<&on_chunk_hashes_packet>();
 }
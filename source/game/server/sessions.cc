@@ -2,6 +2,7 @@
 #include "server/precompiled.hh"
 #include "server/sessions.hh"
 
+#include "mathlib/box3base.hh"
 #include "mathlib/constexpr.hh"
 
 #include "common/config.hh"
@@ -9,13 +10,14 @@
 #include "common/fstools.hh"
 #include "common/strtools.hh"
 
+#include "shared/entity/chunk.hh"
+#include "shared/entity/commanded.hh"
 #include "shared/entity/factory.hh"
 #include "shared/entity/head.hh"
 #include "shared/entity/player.hh"
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
-#include "shared/event/chunk_create.hh"
 #include "shared/event/chunk_update.hh"
 #include "shared/event/voxel_set.hh"
 
@@ -24,8 +26,11 @@
 
 #include "shared/protocol.hh"
 
+#include "server/chunk_cache.hh"
+#include "server/chunk_stream.hh"
 #include "server/game.hh"
 #include "server/globals.hh"
+#include "server/net_thread.hh"
 #include "server/whitelist.hh"
 
 
@@ -88,26 +93,28 @@ static void on_login_request_packet(const protocol::LoginRequest &packet)
 
         spdlog::info("sessions: {} [{}] logged in with client_index={}", session->client_username, session->client_identity, session->client_index);
 
-        // FIXME: only send entities that are present within the current
-        // player's view bounding box; this also would mean we're not sending
-        // anything here and just straight up spawing the player and await them
-        // to receive all the chunks and entites they feel like requesting
-        for(auto entity : globals::registry.view<entt::entity>()) {
-            protocol::send_entity_head(session->peer, nullptr, entity);
-            protocol::send_entity_transform(session->peer, nullptr, entity);
-            protocol::send_entity_velocity(session->peer, nullptr, entity);
-            protocol::send_entity_player(session->peer, nullptr, entity);
-        }
-
         session->player_entity = globals::registry.create();
         shared_entity_factory::create_player(session->player_entity);
+        globals::registry.emplace<CommandedComponent>(session->player_entity);
+
+        // Only the entities within the player's view box are sent
+        // right away; snapshots stream the rest in and out as they
+        // (or the player) cross the view box boundaries later on
+        for(const auto [entity, transform] : globals::registry.view<TransformComponent>().each()) {
+            if((entity != session->player_entity) && sessions::is_in_view(session, transform.position.chunk)) {
+                sessions::send_entity(session, entity);
+            }
+        }
 
         // The player entity is to be spawned in the world the last;
         // We don't want to interact with the still not-loaded world!
-        protocol::send_entity_head(nullptr, globals::server_host, session->player_entity);
-        protocol::send_entity_transform(nullptr, globals::server_host, session->player_entity);
-        protocol::send_entity_velocity(nullptr, globals::server_host, session->player_entity);
-        protocol::send_entity_player(nullptr, globals::server_host, session->player_entity);
+        sessions::send_entity(session, session->player_entity);
+
+        for(Session &other : sessions_vector) {
+            if(other.peer && (&other != session) && sessions::is_in_view(&other, session->player_entity)) {
+                sessions::send_entity(&other, session->player_entity);
+            }
+        }
 
         // SpawnPlayer serves a different purpose compared to EntityPlayer
         // The latter is used to construct entities (as in "attach a component")
@@ -148,34 +155,70 @@ static void on_disconnect_packet(const protocol::Disconnect &packet)
 // NOTE: [sessions] is a good place for this since [receive]
 // handles entity data sent by players and [sessions] handles
 // everything else network related that is not player movement
-static void on_chunk_create(const ChunkCreateEvent &event)
+static void on_chunk_update(const ChunkUpdateEvent &event)
 {
-    protocol::ChunkVoxels packet = {};
-    packet.entity = event.chunk->entity;
-    packet.chunk = event.coord;
-    packet.voxels = event.chunk->voxels;
-    protocol::send(nullptr, globals::server_host, packet);
+    if(ENetPacket *packet = chunk_cache::find(event.chunk->entity)) {
+        sessions::broadcast_interested(event.coord, packet, nullptr);
+    }
 }
 
-static void on_chunk_update(const ChunkUpdateEvent &event)
+static void on_voxel_set(const VoxelSetEvent &event)
 {
-    protocol::ChunkVoxels packet = {};
-    packet.entity = event.chunk->entity;
-    packet.chunk = event.coord;
-    packet.voxels = event.chunk->voxels;
-    protocol::send(nullptr, globals::server_host, packet);
+    protocol::SetVoxel packet = {};
+    packet.coord = event.vpos;
+    packet.voxel = event.voxel;
+    packet.flags = UINT16_C(0x0000); // UNDONE
+    sessions::broadcast_interested(event.cpos, protocol::encode(packet), nullptr);
 }
 
-static void on_voxel_set(const VoxelSetEvent &event)
+// Shared packets must be held onto under the host lock until
+// they're released; otherwise the I/O thread could let go of
+// one as soon as the first peer acknowledges it
+static void release_unused(ENetPacket *packet)
 {
-    protocol::send_set_voxel(nullptr, globals::server_host, event.vpos, event.voxel);
+    if(packet->referenceCount == 0) {
+        // Nobody was interested in the packet
+        enet_packet_destroy(packet);
+    }
+}
+
+static void on_destroy_chunk(const entt::registry &registry, entt::entity entity)
+{
+    const auto &component = registry.get<ChunkComponent>(entity);
+
+    protocol::RemoveChunk packet = {};
+    packet.entity = entity;
+
+    ENetPacket *encoded = protocol::encode(packet);
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    // Registry destroys components before the entity itself, so
+    // this is the only place where a dying chunk entity can still be
+    // told apart from others; on_destroy_entity doesn't know chunks
+    for(Session &session : sessions_vector) {
+        if(session.peer && session.chunks.erase(component.coord)) {
+            protocol::send(session.peer, nullptr, encoded);
+        }
+    }
+
+    release_unused(encoded);
 }
 
 static void on_destroy_entity(const entt::registry &registry, entt::entity entity)
 {
     protocol::RemoveEntity packet = {};
     packet.entity = entity;
-    protocol::send(nullptr, globals::server_host, packet);
+
+    ENetPacket *encoded = protocol::encode(packet);
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    for(Session &session : sessions_vector) {
+        if(session.peer && session.entities.erase(entity)) {
+            protocol::send(session.peer, nullptr, encoded);
+        }
+    }
+
+    release_unused(encoded);
 }
 
 void sessions::init(void)
@@ -185,10 +228,10 @@ void sessions::init(void)
     globals::dispatcher.sink<protocol::LoginRequest>().connect<&on_login_request_packet>();
     globals::dispatcher.sink<protocol::Disconnect>().connect<&on_disconnect_packet>();
 
-    globals::dispatcher.sink<ChunkCreateEvent>().connect<&on_chunk_create>();
     globals::dispatcher.sink<ChunkUpdateEvent>().connect<&on_chunk_update>();
     globals::dispatcher.sink<VoxelSetEvent>().connect<&on_voxel_set>();
 
+    globals::registry.on_destroy<ChunkComponent>().connect<&on_destroy_chunk>();
     globals::registry.on_destroy<entt::entity>().connect<&on_destroy_entity>();
 }
 
@@ -207,6 +250,8 @@ void sessions::init_late(void)
         sessions_vector[i].client_username = std::string();
         sessions_vector[i].player_entity = entt::null;
         sessions_vector[i].peer = nullptr;
+        sessions_vector[i].chunks.clear();
+        sessions_vector[i].entities.clear();
     }
 }
 
@@ -227,7 +272,17 @@ Session *sessions::create(ENetPeer *peer, const std::string &client_username)
             sessions_vector[i].client_identity = client_identity;
             sessions_vector[i].client_username = client_username;
             sessions_vector[i].player_entity = entt::null;
-            sessions_vector[i].peer = peer;        
+            sessions_vector[i].peer = peer;
+            sessions_vector[i].chunks.clear();
+            sessions_vector[i].entities.clear();
+
+            chunk_stream::reset(&sessions_vector[i]);
+            snapshot::reset(sessions_vector[i].snapshots);
+            sessions_vector[i].priorities.clear();
+            sessions_vector[i].snapshot_budget = 0.0f;
+            sessions_vector[i].player_sequence = UINT32_C(0);
+            sessions_vector[i].command_tick = globals::fixed_framecount;
+            sessions_vector[i].command_budget = 0U;
 
             username_map[client_username] = &sessions_vector[i];
             identity_map[client_identity] = &sessions_vector[i];
@@ -284,7 +339,14 @@ void sessions::destroy(Session *session)
             // Make sure we don't leave a mark
             session->peer->data = nullptr;
         }
-        
+
+        // The peer is going away; there's no point
+        // in telling it about its own player entity removal
+        session->chunks.clear();
+        session->entities.clear();
+
+        chunk_stream::reset(session);
+
         globals::registry.destroy(session->player_entity);
 
         username_map.erase(session->client_username);
@@ -312,3 +374,89 @@ void sessions::refresh_player_list(void)
 
     protocol::send(nullptr, globals::server_host, packet);
 }
+
+bool sessions::is_in_view(const Session *session, const ChunkCoord &cpos)
+{
+    if(const TransformComponent *transform = globals::registry.try_get<TransformComponent>(session->player_entity)) {
+        auto view_box = Box3base<ChunkCoord::value_type>();
+        view_box.min = transform->position.chunk - server_game::view_distance;
+        view_box.max = transform->position.chunk + server_game::view_distance;
+        return Box3base<ChunkCoord::value_type>::contains(view_box, cpos);
+    }
+
+    return false;
+}
+
+bool sessions::is_in_view(const Session *session, entt::entity entity)
+{
+    if(const TransformComponent *transform = globals::registry.try_get<TransformComponent>(entity))
+        return sessions::is_in_view(session, transform->position.chunk);
+    return globals::registry.valid(session->player_entity);
+}
+
+void sessions::send_chunk(Session *session, entt::entity entity)
+{
+    if(const ChunkComponent *component = globals::registry.try_get<ChunkComponent>(entity)) {
+        if(session->chunks.insert(component->coord).second) {
+            protocol::send(session->peer, nullptr, chunk_cache::find(entity));
+        }
+    }
+}
+
+void sessions::send_entity(Session *session, entt::entity entity)
+{
+    // Components are constructed by reliable packets; the
+    // state that follows them is unreliable and snapshots will
+    // fill it in eventually if it doesn't make it there
+    protocol::send_entity_player(session->peer, nullptr, entity);
+    protocol::send_entity_head(session->peer, nullptr, entity);
+    protocol::send_entity_transform(session->peer, nullptr, entity);
+    protocol::send_entity_velocity(session->peer, nullptr, entity);
+    session->entities.insert(entity);
+}
+
+void sessions::remove_entity(Session *session, entt::entity entity)
+{
+    if(session->entities.erase(entity)) {
+        protocol::RemoveEntity packet = {};
+        packet.entity = entity;
+        protocol::send(session->peer, nullptr, packet);
+    }
+}
+
+void sessions::broadcast_interested(const ChunkCoord &cpos, ENetPacket *packet, ENetPeer *except)
+{
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    for(Session &session : sessions_vector) {
+        if(session.peer && (session.peer != except) && session.chunks.count(cpos)) {
+            protocol::send(session.peer, nullptr, packet);
+        }
+    }
+
+    release_unused(packet);
+}
+
+void sessions::broadcast_interested(entt::entity entity, ENetPacket *packet, ENetPeer *except)
+{
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    for(Session &session : sessions_vector) {
+        if(!session.peer || (session.peer == except))
+            continue;
+
+        if(!sessions::is_in_view(&session, entity))
+            continue;
+
+        if(!session.entities.count(entity)) {
+            // The entity has just wandered into the view
+            // box; the full state supersedes the packet here
+            sessions::send_entity(&session, entity);
+            continue;
+        }
+
+        protocol::send(session.peer, nullptr, packet);
+    }
+
+    release_unused(packet);
+}
@@ -1,5 +1,10 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
+#include "shared/entity/snapshot.hh"
+
+#include "shared/world/chunk_coord.hh"
+
+#include "server/chunk_stream.hh"
 
 namespace sessions
 {
@@ -13,6 +18,28 @@ struct Session final {
     std::string client_username {};
     entt::entity player_entity {};
     ENetPeer *peer {};
+
+    // Interest sets; chunks are the ones the client has been
+    // sent and is expected to hold, entities are the non-chunk
+    // entities the client has been told about at some point
+    std::unordered_set<ChunkCoord> chunks {};
+    std::unordered_set<entt::entity> entities {};
+
+    ChunkStream stream {};
+    SnapshotHistory snapshots {};
+
+    // Update priorities accumulated for the entities
+    // within the view box and the snapshot bytes the
+    // session is still allowed to be sent this tick
+    emhash8::HashMap<entt::entity, float> priorities {};
+    float snapshot_budget {};
+
+    // Latest player command that has been run; the budget
+    // grows by a single command every tick so that sending
+    // commands faster doesn't make the player move faster
+    std::uint32_t player_sequence {};
+    std::uint64_t command_tick {};
+    unsigned int command_budget {};
 };
 
 namespace sessions
@@ -36,3 +63,23 @@ namespace sessions
 {
 void refresh_player_list(void);
 } // namespace sessions
+
+namespace sessions
+{
+bool is_in_view(const Session *session, const ChunkCoord &cpos);
+bool is_in_view(const Session *session, entt::entity entity);
+void send_chunk(Session *session, entt::entity entity);
+void send_entity(Session *session, entt::entity entity);
+void remove_entity(Session *session, entt::entity entity);
+} // namespace sessions
+
+namespace sessions
+{
+// Chunk packets only go to sessions that hold the chunk; entity
+// packets go to sessions that have the entity within their view
+// box and sessions that don't know about the entity yet are sent
+// its entire state instead of the packet; the packet is released
+// if it ends up not being sent to anyone at all
+void broadcast_interested(const ChunkCoord &cpos, ENetPacket *packet, ENetPeer *except);
+void broadcast_interested(entt::entity entity, ENetPacket *packet, ENetPeer *except);
+} // namespace sessions
@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "server/precompiled.hh"
+#include "server/snapshots.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/config.hh"
+#include "common/packet_buffer.hh"
+
+#include "shared/entity/snapshot.hh"
+#include "shared/entity/transform.hh"
+
+#include "shared/protocol.hh"
+
+#include "server/game.hh"
+#include "server/globals.hh"
+#include "server/sessions.hh"
+
+
+// Entities within this distance are updated every tick;
+// further away the update rate drops proportionally down
+// to a single update every MAX_INTERVAL ticks
+constexpr static float NEAR_DISTANCE = 16.0f;
+constexpr static float MAX_INTERVAL = 8.0f;
+
+// Entities that have drifted further than this away from
+// what the client has seen are updated the next chance they get
+constexpr static float ERROR_THRESHOLD = 2.0f;
+
+// Entities the client knows nothing about yet go first
+constexpr static float NEW_PRIORITY = 1000.0f;
+
+// Entities are removed from the client once they're this
+// many chunks past the view box; otherwise the ones walking
+// along its edge would keep coming and going every other tick
+constexpr static std::int32_t VIEW_MARGIN = 1;
+
+// Unused budget is allowed to accumulate
+// for this many ticks worth of bandwidth
+constexpr static float BURST_TICKS = 2.0f;
+
+struct Candidate final {
+    SnapshotEntry entry {};
+    const SnapshotEntry *held {};
+    float priority {};
+    std::size_t size {};
+};
+
+unsigned int server_snapshots::bandwidth = 32U;
+
+static PacketBuffer payload = {};
+static std::vector<Candidate> candidates = {};
+static std::vector<entt::entity> leaving = {};
+
+static float calc_weight(float distance)
+{
+    if(distance <= NEAR_DISTANCE)
+        return 1.0f;
+    return cxpr::max(NEAR_DISTANCE / distance, 1.0f / MAX_INTERVAL);
+}
+
+static bool is_within(const ChunkCoord &observer, const ChunkCoord &cpos, std::int32_t distance)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        if(std::abs(cpos[i] - observer[i]) > distance) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void on_snapshot_ack_packet(const protocol::SnapshotAck &packet)
+{
+    if(Session *session = sessions::find(packet.peer)) {
+        // Acknowledgements can arrive out of order and
+        // can't acknowledge something that was never sent
+        if((packet.sequence > session->snapshots.acknowledged) && (packet.sequence <= session->snapshots.sequence)) {
+            session->snapshots.acknowledged = packet.sequence;
+        }
+    }
+}
+
+static void update_session(Session *session)
+{
+    const auto observer = globals::registry.try_get<TransformComponent>(session->player_entity);
+
+    if(!observer)
+        return;
+
+    const std::uint32_t sequence = session->snapshots.sequence + 1U;
+    const std::uint32_t baseline = session->snapshots.acknowledged;
+    const Snapshot *baseline_snapshot = snapshot::find(session->snapshots, baseline);
+    const Snapshot *latest_snapshot = snapshot::find(session->snapshots, session->snapshots.sequence);
+
+    Snapshot current = {};
+
+    candidates.clear();
+    leaving.clear();
+
+    const auto view_distance = static_cast<std::int32_t>(server_game::view_distance);
+
+    for(const auto [entity, transform] : globals::registry.view<TransformComponent>().each()) {
+        if(entity == session->player_entity) {
+            // Players predict their own movement and
+            // are corrected through PlayerStateAck instead
+            continue;
+        }
+
+        const bool is_known = session->entities.count(entity);
+
+        if(!is_within(observer->position.chunk, transform.position.chunk, view_distance + (is_known ? VIEW_MARGIN : 0))) {
+            if(is_known)
+                leaving.push_back(entity);
+            continue;
+        }
+
+        if(!is_known) {
+            // The entity has just wandered into the view box; it
+            // is introduced reliably and its state is then tracked
+            sessions::send_entity(session, entity);
+        }
+
+        Candidate candidate = {};
+        candidate.entry.entity = entity;
+        snapshot::capture(entity, candidate.entry.state);
+
+        // The client is assumed to have seen whatever has been
+        // sent the last; an entity whose update is held back keeps
+        // that state so it never jumps back to the baseline one
+        const SnapshotEntry *base = snapshot::find(baseline_snapshot, entity);
+        const SnapshotEntry *latest = snapshot::find(latest_snapshot, entity);
+        candidate.held = latest ? latest : base;
+
+        const SnapshotState *base_state = base ? &base->state : nullptr;
+        candidate.size = snapshot::estimate(candidate.entry.state, base_state);
+
+        float &priority = session->priorities[entity];
+
+        if(candidate.size == 0) {
+            priority = 0.0f;
+            current.push_back(candidate.entry);
+            continue;
+        }
+
+        if(candidate.held == nullptr) {
+            priority = NEW_PRIORITY;
+        }
+        else {
+            priority += calc_weight(Vec3f::length(WorldCoord::to_vec3f(observer->position, transform.position)));
+
+            if(snapshot::distance(candidate.entry.state, candidate.held->state) > ERROR_THRESHOLD) {
+                priority = cxpr::max(priority, 1.0f);
+            }
+        }
+
+        candidate.priority = priority;
+        candidates.push_back(candidate);
+    }
+
+    for(const entt::entity entity : leaving) {
+        sessions::remove_entity(session, entity);
+    }
+
+    const bool is_limited = server_snapshots::bandwidth != 0U;
+
+    if(is_limited) {
+        const float per_tick = static_cast<float>(server_snapshots::bandwidth) * 1024.0f / static_cast<float>(globals::tickrate);
+        session->snapshot_budget = cxpr::min(session->snapshot_budget + per_tick, BURST_TICKS * per_tick);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.priority > b.priority;
+    });
+
+    // The last entry sent is allowed to overdraw the budget;
+    // otherwise an entry larger than the budget ever gets
+    // would starve and the overdraft is paid back later on
+    for(const Candidate &candidate : candidates) {
+        if((candidate.priority >= 1.0f) && (!is_limited || (session->snapshot_budget > 0.0f))) {
+            session->priorities[candidate.entry.entity] = 0.0f;
+            session->snapshot_budget -= static_cast<float>(candidate.size);
+            current.push_back(candidate.entry);
+            continue;
+        }
+
+        if(candidate.held) {
+            // Repeating the held state costs whatever
+            // it differs by from the acknowledged baseline
+            const SnapshotEntry *base = snapshot::find(baseline_snapshot, candidate.entry.entity);
+            session->snapshot_budget -= static_cast<float>(snapshot::estimate(candidate.held->state, base ? &base->state : nullptr));
+
+            SnapshotEntry entry = {};
+            entry.entity = candidate.entry.entity;
+            entry.state = candidate.held->state;
+            current.push_back(entry);
+            continue;
+        }
+
+        // New entities that don't fit are left out
+        // entirely and introduced on some later tick
+    }
+
+    if(!is_limited)
+        session->snapshot_budget = 0.0f;
+
+    std::sort(current.begin(), current.end(), [](const SnapshotEntry &a, const SnapshotEntry &b) {
+        return a.entity < b.entity;
+    });
+
+    for(auto it = session->priorities.begin(); it != session->priorities.end();) {
+        if(snapshot::find(&current, it->first))
+            ++it;
+        else it = session->priorities.erase(it);
+    }
+
+    PacketBuffer::setup(payload);
+
+    if(!snapshot::encode(current, baseline_snapshot, payload)) {
+        // Nothing has changed since the baseline
+        return;
+    }
+
+    protocol::EntitySnapshot packet = {};
+    packet.sequence = sequence;
+    packet.tick = globals::fixed_framecount;
+    packet.baseline = baseline_snapshot ? baseline : UINT32_C(0);
+    packet.payload = payload.vector;
+    protocol::send(session->peer, nullptr, packet);
+
+    snapshot::store(session->snapshots, sequence) = std::move(current);
+    session->snapshots.sequence = sequence;
+}
+
+void server_snapshots::init(void)
+{
+    Config::add(globals::server_config, "snapshots.bandwidth", server_snapshots::bandwidth);
+
+    globals::dispatcher.sink<protocol::SnapshotAck>().connect<&on_snapshot_ack_packet>();
+}
+
+void server_snapshots::update_late(void)
+{
+    for(unsigned int i = 0U; i < sessions::max_players; ++i) {
+        if(Session *session = sessions::find(static_cast<std::uint16_t>(i))) {
+            update_session(session);
+        }
+    }
+}
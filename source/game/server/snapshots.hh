@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+// Moving entities are replicated to clients through
+// unreliable snapshots that are delta-compressed against
+// whatever snapshot the client has acknowledged the last;
+// distant entities are updated less often and every session
+// is given a bandwidth budget that the most urgent ones get first
+namespace server_snapshots
+{
+extern unsigned int bandwidth;
+} // namespace server_snapshots
+
+namespace server_snapshots
+{
+void init(void);
+void update_late(void);
+} // namespace server_snapshots
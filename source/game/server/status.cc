@@ -2,24 +2,164 @@
 #include "server/precompiled.hh"
 #include "server/status.hh"
 
+#include "mathlib/constexpr.hh"
+
+#include "common/config.hh"
+
 #include "shared/motd.hh"
 #include "shared/protocol.hh"
 
+#include "server/chunk_cache.hh"
 #include "server/globals.hh"
+#include "server/net_thread.hh"
 #include "server/sessions.hh"
 
 
+// Only the packet types that take up the most
+// bytes are listed; the rest are rarely worth a look
+constexpr static std::size_t NUM_TOP_PACKETS = 3;
+
+unsigned int status::traffic_interval = 60U;
+
+static std::uint64_t interval_ticks = 0;
+static std::uint64_t next_report = 0;
+static ChunkTraffic last_chunks = {};
+static std::uint64_t last_hits = 0;
+static std::uint64_t last_misses = 0;
+static std::vector<PeerTraffic> last_traffic = {};
+
 static void on_status_request_packet(const protocol::StatusRequest &packet)
 {
     protocol::StatusResponse response = {};
     response.version = protocol::VERSION;
     response.max_players = sessions::max_players;
     response.num_players = sessions::num_players;
+    response.busy_time_us = static_cast<std::uint32_t>(1000000.0f * globals::fixed_busytime_avg);
     response.motd = motd::get();
     protocol::send(packet.peer, nullptr, response);
 }
 
+static std::string describe(const PacketTraffic &traffic, const PacketTraffic &last, float seconds)
+{
+    const std::uint64_t total = protocol::sum_bytes(traffic, last);
+
+    std::array<std::size_t, protocol::NUM_PACKET_IDS + 1> order = {};
+    std::iota(order.begin(), order.end(), std::size_t(0));
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return (traffic.bytes[a] - last.bytes[a]) > (traffic.bytes[b] - last.bytes[b]);
+    });
+
+    std::string result = fmt::format("{:.1f} KiB/s", static_cast<float>(total) / 1024.0f / seconds);
+
+    for(std::size_t i = 0; i < NUM_TOP_PACKETS; ++i) {
+        const std::uint64_t bytes = traffic.bytes[order[i]] - last.bytes[order[i]];
+
+        if(bytes == 0)
+            break;
+
+        const auto percent = 100.0f * static_cast<float>(bytes) / static_cast<float>(total);
+        const auto name = protocol::get_packet_name(static_cast<std::uint16_t>(order[i]));
+        result += fmt::format("{}{} {:.0f}%", (i ? ", " : " ["), name, percent);
+    }
+
+    if(total) {
+        result += "]";
+    }
+
+    return result;
+}
+
+static void report_session(const Session *session, float seconds)
+{
+    const ENetPeer *peer = session->peer;
+    const PeerTraffic *traffic = protocol::find_traffic(peer);
+
+    if(traffic == nullptr)
+        return;
+
+    const std::size_t index = static_cast<std::size_t>(peer - globals::server_host->peers);
+    PeerTraffic &last = last_traffic[index];
+
+    if(last.connect_id != traffic->connect_id) {
+        // Counters have started over since the last
+        // report; the whole connection is reported instead
+        last = PeerTraffic();
+        last.connect_id = traffic->connect_id;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(net_thread::host_mutex);
+
+    const auto loss = 100.0f * static_cast<float>(peer->packetLoss) / static_cast<float>(ENET_PEER_PACKET_LOSS_SCALE);
+
+    spdlog::info("status: {}: rtt {}±{} ms, loss {:.1f}%, {} bytes in transit; out {}; in {}", session->client_username,
+        peer->roundTripTime, peer->roundTripTimeVariance, loss, peer->reliableDataInTransit,
+        describe(traffic->sent, last.sent, seconds), describe(traffic->received, last.received, seconds));
+
+    last = *traffic;
+}
+
+static void report_chunks(void)
+{
+    const ChunkTraffic &chunks = protocol::chunk_traffic;
+    const std::uint64_t count = chunks.chunks - last_chunks.chunks;
+
+    if(count) {
+        const std::uint64_t raw_bytes = chunks.raw_bytes - last_chunks.raw_bytes;
+        const std::uint64_t encoded_bytes = chunks.encoded_bytes - last_chunks.encoded_bytes;
+        const auto ratio = static_cast<float>(raw_bytes) / static_cast<float>(cxpr::max<std::uint64_t>(encoded_bytes, 1U));
+
+        spdlog::info("status: chunks: {} encoded, {:.1f} KiB into {:.1f} KiB ({:.1f}:1)", count,
+            static_cast<float>(raw_bytes) / 1024.0f, static_cast<float>(encoded_bytes) / 1024.0f, ratio);
+    }
+
+    last_chunks = chunks;
+
+    const std::uint64_t hits = chunk_cache::num_hits - last_hits;
+    const std::uint64_t misses = chunk_cache::num_misses - last_misses;
+
+    if(hits || misses) {
+        const auto hit_rate = 100.0f * static_cast<float>(hits) / static_cast<float>(hits + misses);
+        spdlog::info("status: chunk_cache: {} hits, {} misses ({:.02f}% hit rate)", hits, misses, hit_rate);
+    }
+
+    last_hits = chunk_cache::num_hits;
+    last_misses = chunk_cache::num_misses;
+}
+
 void status::init(void)
 {
+    Config::add(globals::server_config, "status.traffic_interval", status::traffic_interval);
+
     globals::dispatcher.sink<protocol::StatusRequest>().connect<&on_status_request_packet>();
 }
+
+void status::init_late(void)
+{
+    // Ticks are counted instead of measuring time so that
+    // replays report the very same intervals as the original
+    interval_ticks = (UINT64_C(1000000) * status::traffic_interval) / globals::tickrate_dt;
+    next_report = globals::fixed_framecount + interval_ticks;
+
+    last_chunks = protocol::chunk_traffic;
+    last_hits = chunk_cache::num_hits;
+    last_misses = chunk_cache::num_misses;
+    last_traffic.clear();
+    last_traffic.resize(globals::server_host->peerCount);
+}
+
+void status::update_late(void)
+{
+    if((interval_ticks == 0) || (globals::fixed_framecount < next_report))
+        return;
+
+    const auto seconds = static_cast<float>(interval_ticks * globals::tickrate_dt) / 1000000.0f;
+    next_report = globals::fixed_framecount + interval_ticks;
+
+    for(unsigned int i = 0U; i < sessions::max_players; ++i) {
+        if(const Session *session = sessions::find(static_cast<std::uint16_t>(i))) {
+            report_session(session, seconds);
+        }
+    }
+
+    report_chunks();
+}
@@ -1,7 +1,16 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
 
+namespace status
+{
+// Network telemetry is logged every that many
+// seconds for every session; zero turns it off
+extern unsigned int traffic_interval;
+} // namespace status
+
 namespace status
 {
 void init(void);
+void init_late(void);
+void update_late(void);
 } // namespace status
@@ -2,6 +2,7 @@
 #include "shared/precompiled.hh"
 #include "shared/entity/collision.hh"
 
+#include "shared/entity/commanded.hh"
 #include "shared/entity/gravity.hh"
 #include "shared/entity/grounded.hh"
 #include "shared/entity/transform.hh"
@@ -124,6 +125,16 @@ static int vgrid_collide(int d, CollisionComponent &collision, TransformComponen
     return 0;
 }
 
+static void collide(entt::entity entity, CollisionComponent &collision, TransformComponent &transform, VelocityComponent &velocity)
+{
+    if(vgrid_collide(1, collision, transform, velocity) == (-cxpr::sign<int>(GravityComponent::acceleration)))
+        globals::registry.emplace_or_replace<GroundedComponent>(entity);
+    else globals::registry.remove<GroundedComponent>(entity);
+
+    vgrid_collide(0, collision, transform, velocity);
+    vgrid_collide(2, collision, transform, velocity);
+}
+
 void CollisionComponent::fixed_update(void)
 {
     // FIXME: this isn't particularly accurate considering
@@ -135,14 +146,17 @@ void CollisionComponent::fixed_update(void)
     // we shouldn't treat all voxels as full cubes if we want
     // to support slabs, stairs and non-full liquid voxels in the future
 
-    auto group = globals::registry.group<CollisionComponent>(entt::get<TransformComponent, VelocityComponent>);
+    auto group = globals::registry.group<CollisionComponent>(entt::get<TransformComponent, VelocityComponent>, entt::exclude<CommandedComponent>);
 
     for(auto [entity, collision, transform, velocity] : group.each()) {
-        if(vgrid_collide(1, collision, transform, velocity) == (-cxpr::sign<int>(GravityComponent::acceleration)))
-            globals::registry.emplace_or_replace<GroundedComponent>(entity);
-        else globals::registry.remove<GroundedComponent>(entity);
-
-        vgrid_collide(0, collision, transform, velocity);
-        vgrid_collide(2, collision, transform, velocity);
+        collide(entity, collision, transform, velocity);
     }
 }
+
+void CollisionComponent::fixed_update(entt::entity entity)
+{
+    auto &collision = globals::registry.get<CollisionComponent>(entity);
+    auto &transform = globals::registry.get<TransformComponent>(entity);
+    auto &velocity = globals::registry.get<VelocityComponent>(entity);
+    collide(entity, collision, transform, velocity);
+}
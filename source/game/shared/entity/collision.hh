@@ -11,4 +11,8 @@ public:
     // before TransformComponent::fixed_update and VelocityComponent::fixed_update
     // because both transform and velocity may be updated internally
     static void fixed_update(void);
+
+    // Updates just the given entity; used for entities
+    // moved by player commands instead of the world simulation
+    static void fixed_update(entt::entity entity);
 };
@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+// Flag component;
+// Assigned to player entities that are moved by
+// player commands through pmove::simulate; the world
+// simulation doesn't touch them in any way
+struct CommandedComponent final {};
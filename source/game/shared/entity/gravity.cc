@@ -2,6 +2,7 @@
 #include "shared/precompiled.hh"
 #include "shared/entity/gravity.hh"
 
+#include "shared/entity/commanded.hh"
 #include "shared/entity/stasis.hh"
 #include "shared/entity/velocity.hh"
 
@@ -12,7 +13,7 @@ float GravityComponent::acceleration = 30.0f;
 
 void GravityComponent::fixed_update(void)
 {
-    auto group = globals::registry.group<GravityComponent>(entt::get<VelocityComponent>, entt::exclude<StasisComponent>);
+    auto group = globals::registry.group<GravityComponent>(entt::get<VelocityComponent>, entt::exclude<StasisComponent, CommandedComponent>);
 
     for(auto [entity, velocity] : group.each()) {
         velocity.linear[1] -= GravityComponent::acceleration * globals::fixed_frametime;
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "shared/precompiled.hh"
+#include "shared/entity/pmove.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "shared/entity/collision.hh"
+#include "shared/entity/gravity.hh"
+#include "shared/entity/grounded.hh"
+#include "shared/entity/stasis.hh"
+#include "shared/entity/transform.hh"
+#include "shared/entity/velocity.hh"
+
+#include "shared/world/world.hh"
+
+#include "shared/globals.hh"
+
+
+constexpr static float ANGLE_SCALE = 65536.0f / cxpr::radians(360.0f);
+constexpr static float DIRECTION_SCALE = 127.0f;
+
+static Vec3f accelerate(const Vec3f &wish_dir, const Vec3f &velocity, float wish_speed, float accel)
+{
+    const auto current_speed = Vec3f::dot(velocity, wish_dir);
+    const auto add_speed = wish_speed - current_speed;
+
+    if(add_speed <= 0.0f) {
+        // Not accelerating
+        return velocity;
+    }
+
+    const auto accel_speed = cxpr::min(add_speed, accel * globals::fixed_frametime * wish_speed);
+
+    auto result = Vec3f(velocity);
+    result[0] += accel_speed * wish_dir[0];
+    result[2] += accel_speed * wish_dir[2];
+    return result;
+}
+
+static Vec3f air_move(const Vec3f &wish_dir, const Vec3f &velocity)
+{
+    return accelerate(wish_dir, velocity, PMOVE_ACCELERATION_AIR, PMOVE_MAX_SPEED_AIR);
+}
+
+static Vec3f ground_move(const Vec3f &wish_dir, const Vec3f &velocity)
+{
+    if(const auto speed = Vec3f::length(velocity)) {
+        const auto speed_drop = speed * PMOVE_FRICTION_GROUND * globals::fixed_frametime;
+        const auto speed_factor = cxpr::max(speed - speed_drop, 0.0f) / speed;
+        return accelerate(wish_dir, velocity * speed_factor, PMOVE_ACCELERATION_GROUND, PMOVE_MAX_SPEED_GROUND);
+    }
+
+    return accelerate(wish_dir, velocity, PMOVE_ACCELERATION_GROUND, PMOVE_MAX_SPEED_GROUND);
+}
+
+bool pmove::simulate(entt::entity entity, const PlayerCommand &command)
+{
+    auto &transform = globals::registry.get<TransformComponent>(entity);
+    auto &velocity = globals::registry.get<VelocityComponent>(entity);
+
+    Vec3f forward, right;
+    Vec3angles::vectors(Vec3angles(0.0f, command.head[1], 0.0f), &forward, &right, nullptr);
+
+    Vec3f wish_dir = Vec3f::zero();
+    Vec3f move_vars_xz = Vec3f(command.wish_dir.get_x(), 0.0f, command.wish_dir.get_z());
+    wish_dir.set_x(Vec3f::dot(move_vars_xz, right));
+    wish_dir.set_z(Vec3f::dot(move_vars_xz, forward));
+
+    const auto is_grounded = globals::registry.any_of<GroundedComponent>(entity);
+    const auto velocity_xz = Vec3f(velocity.linear.get_x(), 0.0f, velocity.linear.get_z());
+
+    if(is_grounded) {
+        const auto xz = ground_move(wish_dir, velocity_xz);
+        velocity.linear.set_x(xz.get_x());
+        velocity.linear.set_z(xz.get_z());
+    }
+    else {
+        const auto xz = air_move(wish_dir, velocity_xz);
+        velocity.linear.set_x(xz.get_x());
+        velocity.linear.set_z(xz.get_z());
+    }
+
+    const bool has_jumped = is_grounded && command.jump;
+
+    if(has_jumped) {
+        velocity.linear.set_y(GravityComponent::acceleration * 0.275f);
+    }
+
+    // The rest goes in the very same order
+    // the world simulation systems are run in
+    CollisionComponent::fixed_update(entity);
+
+    const auto is_stasis = globals::registry.any_of<StasisComponent>(entity);
+
+    if(!is_stasis) {
+        transform.position.local += velocity.linear * globals::fixed_frametime;
+        transform.angles += velocity.angular * globals::fixed_frametime;
+    }
+
+    TransformComponent::fixed_update(entity);
+
+    if(!is_stasis && globals::registry.any_of<GravityComponent>(entity)) {
+        velocity.linear[1] -= GravityComponent::acceleration * globals::fixed_frametime;
+    }
+
+    if(nullptr == world::find(transform.position.chunk))
+        globals::registry.emplace_or_replace<StasisComponent>(entity);
+    else globals::registry.remove<StasisComponent>(entity);
+
+    return has_jumped;
+}
+
+void pmove::quantise(PlayerCommand &command)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        const auto angle = static_cast<std::int16_t>(std::lround(command.head[i] * ANGLE_SCALE) & 0xFFFFL);
+        const auto direction = cxpr::clamp(std::lround(command.wish_dir[i] * DIRECTION_SCALE), -127L, 127L);
+        command.head[i] = static_cast<float>(angle) / ANGLE_SCALE;
+        command.wish_dir[i] = static_cast<float>(direction) / DIRECTION_SCALE;
+    }
+
+    command.wish_dir[1] = 0.0f;
+}
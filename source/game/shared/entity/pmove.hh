@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "mathlib/vec3angles.hh"
+
+constexpr static float PMOVE_MAX_SPEED_AIR = 16.0f;
+constexpr static float PMOVE_MAX_SPEED_GROUND = 8.0f;
+constexpr static float PMOVE_ACCELERATION_AIR = 3.0f;
+constexpr static float PMOVE_ACCELERATION_GROUND = 6.0f;
+constexpr static float PMOVE_FRICTION_GROUND = 10.0f;
+
+// A single fixed tick worth of player input; the wished
+// direction is relative to where the head is looking at and
+// its vertical component is ignored. The jump cooldown is
+// up to whoever issues commands, pmove just jumps if it can
+struct PlayerCommand final {
+    std::uint32_t sequence {};
+    Vec3f wish_dir {};
+    Vec3angles head {};
+    bool jump {};
+};
+
+namespace pmove
+{
+// Moves an entity with CommandedComponent by a single fixed
+// tick the very same way the world simulation would have moved
+// it; the client predicts its own movement and the server checks
+// it by running the same commands. Returns true if the entity jumped
+bool simulate(entt::entity entity, const PlayerCommand &command);
+
+// Rounds the command to the precision it's sent to the
+// server with; prediction has to run exactly what the server
+// runs or otherwise the two would slowly drift apart
+void quantise(PlayerCommand &command);
+} // namespace pmove
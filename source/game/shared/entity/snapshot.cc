@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "shared/precompiled.hh"
+#include "shared/entity/snapshot.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/packet_buffer.hh"
+
+#include "shared/entity/head.hh"
+#include "shared/entity/transform.hh"
+#include "shared/entity/velocity.hh"
+
+#include "shared/globals.hh"
+
+
+constexpr static std::uint8_t FIELD_CHUNK = 0x01;
+constexpr static std::uint8_t FIELD_LOCAL = 0x02;
+constexpr static std::uint8_t FIELD_ANGLES = 0x04;
+constexpr static std::uint8_t FIELD_HEAD = 0x08;
+constexpr static std::uint8_t FIELD_LINEAR = 0x10;
+constexpr static std::uint8_t FIELD_ANGULAR = 0x20;
+constexpr static std::uint8_t FIELD_ALL = 0x3F;
+
+constexpr static float LOCAL_SCALE = 65536.0f / static_cast<float>(CHUNK_SIZE);
+constexpr static float ANGLE_SCALE = 65536.0f / cxpr::radians(360.0f);
+constexpr static float VELOCITY_SCALE = 256.0f;
+
+static std::uint16_t quantise_local(float value)
+{
+    return static_cast<std::uint16_t>(cxpr::clamp(std::lround(value * LOCAL_SCALE), 0L, 65535L));
+}
+
+static std::uint16_t quantise_angle(float value)
+{
+    // Angles wrap around naturally; a full turn
+    // is exactly 65536 steps so we just truncate
+    return static_cast<std::uint16_t>(std::lround(value * ANGLE_SCALE) & 0xFFFFL);
+}
+
+static std::int16_t quantise_velocity(float value)
+{
+    return static_cast<std::int16_t>(cxpr::clamp(std::lround(value * VELOCITY_SCALE), -32768L, 32767L));
+}
+
+static float restore_angle(std::uint16_t value)
+{
+    return static_cast<float>(static_cast<std::int16_t>(value)) / ANGLE_SCALE;
+}
+
+static std::size_t varint_size(std::uint32_t value)
+{
+    std::size_t size = 1;
+
+    while(value >= 0x80U) {
+        value >>= 7;
+        size += 1;
+    }
+
+    return size;
+}
+
+static std::size_t zigzag_size(std::int32_t value)
+{
+    return varint_size((static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31));
+}
+
+static std::uint8_t compare(const SnapshotState &a, const SnapshotState &b)
+{
+    std::uint8_t fields = 0x00;
+    if(a.chunk != b.chunk) fields |= FIELD_CHUNK;
+    if(a.local != b.local) fields |= FIELD_LOCAL;
+    if(a.angles != b.angles) fields |= FIELD_ANGLES;
+    if(a.head != b.head) fields |= FIELD_HEAD;
+    if(a.linear != b.linear) fields |= FIELD_LINEAR;
+    if(a.angular != b.angular) fields |= FIELD_ANGULAR;
+    return fields;
+}
+
+void snapshot::capture(entt::entity entity, SnapshotState &state)
+{
+    state = SnapshotState();
+
+    if(const TransformComponent *transform = globals::registry.try_get<TransformComponent>(entity)) {
+        state.chunk = transform->position.chunk;
+
+        for(std::size_t i = 0; i < 3; ++i) {
+            state.local[i] = quantise_local(transform->position.local[i]);
+            state.angles[i] = quantise_angle(transform->angles[i]);
+        }
+    }
+
+    if(const HeadComponent *head = globals::registry.try_get<HeadComponent>(entity)) {
+        for(std::size_t i = 0; i < 3; ++i) {
+            state.head[i] = quantise_angle(head->angles[i]);
+        }
+    }
+
+    if(const VelocityComponent *velocity = globals::registry.try_get<VelocityComponent>(entity)) {
+        for(std::size_t i = 0; i < 3; ++i) {
+            state.linear[i] = quantise_velocity(velocity->linear[i]);
+            state.angular[i] = quantise_velocity(velocity->angular[i]);
+        }
+    }
+}
+
+void snapshot::apply(entt::entity entity, const SnapshotState &state)
+{
+    auto &transform = globals::registry.get_or_emplace<TransformComponent>(entity);
+    auto &head = globals::registry.get_or_emplace<HeadComponent>(entity);
+    auto &velocity = globals::registry.get_or_emplace<VelocityComponent>(entity);
+
+    transform.position.chunk = state.chunk;
+
+    for(std::size_t i = 0; i < 3; ++i) {
+        transform.position.local[i] = static_cast<float>(state.local[i]) / LOCAL_SCALE;
+        transform.angles[i] = restore_angle(state.angles[i]);
+        head.angles[i] = restore_angle(state.head[i]);
+        velocity.linear[i] = static_cast<float>(state.linear[i]) / VELOCITY_SCALE;
+        velocity.angular[i] = static_cast<float>(state.angular[i]) / VELOCITY_SCALE;
+    }
+}
+
+void snapshot::reset(SnapshotHistory &history)
+{
+    for(std::size_t i = 0; i < snapshot::HISTORY_SIZE; ++i) {
+        history.snapshots[i].clear();
+        history.sequences[i] = UINT32_C(0);
+    }
+
+    history.sequence = UINT32_C(0);
+    history.acknowledged = UINT32_C(0);
+}
+
+const Snapshot *snapshot::find(const SnapshotHistory &history, std::uint32_t sequence)
+{
+    const std::size_t index = sequence % snapshot::HISTORY_SIZE;
+    if(sequence && (history.sequences[index] == sequence))
+        return &history.snapshots[index];
+    return nullptr;
+}
+
+const SnapshotEntry *snapshot::find(const Snapshot *snapshot, entt::entity entity)
+{
+    if(snapshot) {
+        const auto it = std::lower_bound(snapshot->cbegin(), snapshot->cend(), entity, [](const SnapshotEntry &entry, entt::entity value) {
+            return entry.entity < value;
+        });
+
+        if((it != snapshot->cend()) && (it->entity == entity)) {
+            return &(*it);
+        }
+    }
+
+    return nullptr;
+}
+
+Snapshot &snapshot::store(SnapshotHistory &history, std::uint32_t sequence)
+{
+    const std::size_t index = sequence % snapshot::HISTORY_SIZE;
+    history.sequences[index] = sequence;
+    history.snapshots[index].clear();
+    return history.snapshots[index];
+}
+
+std::size_t snapshot::estimate(const SnapshotState &state, const SnapshotState *baseline)
+{
+    const std::uint8_t fields = baseline ? compare(state, *baseline) : FIELD_ALL;
+
+    if(fields == 0x00)
+        return 0;
+
+    // Entity identifiers are small most of the time
+    // and the mask is always exactly a single byte
+    std::size_t size = 3 + 1;
+
+    if(fields & FIELD_CHUNK)
+        size += zigzag_size(state.chunk[0]) + zigzag_size(state.chunk[1]) + zigzag_size(state.chunk[2]);
+    if(fields & FIELD_LOCAL)
+        size += 3 * sizeof(std::uint16_t);
+    if(fields & FIELD_ANGLES)
+        size += 3 * sizeof(std::uint16_t);
+    if(fields & FIELD_HEAD)
+        size += 3 * sizeof(std::uint16_t);
+    if(fields & FIELD_LINEAR)
+        size += 3 * sizeof(std::uint16_t);
+    if(fields & FIELD_ANGULAR)
+        size += 3 * sizeof(std::uint16_t);
+    return size;
+}
+
+float snapshot::distance(const SnapshotState &a, const SnapshotState &b)
+{
+    Vec3f delta = {};
+
+    for(std::size_t i = 0; i < 3; ++i) {
+        const float chunk = static_cast<float>(a.chunk[i] - b.chunk[i]) * static_cast<float>(CHUNK_SIZE);
+        const float local = (static_cast<float>(a.local[i]) - static_cast<float>(b.local[i])) / LOCAL_SCALE;
+        delta[i] = chunk + local;
+    }
+
+    return Vec3f::length(delta);
+}
+
+bool snapshot::encode(const Snapshot &current, const Snapshot *baseline, PacketBuffer &buffer)
+{
+    std::vector<entt::entity> removed = {};
+    std::vector<std::pair<const SnapshotEntry *, std::uint8_t>> changed = {};
+
+    if(baseline) {
+        for(const SnapshotEntry &entry : *baseline) {
+            if(!snapshot::find(&current, entry.entity)) {
+                removed.push_back(entry.entity);
+            }
+        }
+    }
+
+    for(const SnapshotEntry &entry : current) {
+        if(const SnapshotEntry *base = snapshot::find(baseline, entry.entity)) {
+            if(std::uint8_t fields = compare(entry.state, base->state))
+                changed.emplace_back(&entry, fields);
+            continue;
+        }
+
+        changed.emplace_back(&entry, FIELD_ALL);
+    }
+
+    if(removed.empty() && changed.empty())
+        return false;
+
+    PacketBuffer::write_VUI32(buffer, static_cast<std::uint32_t>(removed.size()));
+
+    for(const entt::entity entity : removed)
+        PacketBuffer::write_VUI32(buffer, static_cast<std::uint32_t>(entity));
+
+    PacketBuffer::write_VUI32(buffer, static_cast<std::uint32_t>(changed.size()));
+
+    for(const auto &it : changed) {
+        const SnapshotState &state = it.first->state;
+
+        PacketBuffer::write_VUI32(buffer, static_cast<std::uint32_t>(it.first->entity));
+        PacketBuffer::write_UI8(buffer, it.second);
+
+        if(it.second & FIELD_CHUNK) {
+            PacketBuffer::write_VI32(buffer, state.chunk[0]);
+            PacketBuffer::write_VI32(buffer, state.chunk[1]);
+            PacketBuffer::write_VI32(buffer, state.chunk[2]);
+        }
+
+        for(std::size_t i = 0; (it.second & FIELD_LOCAL) && (i < 3); ++i)
+            PacketBuffer::write_UI16(buffer, state.local[i]);
+        for(std::size_t i = 0; (it.second & FIELD_ANGLES) && (i < 3); ++i)
+            PacketBuffer::write_UI16(buffer, state.angles[i]);
+        for(std::size_t i = 0; (it.second & FIELD_HEAD) && (i < 3); ++i)
+            PacketBuffer::write_UI16(buffer, state.head[i]);
+        for(std::size_t i = 0; (it.second & FIELD_LINEAR) && (i < 3); ++i)
+            PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(state.linear[i]));
+        for(std::size_t i = 0; (it.second & FIELD_ANGULAR) && (i < 3); ++i)
+            PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(state.angular[i]));
+    }
+
+    return true;
+}
+
+bool snapshot::decode(PacketBuffer &buffer, const Snapshot *baseline, Snapshot &current, std::vector<entt::entity> &changed)
+{
+    std::vector<entt::entity> removed = {};
+
+    current.clear();
+    changed.clear();
+
+    removed.resize(cxpr::min<std::size_t>(PacketBuffer::read_VUI32(buffer), buffer.vector.size()));
+
+    for(std::size_t i = 0; i < removed.size(); ++i)
+        removed[i] = static_cast<entt::entity>(PacketBuffer::read_VUI32(buffer));
+
+    std::sort(removed.begin(), removed.end());
+
+    if(baseline) {
+        for(const SnapshotEntry &entry : *baseline) {
+            if(!std::binary_search(removed.cbegin(), removed.cend(), entry.entity)) {
+                current.push_back(entry);
+            }
+        }
+    }
+
+    const std::size_t count = cxpr::min<std::size_t>(PacketBuffer::read_VUI32(buffer), buffer.vector.size());
+
+    for(std::size_t i = 0; i < count; ++i) {
+        SnapshotEntry entry = {};
+        entry.entity = static_cast<entt::entity>(PacketBuffer::read_VUI32(buffer));
+
+        const std::uint8_t fields = PacketBuffer::read_UI8(buffer);
+
+        if(const SnapshotEntry *base = snapshot::find(baseline, entry.entity))
+            entry.state = base->state;
+        else if(fields != FIELD_ALL)
+            return false;
+
+        if(fields & FIELD_CHUNK) {
+            entry.state.chunk[0] = PacketBuffer::read_VI32(buffer);
+            entry.state.chunk[1] = PacketBuffer::read_VI32(buffer);
+            entry.state.chunk[2] = PacketBuffer::read_VI32(buffer);
+        }
+
+        for(std::size_t j = 0; (fields & FIELD_LOCAL) && (j < 3); ++j)
+            entry.state.local[j] = PacketBuffer::read_UI16(buffer);
+        for(std::size_t j = 0; (fields & FIELD_ANGLES) && (j < 3); ++j)
+            entry.state.angles[j] = PacketBuffer::read_UI16(buffer);
+        for(std::size_t j = 0; (fields & FIELD_HEAD) && (j < 3); ++j)
+            entry.state.head[j] = PacketBuffer::read_UI16(buffer);
+        for(std::size_t j = 0; (fields & FIELD_LINEAR) && (j < 3); ++j)
+            entry.state.linear[j] = static_cast<std::int16_t>(PacketBuffer::read_UI16(buffer));
+        for(std::size_t j = 0; (fields & FIELD_ANGULAR) && (j < 3); ++j)
+            entry.state.angular[j] = static_cast<std::int16_t>(PacketBuffer::read_UI16(buffer));
+
+        auto it = std::lower_bound(current.begin(), current.end(), entry.entity, [](const SnapshotEntry &a, entt::entity value) {
+            return a.entity < value;
+        });
+
+        if((it != current.end()) && (it->entity == entry.entity))
+            it->state = entry.state;
+        else current.insert(it, entry);
+
+        changed.push_back(entry.entity);
+    }
+
+    return buffer.read_position <= buffer.vector.size();
+}
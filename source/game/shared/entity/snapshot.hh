@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk_coord.hh"
+
+struct PacketBuffer;
+
+// Quantised entity state; positions are stored relative to the
+// chunk with 1/4096 of a unit precision, angles with 1/65536 of a
+// full turn and velocities as 8.8 fixed point values. The state is
+// compared field by field so anything that changes by less than a
+// single quantisation step is not considered changed at all
+struct SnapshotState final {
+    ChunkCoord chunk {};
+    std::array<std::uint16_t, 3> local {};
+    std::array<std::uint16_t, 3> angles {};
+    std::array<std::uint16_t, 3> head {};
+    std::array<std::int16_t, 3> linear {};
+    std::array<std::int16_t, 3> angular {};
+};
+
+struct SnapshotEntry final {
+    entt::entity entity {};
+    SnapshotState state {};
+};
+
+// Entries are sorted by the entity
+// identifier to allow binary searches
+using Snapshot = std::vector<SnapshotEntry>;
+
+namespace snapshot
+{
+constexpr static std::size_t HISTORY_SIZE = 32;
+} // namespace snapshot
+
+// Sequence number zero is never used so that it
+// can mean "no snapshot" when used as a baseline
+struct SnapshotHistory final {
+    std::array<Snapshot, snapshot::HISTORY_SIZE> snapshots {};
+    std::array<std::uint32_t, snapshot::HISTORY_SIZE> sequences {};
+    std::uint32_t sequence {};
+    std::uint32_t acknowledged {};
+};
+
+namespace snapshot
+{
+void capture(entt::entity entity, SnapshotState &state);
+void apply(entt::entity entity, const SnapshotState &state);
+} // namespace snapshot
+
+namespace snapshot
+{
+void reset(SnapshotHistory &history);
+const Snapshot *find(const SnapshotHistory &history, std::uint32_t sequence);
+const SnapshotEntry *find(const Snapshot *snapshot, entt::entity entity);
+Snapshot &store(SnapshotHistory &history, std::uint32_t sequence);
+} // namespace snapshot
+
+namespace snapshot
+{
+// Size of the entry once encoded against the baseline
+// state; zero means it wouldn't be written at all
+std::size_t estimate(const SnapshotState &state, const SnapshotState *baseline);
+
+// How far apart the two states' positions are in world units
+float distance(const SnapshotState &a, const SnapshotState &b);
+} // namespace snapshot
+
+namespace snapshot
+{
+// Only writes entities that were removed since the baseline
+// and fields that changed; returns false if there's nothing
+bool encode(const Snapshot &current, const Snapshot *baseline, PacketBuffer &buffer);
+
+// Reconstructs the full snapshot; entities whose state
+// has been written to the buffer are listed as changed
+bool decode(PacketBuffer &buffer, const Snapshot *baseline, Snapshot &current, std::vector<entt::entity> &changed);
+} // namespace snapshot
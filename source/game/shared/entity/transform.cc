@@ -3,23 +3,33 @@
 #include "shared/entity/transform.hh"
 #include "shared/globals.hh"
 
+static void wrap_position(TransformComponent &transform)
+{
+    for(std::size_t i = 0U; i < 3U; ++i) {
+        if(transform.position.local[i] >= CHUNK_SIZE) {
+            transform.position.local[i] -= CHUNK_SIZE;
+            transform.position.chunk[i] += 1;
+            continue;
+        }
+
+        if(transform.position.local[i] < 0.0f) {
+            transform.position.local[i] += CHUNK_SIZE;
+            transform.position.chunk[i] -= 1;
+            continue;
+        }
+    }
+}
+
 void TransformComponent::fixed_update(void)
 {
     const auto view = globals::registry.view<TransformComponent>();
 
     for(auto [entity, transform] : view.each()) {
-        for(std::size_t i = 0U; i < 3U; ++i) {
-            if(transform.position.local[i] >= CHUNK_SIZE) {
-                transform.position.local[i] -= CHUNK_SIZE;
-                transform.position.chunk[i] += 1;
-                continue;
-            }
-
-            if(transform.position.local[i] < 0.0f) {
-                transform.position.local[i] += CHUNK_SIZE;
-                transform.position.chunk[i] -= 1;
-                continue;
-            }
-        }
+        wrap_position(transform);
     }
 }
+
+void TransformComponent::fixed_update(entt::entity entity)
+{
+    wrap_position(globals::registry.get<TransformComponent>(entity));
+}
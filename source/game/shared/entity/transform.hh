@@ -13,6 +13,10 @@ public:
     // the local part of WorldCoord field is always
     // within a single chunk - floating point precision fixes
     static void fixed_update(void);
+
+    // Updates just the given entity; used for entities
+    // moved by player commands instead of the world simulation
+    static void fixed_update(entt::entity entity);
 };
 
 // Clientside-only: interpolation
@@ -2,6 +2,7 @@
 #include "shared/precompiled.hh"
 #include "shared/entity/velocity.hh"
 
+#include "shared/entity/commanded.hh"
 #include "shared/entity/stasis.hh"
 #include "shared/entity/transform.hh"
 
@@ -10,7 +11,7 @@
 
 void VelocityComponent::fixed_update(void)
 {
-    const auto group = globals::registry.group<VelocityComponent>(entt::get<TransformComponent>, entt::exclude<StasisComponent>);
+    const auto group = globals::registry.group<VelocityComponent>(entt::get<TransformComponent>, entt::exclude<StasisComponent, CommandedComponent>);
 
     for(const auto [entity, velocity, transform] : group.each()) {
         transform.position.local += velocity.linear * globals::fixed_frametime;
@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk.hh"
+#include "shared/world/chunk_coord.hh"
+
+// Triggered right before a loaded chunk gets its voxels
+// modified, gets replaced with another chunk or is destroyed;
+// the chunk is still intact when the event is dispatched
+struct ChunkWriteEvent final {
+    ChunkCoord coord {};
+    Chunk *chunk {};
+};
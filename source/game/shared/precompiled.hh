@@ -11,6 +11,9 @@
 #include <chrono>
 #include <filesystem>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
@@ -21,6 +24,8 @@
 #include <utility>
 #include <vector>
 
+#include <BS_thread_pool.hpp>
+
 // FIXME: including hash_set8.hpp is fucked up whenever
 // hash_table8.hpp is included. It doesn't even compile
 // possibly due some function re-definitions. Too bad!
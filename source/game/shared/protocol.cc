@@ -4,6 +4,7 @@
 
 #include "common/packet_buffer.hh"
 
+#include "mathlib/constexpr.hh"
 #include "mathlib/floathacks.hh"
 
 #include "shared/entity/chunk.hh"
@@ -12,92 +13,419 @@
 #include "shared/entity/transform.hh"
 #include "shared/entity/velocity.hh"
 
+#include "shared/world/chunk_codec.hh"
+#include "shared/world/local_coord.hh"
+#include "shared/world/voxel_coord.hh"
+
 #include "shared/globals.hh"
 
 
 static PacketBuffer read_buffer = {};
 static PacketBuffer write_buffer = {};
-static std::vector<std::uint8_t> read_zdata = {};
 static std::vector<std::uint8_t> write_zdata = {};
+static std::vector<protocol::Message> received_messages = {};
+
+// Packets larger than that are handed over to ENet
+// as they are instead of being copied; smaller ones are
+// way cheaper to copy than to allocate storage for
+constexpr static std::size_t ZERO_COPY_THRESHOLD = 1024;
+
+// Frames carry a number of length-prefixed messages; the
+// identifier is never used by an actual packet type and frames
+// are never nested into each other
+constexpr static std::uint16_t FRAME_ID = UINT16_C(0xFFFF);
+
+// Frames are kept below the usual path MTU so that
+// they never have to be fragmented by ENet; messages larger
+// than the threshold are not worth coalescing at all
+constexpr static std::size_t FRAME_SIZE = 1200;
+constexpr static std::size_t FRAME_THRESHOLD = 512;
+
+constexpr static float ANGLE_SCALE = 65536.0f / cxpr::radians(360.0f);
+
+struct PendingFrame final {
+    PacketBuffer writer {};
+    enet_uint32 connect_id {};
+    enet_uint32 flags {};
+    std::size_t count {};
+};
+
+unsigned int protocol::chunk_level = chunk_codec::LEVEL_DEFAULT;
+bool protocol::discard_sends = false;
+std::recursive_mutex *protocol::host_mutex = nullptr;
+
+ChunkTraffic protocol::chunk_traffic = {};
+
+static bool is_framing = false;
+static emhash8::HashMap<ENetPeer *, std::array<PendingFrame, protocol::NUM_CHANNELS>> pending_frames = {};
+static emhash8::HashMap<const ENetPeer *, PeerTraffic> peer_traffic = {};
+
+static std::unique_lock<std::recursive_mutex> lock_host(void)
+{
+    if(protocol::host_mutex)
+        return std::unique_lock<std::recursive_mutex>(*protocol::host_mutex);
+    return std::unique_lock<std::recursive_mutex>();
+}
+
+static void free_packet_storage(ENetPacket *packet)
+{
+    delete reinterpret_cast<std::vector<std::uint8_t> *>(packet->userData);
+}
+
+static ENetPacket *make_packet(enet_uint32 flags)
+{
+    if(write_buffer.vector.size() < ZERO_COPY_THRESHOLD)
+        return enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), flags);
+
+    auto storage = new std::vector<std::uint8_t>(std::move(write_buffer.vector));
+    auto packet = enet_packet_create(storage->data(), storage->size(), flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+    packet->freeCallback = &free_packet_storage;
+    packet->userData = storage;
+
+    write_buffer.vector.clear();
+
+    return packet;
+}
+
+static PeerTraffic &get_traffic(const ENetPeer *peer)
+{
+    PeerTraffic &traffic = peer_traffic[peer];
+
+    // ENet resets the peer as soon as it's disconnected
+    // so a zero identifier still means the same connection
+    if(peer->connectID && (traffic.connect_id != peer->connectID)) {
+        traffic = PeerTraffic();
+        traffic.connect_id = peer->connectID;
+    }
 
-static void write_voxel_storage(PacketBuffer &buffer, const VoxelStorage &storage)
+    return traffic;
+}
+
+static void count_message(PacketTraffic &traffic, const std::uint8_t *data, std::size_t size)
 {
-    mz_ulong bound = mz_compressBound(sizeof(VoxelStorage));
+    std::size_t index = protocol::NUM_PACKET_IDS;
 
-    VoxelStorage net_storage = {};
-    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
-        // Convert voxel data into network byte order
-        // FIXME: what if we change voxel size to 32 bits?
-        net_storage[i] = ENET_HOST_TO_NET_16(storage[i]);
+    if(size >= 2) {
+        const std::size_t id = (data[0] << 8U) | data[1];
+        index = cxpr::min(id, protocol::NUM_PACKET_IDS);
     }
 
-    write_zdata.resize(bound);
-    mz_compress(write_zdata.data(), &bound, reinterpret_cast<const unsigned char *>(net_storage.data()), sizeof(VoxelStorage));
-    PacketBuffer::write_UI64(buffer, static_cast<std::uint64_t>(bound));
-    for(mz_ulong i = 0; i < bound; PacketBuffer::write_UI8(buffer, write_zdata[i++]));
+    traffic.packets[index] += 1;
+    traffic.bytes[index] += size;
 }
 
-static void read_voxel_storage(PacketBuffer &buffer, VoxelStorage &storage)
+static void count_chunk(std::size_t encoded_size)
 {
-    mz_ulong size = static_cast<mz_ulong>(sizeof(VoxelStorage));
-    mz_ulong bound = static_cast<mz_ulong>(PacketBuffer::read_UI64(buffer));
+    protocol::chunk_traffic.chunks += 1;
+    protocol::chunk_traffic.raw_bytes += sizeof(VoxelStorage);
+    protocol::chunk_traffic.encoded_bytes += encoded_size;
+}
 
-    read_zdata.resize(bound);
-    for(mz_ulong i = 0; i < bound; read_zdata[i++] = PacketBuffer::read_UI8(buffer));
-    mz_uncompress(reinterpret_cast<unsigned char *>(storage.data()), &size, read_zdata.data(), bound);
+static void write_entity(PacketBuffer &buffer, entt::entity entity)
+{
+    PacketBuffer::write_VUI32(buffer, static_cast<std::uint32_t>(entity));
+}
 
-    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
-        // Convert voxel storage to host byte order in-situ
-        // FIXME: what if we change voxel size to 32 bits?
-        storage[i] = ENET_NET_TO_HOST_16(storage[i]);
+static entt::entity read_entity(PacketBuffer &buffer)
+{
+    return static_cast<entt::entity>(PacketBuffer::read_VUI32(buffer));
+}
+
+static void write_chunk_coord(PacketBuffer &buffer, const ChunkCoord &cpos)
+{
+    PacketBuffer::write_VI32(buffer, cpos[0]);
+    PacketBuffer::write_VI32(buffer, cpos[1]);
+    PacketBuffer::write_VI32(buffer, cpos[2]);
+}
+
+static ChunkCoord read_chunk_coord(PacketBuffer &buffer)
+{
+    ChunkCoord result = {};
+    result[0] = PacketBuffer::read_VI32(buffer);
+    result[1] = PacketBuffer::read_VI32(buffer);
+    result[2] = PacketBuffer::read_VI32(buffer);
+    return result;
+}
+
+// Angles wrap around naturally; a full turn
+// is exactly 65536 steps so we just truncate
+static void write_angles(PacketBuffer &buffer, const Vec3angles &angles)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(std::lround(angles[i] * ANGLE_SCALE) & 0xFFFFL));
+    }
+}
+
+static Vec3angles read_angles(PacketBuffer &buffer)
+{
+    Vec3angles result = {};
+    result[0] = static_cast<float>(static_cast<std::int16_t>(PacketBuffer::read_UI16(buffer))) / ANGLE_SCALE;
+    result[1] = static_cast<float>(static_cast<std::int16_t>(PacketBuffer::read_UI16(buffer))) / ANGLE_SCALE;
+    result[2] = static_cast<float>(static_cast<std::int16_t>(PacketBuffer::read_UI16(buffer))) / ANGLE_SCALE;
+    return result;
+}
+
+// Voxels are addressed by their chunk and a local index
+// which only takes 12 bits; the rest of the index is reserved
+static VoxelCoord read_voxel_coord(PacketBuffer &buffer)
+{
+    const ChunkCoord cpos = read_chunk_coord(buffer);
+    const std::size_t index = PacketBuffer::read_UI16(buffer) % CHUNK_VOLUME;
+    return ChunkCoord::to_voxel(cpos, index);
+}
+
+// Every element takes at least one byte so a length can't
+// be larger than whatever is left to be read; this prevents
+// truncated and malicious packets from causing huge allocations
+static std::size_t read_length(PacketBuffer &buffer)
+{
+    const std::size_t length = PacketBuffer::read_VUI32(buffer);
+    return cxpr::min(length, buffer.vector.size() - cxpr::min(buffer.read_position, buffer.vector.size()));
+}
+
+static void write_voxel_storage(PacketBuffer &buffer, const std::vector<std::uint8_t> &encoded)
+{
+    PacketBuffer::write_VUI64(buffer, static_cast<std::uint64_t>(encoded.size()));
+    PacketBuffer::write_bytes(buffer, encoded.data(), encoded.size());
+}
+
+static void read_voxel_storage(PacketBuffer &buffer, std::vector<std::uint8_t> &encoded, VoxelStorage &storage)
+{
+    auto size = static_cast<std::size_t>(PacketBuffer::read_VUI64(buffer));
+
+    if(size > (buffer.vector.size() - cxpr::min(buffer.read_position, buffer.vector.size()))) {
+        // Don't even try to allocate whatever
+        // amount of memory a truncated packet wants
+        storage.fill(NULL_VOXEL);
+        encoded.clear();
+        return;
+    }
+
+    encoded.resize(size);
+    PacketBuffer::read_bytes(buffer, encoded.data(), size);
+
+    if(!chunk_codec::decode(encoded, storage)) {
+        spdlog::warn("protocol: corrupted chunk voxel data");
+        storage.fill(NULL_VOXEL);
+        encoded.clear();
+        return;
+    }
+
+    count_chunk(size);
+}
+
+// Already serialised packets don't carry their type
+// around with them; the channel is looked up by the ID
+static enet_uint8 find_channel(const ENetPacket *packet)
+{
+    if(packet->dataLength < 2)
+        return protocol::CHANNEL_DEFAULT;
+
+    const auto id = static_cast<std::uint16_t>((packet->data[0] << 8U) | packet->data[1]);
+
+    switch(id) {
+        case protocol::StatusRequest::ID:
+            return protocol::StatusRequest::CHANNEL;
+        case protocol::StatusResponse::ID:
+            return protocol::StatusResponse::CHANNEL;
+        case protocol::LoginRequest::ID:
+            return protocol::LoginRequest::CHANNEL;
+        case protocol::LoginResponse::ID:
+            return protocol::LoginResponse::CHANNEL;
+        case protocol::Disconnect::ID:
+            return protocol::Disconnect::CHANNEL;
+        case protocol::ChunkVoxels::ID:
+            return protocol::ChunkVoxels::CHANNEL;
+        case protocol::EntityTransform::ID:
+            return protocol::EntityTransform::CHANNEL;
+        case protocol::EntityHead::ID:
+            return protocol::EntityHead::CHANNEL;
+        case protocol::EntityVelocity::ID:
+            return protocol::EntityVelocity::CHANNEL;
+        case protocol::SpawnPlayer::ID:
+            return protocol::SpawnPlayer::CHANNEL;
+        case protocol::ChatMessage::ID:
+            return protocol::ChatMessage::CHANNEL;
+        case protocol::SetVoxel::ID:
+            return protocol::SetVoxel::CHANNEL;
+        case protocol::RemoveEntity::ID:
+            return protocol::RemoveEntity::CHANNEL;
+        case protocol::EntityPlayer::ID:
+            return protocol::EntityPlayer::CHANNEL;
+        case protocol::PlayerListUpdate::ID:
+            return protocol::PlayerListUpdate::CHANNEL;
+        case protocol::RequestChunk::ID:
+            return protocol::RequestChunk::CHANNEL;
+        case protocol::GenericSound::ID:
+            return protocol::GenericSound::CHANNEL;
+        case protocol::EntitySound::ID:
+            return protocol::EntitySound::CHANNEL;
+        case protocol::ChunkHashes::ID:
+            return protocol::ChunkHashes::CHANNEL;
+        case protocol::ChunkUnchanged::ID:
+            return protocol::ChunkUnchanged::CHANNEL;
+        case protocol::ChunkAbsent::ID:
+            return protocol::ChunkAbsent::CHANNEL;
+        case protocol::EntitySnapshot::ID:
+            return protocol::EntitySnapshot::CHANNEL;
+        case protocol::SnapshotAck::ID:
+            return protocol::SnapshotAck::CHANNEL;
+        case protocol::PlayerCommands::ID:
+            return protocol::PlayerCommands::CHANNEL;
+        case protocol::PlayerStateAck::ID:
+            return protocol::PlayerStateAck::CHANNEL;
+        case protocol::RemoveChunk::ID:
+            return protocol::RemoveChunk::CHANNEL;
+        default:
+            return protocol::CHANNEL_DEFAULT;
+    }
+}
+
+static void release_unused(ENetPacket *packet)
+{
+    if(packet->referenceCount == 0) {
+        // ENet seems to do that as well
+        enet_packet_destroy(packet);
+    }
+}
+
+static void send_frame(ENetPeer *peer, enet_uint8 channel, PendingFrame &frame)
+{
+    if(frame.count == 0)
+        return;
+
+    // The peer might have disconnected and its slot might
+    // have been taken by somebody else since the frame was started
+    if((peer->state == ENET_PEER_STATE_CONNECTED) && (peer->connectID == frame.connect_id)) {
+        const std::vector<std::uint8_t> &data = frame.writer.vector;
+        ENetPacket *packet;
+
+        if(frame.count == 1) {
+            // There's no point in wrapping a single
+            // message; skip both the identifier and the length
+            packet = enet_packet_create(data.data() + 4, data.size() - 4, frame.flags);
+        }
+        else {
+            packet = enet_packet_create(data.data(), data.size(), frame.flags);
+        }
+
+        if(protocol::discard_sends || (enet_peer_send(peer, channel, packet) < 0)) {
+            enet_packet_destroy(packet);
+        }
+    }
+
+    frame.count = 0;
+}
+
+static void flush_frame(ENetPeer *peer, enet_uint8 channel)
+{
+    const auto it = pending_frames.find(peer);
+
+    if((it != pending_frames.end()) && (channel < protocol::NUM_CHANNELS)) {
+        send_frame(peer, channel, it->second[channel]);
+    }
+}
+
+static bool append_frame(ENetPeer *peer, enet_uint8 channel, const ENetPacket *packet)
+{
+    if((packet->dataLength > FRAME_THRESHOLD) || (channel >= protocol::NUM_CHANNELS))
+        return false;
+
+    PendingFrame &frame = pending_frames[peer][channel];
+    const enet_uint32 flags = packet->flags & (ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_UNSEQUENCED);
+
+    if(frame.count && ((frame.flags != flags) || (frame.connect_id != peer->connectID) || ((frame.writer.vector.size() + 2 + packet->dataLength) > FRAME_SIZE))) {
+        // The message can't share the datagram
+        // with whatever has been queued before it
+        send_frame(peer, channel, frame);
+    }
+
+    if(frame.count == 0) {
+        PacketBuffer::setup(frame.writer);
+        PacketBuffer::write_UI16(frame.writer, FRAME_ID);
+        frame.connect_id = peer->connectID;
+        frame.flags = flags;
+    }
+
+    PacketBuffer::write_UI16(frame.writer, static_cast<std::uint16_t>(packet->dataLength));
+    PacketBuffer::write_bytes(frame.writer, packet->data, packet->dataLength);
+    frame.count += 1;
+
+    return true;
+}
+
+static void peer_send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet)
+{
+    count_message(get_traffic(peer).sent, packet->data, packet->dataLength);
+
+    if(is_framing) {
+        if(append_frame(peer, channel, packet))
+            return;
+
+        // Larger packets go out as they are; whatever is
+        // queued on the channel has to be sent ahead of them
+        flush_frame(peer, channel);
+    }
+
+    if(!protocol::discard_sends) {
+        enet_peer_send(peer, channel, packet);
     }
 }
 
 // [peer], [NULL] - send to one specific peer
 // [NULL], [host] - broadcast to all the host peers
 // [peer], [host] - broadcast to all the peers except one
-static void basic_send(ENetPeer *peer, ENetHost *host, ENetPacket *packet)
+static void basic_send(ENetPeer *peer, ENetHost *host, ENetPacket *packet, enet_uint8 channel)
 {
     if(host) {
         for(std::size_t i = 0; i < host->peerCount; ++i) {
             if(host->peers[i].state == ENET_PEER_STATE_CONNECTED) {
                 if(&host->peers[i] == peer)
                     continue;
-                enet_peer_send(&host->peers[i], 0, packet);
+                peer_send(&host->peers[i], channel, packet);
             }
         }
-
-        if(packet->referenceCount == 0) {
-            // ENet seems to do that as well
-            enet_packet_destroy(packet);
-        }
     }
     else if(peer) {
         // Send to just one peer
-        enet_peer_send(peer, 0, packet);
+        peer_send(peer, channel, packet);
     }
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusRequest &packet)
+// Freshly encoded packets are owned by the sender; they are
+// released if they end up being copied into frames entirely
+static void send_encoded(ENetPeer *peer, ENetHost *host, ENetPacket *packet, enet_uint8 channel)
+{
+    // ENet might let go of the packet as soon as it's
+    // acknowledged so its reference count is only looked
+    // at while the host can't be serviced in the meantime
+    const auto lock = lock_host();
+
+    basic_send(peer, host, packet, channel);
+    release_unused(packet);
+}
+
+ENetPacket *protocol::encode(const protocol::StatusRequest &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::StatusRequest::ID);
     PacketBuffer::write_UI32(write_buffer, packet.version);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::StatusRequest::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusResponse &packet)
+ENetPacket *protocol::encode(const protocol::StatusResponse &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::StatusResponse::ID);
     PacketBuffer::write_UI32(write_buffer, packet.version);
     PacketBuffer::write_UI16(write_buffer, packet.max_players);
     PacketBuffer::write_UI16(write_buffer, packet.num_players);
+    PacketBuffer::write_VUI32(write_buffer, packet.busy_time_us);
     PacketBuffer::write_string(write_buffer, packet.motd);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::StatusResponse::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest &packet)
+ENetPacket *protocol::encode(const protocol::LoginRequest &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::LoginRequest::ID);
@@ -106,171 +434,468 @@ void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest
     PacketBuffer::write_UI64(write_buffer, packet.item_def_checksum);
     PacketBuffer::write_UI64(write_buffer, packet.password_hash);
     PacketBuffer::write_string(write_buffer, packet.username.substr(0, protocol::MAX_USERNAME));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::LoginRequest::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginResponse &packet)
+ENetPacket *protocol::encode(const protocol::LoginResponse &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::LoginResponse::ID);
     PacketBuffer::write_UI16(write_buffer, packet.client_index);
     PacketBuffer::write_UI64(write_buffer, packet.client_identity);
     PacketBuffer::write_UI16(write_buffer, packet.server_tickrate);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::LoginResponse::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::Disconnect &packet)
+ENetPacket *protocol::encode(const protocol::Disconnect &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::Disconnect::ID);
     PacketBuffer::write_string(write_buffer, packet.reason);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::Disconnect::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkVoxels &packet)
+ENetPacket *protocol::encode(const protocol::ChunkVoxels &packet)
 {
+    const std::vector<std::uint8_t> *encoded = &packet.encoded;
+
+    if(chunk_codec::get_format(packet.encoded) != chunk_codec::get_format(protocol::chunk_level)) {
+        // Voxels are encoded differently from how we'd
+        // encode them so they can't be forwarded as-is
+        if(!chunk_codec::encode(packet.voxels, write_zdata, protocol::chunk_level)) {
+            // Plain runs never go through miniz
+            // and clients can decode either format
+            chunk_codec::encode(packet.voxels, write_zdata, chunk_codec::LEVEL_RLE);
+        }
+
+        encoded = &write_zdata;
+    }
+
     PacketBuffer::setup(write_buffer);
+    PacketBuffer::reserve(write_buffer, 30 + encoded->size());
     PacketBuffer::write_UI16(write_buffer, protocol::ChunkVoxels::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    PacketBuffer::write_I32(write_buffer, packet.chunk[0]);
-    PacketBuffer::write_I32(write_buffer, packet.chunk[1]);
-    PacketBuffer::write_I32(write_buffer, packet.chunk[2]);
-    write_voxel_storage(write_buffer, packet.voxels);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    write_entity(write_buffer, packet.entity);
+    write_chunk_coord(write_buffer, packet.chunk);
+    write_voxel_storage(write_buffer, *encoded);
+
+    count_chunk(encoded->size());
+
+    return make_packet(protocol::ChunkVoxels::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityTransform &packet)
+ENetPacket *protocol::encode(const protocol::EntityTransform &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::EntityTransform::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    PacketBuffer::write_I32(write_buffer, packet.coord.chunk[0]);
-    PacketBuffer::write_I32(write_buffer, packet.coord.chunk[1]);
-    PacketBuffer::write_I32(write_buffer, packet.coord.chunk[2]);
+    write_entity(write_buffer, packet.entity);
+    write_chunk_coord(write_buffer, packet.coord.chunk);
     PacketBuffer::write_FP32(write_buffer, packet.coord.local[0]);
     PacketBuffer::write_FP32(write_buffer, packet.coord.local[1]);
     PacketBuffer::write_FP32(write_buffer, packet.coord.local[2]);
     PacketBuffer::write_FP32(write_buffer, packet.angles[0]);
     PacketBuffer::write_FP32(write_buffer, packet.angles[1]);
     PacketBuffer::write_FP32(write_buffer, packet.angles[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::EntityTransform::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityHead &packet)
+ENetPacket *protocol::encode(const protocol::EntityHead &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::EntityHead::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    write_entity(write_buffer, packet.entity);
     PacketBuffer::write_FP32(write_buffer, packet.angles[0]);
     PacketBuffer::write_FP32(write_buffer, packet.angles[1]);
     PacketBuffer::write_FP32(write_buffer, packet.angles[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::EntityHead::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityVelocity &packet)
+ENetPacket *protocol::encode(const protocol::EntityVelocity &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::EntityVelocity::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    write_entity(write_buffer, packet.entity);
     PacketBuffer::write_FP32(write_buffer, packet.angular[0]);
     PacketBuffer::write_FP32(write_buffer, packet.angular[1]);
     PacketBuffer::write_FP32(write_buffer, packet.angular[2]);
     PacketBuffer::write_FP32(write_buffer, packet.linear[0]);
     PacketBuffer::write_FP32(write_buffer, packet.linear[1]);
     PacketBuffer::write_FP32(write_buffer, packet.linear[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::EntityVelocity::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SpawnPlayer &packet)
+ENetPacket *protocol::encode(const protocol::SpawnPlayer &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::SpawnPlayer::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));    
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    write_entity(write_buffer, packet.entity);
+    return make_packet(protocol::SpawnPlayer::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChatMessage &packet)
+ENetPacket *protocol::encode(const protocol::ChatMessage &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::ChatMessage::ID);
     PacketBuffer::write_UI16(write_buffer, packet.type);
     PacketBuffer::write_string(write_buffer, packet.sender.substr(0, protocol::MAX_USERNAME));
     PacketBuffer::write_string(write_buffer, packet.message.substr(0, protocol::MAX_CHAT));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::ChatMessage::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SetVoxel &packet)
+ENetPacket *protocol::encode(const protocol::SetVoxel &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::SetVoxel::ID);
-    PacketBuffer::write_I64(write_buffer, packet.coord[0]);
-    PacketBuffer::write_I64(write_buffer, packet.coord[1]);
-    PacketBuffer::write_I64(write_buffer, packet.coord[2]);
-    PacketBuffer::write_UI16(write_buffer, packet.voxel);
-    PacketBuffer::write_UI16(write_buffer, packet.flags);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    write_chunk_coord(write_buffer, VoxelCoord::to_chunk(packet.coord));
+    PacketBuffer::write_UI16(write_buffer, static_cast<std::uint16_t>(LocalCoord::to_index(VoxelCoord::to_local(packet.coord))));
+    PacketBuffer::write_VUI32(write_buffer, packet.voxel);
+    PacketBuffer::write_VUI32(write_buffer, packet.flags);
+    return make_packet(protocol::SetVoxel::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RemoveEntity &packet)
+ENetPacket *protocol::encode(const protocol::RemoveEntity &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::RemoveEntity::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    write_entity(write_buffer, packet.entity);
+    return make_packet(protocol::RemoveEntity::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityPlayer &packet)
+ENetPacket *protocol::encode(const protocol::EntityPlayer &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::EntityPlayer::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    write_entity(write_buffer, packet.entity);
+    return make_packet(protocol::EntityPlayer::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::PlayerListUpdate &packet)
+ENetPacket *protocol::encode(const protocol::PlayerListUpdate &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::PlayerListUpdate::ID);
-    PacketBuffer::write_UI16(write_buffer, static_cast<std::uint16_t>(packet.names.size()));
+    PacketBuffer::write_VUI32(write_buffer, static_cast<std::uint32_t>(packet.names.size()));
     for(const std::string &username : packet.names)
         PacketBuffer::write_string(write_buffer, username.substr(0, protocol::MAX_USERNAME));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::PlayerListUpdate::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RequestChunk &packet)
+ENetPacket *protocol::encode(const protocol::RequestChunk &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::RequestChunk::ID);
-    PacketBuffer::write_I32(write_buffer, packet.coord[0]);
-    PacketBuffer::write_I32(write_buffer, packet.coord[1]);
-    PacketBuffer::write_I32(write_buffer, packet.coord[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    write_chunk_coord(write_buffer, packet.coord);
+    return make_packet(protocol::RequestChunk::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::GenericSound &packet)
+ENetPacket *protocol::encode(const protocol::GenericSound &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::GenericSound::ID);
     PacketBuffer::write_string(write_buffer, packet.sound.substr(0, protocol::MAX_SOUNDNAME));
     PacketBuffer::write_UI8(write_buffer, packet.looping);
     PacketBuffer::write_FP32(write_buffer, packet.pitch);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::GenericSound::FLAGS);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntitySound &packet)
+ENetPacket *protocol::encode(const protocol::EntitySound &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::EntitySound::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    write_entity(write_buffer, packet.entity);
     PacketBuffer::write_string(write_buffer, packet.sound.substr(0, protocol::MAX_SOUNDNAME));
     PacketBuffer::write_UI8(write_buffer, packet.looping);
     PacketBuffer::write_FP32(write_buffer, packet.pitch);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    return make_packet(protocol::EntitySound::FLAGS);
 }
 
-void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
+ENetPacket *protocol::encode(const protocol::ChunkHashes &packet)
+{
+    const auto count = cxpr::min(packet.entries.size(), protocol::MAX_CHUNK_HASHES);
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::reserve(write_buffer, 5 + 20 * count);
+    PacketBuffer::write_UI16(write_buffer, protocol::ChunkHashes::ID);
+    PacketBuffer::write_UI8(write_buffer, packet.is_final);
+    PacketBuffer::write_VUI32(write_buffer, static_cast<std::uint32_t>(count));
+    for(std::size_t i = 0; i < count; ++i) {
+        write_chunk_coord(write_buffer, packet.entries[i].coord);
+        PacketBuffer::write_UI64(write_buffer, packet.entries[i].hash);
+    }
+    return make_packet(protocol::ChunkHashes::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::ChunkUnchanged &packet)
+{
+    const auto count = cxpr::min(packet.entries.size(), protocol::MAX_CHUNK_HASHES);
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::reserve(write_buffer, 4 + 20 * count);
+    PacketBuffer::write_UI16(write_buffer, protocol::ChunkUnchanged::ID);
+    PacketBuffer::write_VUI32(write_buffer, static_cast<std::uint32_t>(count));
+    for(std::size_t i = 0; i < count; ++i) {
+        write_entity(write_buffer, packet.entries[i].entity);
+        write_chunk_coord(write_buffer, packet.entries[i].coord);
+    }
+    return make_packet(protocol::ChunkUnchanged::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::ChunkAbsent &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::reserve(write_buffer, 4 + 14 * packet.entries.size());
+    PacketBuffer::write_UI16(write_buffer, protocol::ChunkAbsent::ID);
+    PacketBuffer::write_VUI32(write_buffer, static_cast<std::uint32_t>(packet.entries.size()));
+    for(const protocol::ChunkAbsent::Entry &entry : packet.entries) {
+        write_chunk_coord(write_buffer, entry.coord);
+        PacketBuffer::write_UI16(write_buffer, entry.height);
+    }
+    return make_packet(protocol::ChunkAbsent::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::EntitySnapshot &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::reserve(write_buffer, 20 + packet.payload.size());
+    PacketBuffer::write_UI16(write_buffer, protocol::EntitySnapshot::ID);
+    PacketBuffer::write_VUI32(write_buffer, packet.sequence);
+    PacketBuffer::write_VUI64(write_buffer, packet.tick);
+    PacketBuffer::write_VUI32(write_buffer, packet.baseline);
+    PacketBuffer::write_bytes(write_buffer, packet.payload.data(), packet.payload.size());
+    return make_packet(protocol::EntitySnapshot::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::SnapshotAck &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::SnapshotAck::ID);
+    PacketBuffer::write_VUI32(write_buffer, packet.sequence);
+    return make_packet(protocol::SnapshotAck::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::PlayerCommands &packet)
+{
+    const std::size_t count = cxpr::min(packet.commands.size(), protocol::MAX_PLAYER_COMMANDS);
+    const std::size_t first = packet.commands.size() - count;
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::PlayerCommands::ID);
+    PacketBuffer::write_VUI32(write_buffer, static_cast<std::uint32_t>(count));
+
+    // Sequences are written as deltas from the previous
+    // one; most of the time that's a single byte
+    std::uint32_t sequence = UINT32_C(0);
+
+    for(std::size_t i = first; i < packet.commands.size(); ++i) {
+        const PlayerCommand &command = packet.commands[i];
+        PacketBuffer::write_VUI32(write_buffer, command.sequence - sequence);
+        PacketBuffer::write_I8(write_buffer, static_cast<std::int8_t>(cxpr::clamp(std::lround(command.wish_dir[0] * 127.0f), -127L, 127L)));
+        PacketBuffer::write_I8(write_buffer, static_cast<std::int8_t>(cxpr::clamp(std::lround(command.wish_dir[2] * 127.0f), -127L, 127L)));
+        write_angles(write_buffer, command.head);
+        PacketBuffer::write_UI8(write_buffer, command.jump ? UINT8_C(0x01) : UINT8_C(0x00));
+        sequence = command.sequence;
+    }
+
+    return make_packet(protocol::PlayerCommands::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::PlayerStateAck &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::PlayerStateAck::ID);
+    PacketBuffer::write_VUI32(write_buffer, packet.sequence);
+    write_chunk_coord(write_buffer, packet.coord.chunk);
+    PacketBuffer::write_FP32(write_buffer, packet.coord.local[0]);
+    PacketBuffer::write_FP32(write_buffer, packet.coord.local[1]);
+    PacketBuffer::write_FP32(write_buffer, packet.coord.local[2]);
+    PacketBuffer::write_FP32(write_buffer, packet.linear[0]);
+    PacketBuffer::write_FP32(write_buffer, packet.linear[1]);
+    PacketBuffer::write_FP32(write_buffer, packet.linear[2]);
+    PacketBuffer::write_UI8(write_buffer, packet.is_grounded ? UINT8_C(0x01) : UINT8_C(0x00));
+    return make_packet(protocol::PlayerStateAck::FLAGS);
+}
+
+ENetPacket *protocol::encode(const protocol::RemoveChunk &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::RemoveChunk::ID);
+    write_entity(write_buffer, packet.entity);
+    return make_packet(protocol::RemoveChunk::FLAGS);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusRequest &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::StatusRequest::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusResponse &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::StatusResponse::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::LoginRequest::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginResponse &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::LoginResponse::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::Disconnect &packet)
 {
-    PacketBuffer::setup(read_buffer, packet->data, packet->dataLength);
+    send_encoded(peer, host, protocol::encode(packet), protocol::Disconnect::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkVoxels &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::ChunkVoxels::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityTransform &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::EntityTransform::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityHead &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::EntityHead::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityVelocity &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::EntityVelocity::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SpawnPlayer &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::SpawnPlayer::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChatMessage &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::ChatMessage::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SetVoxel &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::SetVoxel::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RemoveEntity &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::RemoveEntity::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityPlayer &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::EntityPlayer::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::PlayerListUpdate &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::PlayerListUpdate::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RequestChunk &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::RequestChunk::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::GenericSound &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::GenericSound::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntitySound &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::EntitySound::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkHashes &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::ChunkHashes::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkUnchanged &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::ChunkUnchanged::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkAbsent &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::ChunkAbsent::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntitySnapshot &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::EntitySnapshot::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SnapshotAck &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::SnapshotAck::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::PlayerCommands &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::PlayerCommands::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::PlayerStateAck &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::PlayerStateAck::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RemoveChunk &packet)
+{
+    send_encoded(peer, host, protocol::encode(packet), protocol::RemoveChunk::CHANNEL);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, ENetPacket *packet)
+{
+    const auto lock = lock_host();
+
+    basic_send(peer, host, packet, find_channel(packet));
+
+    if(host) {
+        // Nobody else is going to
+        release_unused(packet);
+    }
+}
+
+void protocol::begin_frame(void)
+{
+    is_framing = true;
+}
+
+void protocol::end_frame(void)
+{
+    const auto lock = lock_host();
+
+    for(auto &it : pending_frames) {
+        for(std::size_t i = 0; i < protocol::NUM_CHANNELS; ++i) {
+            send_frame(it.first, static_cast<enet_uint8>(i), it.second[i]);
+        }
+    }
+
+    is_framing = false;
+}
+
+static std::uint16_t read_id(const std::uint8_t *data, std::size_t size)
+{
+    if(size < 2)
+        return FRAME_ID;
+    return static_cast<std::uint16_t>((data[0] << 8U) | data[1]);
+}
+
+static void receive_message(const std::uint8_t *data, std::size_t size, ENetPeer *peer)
+{
+    if(peer) {
+        const auto lock = lock_host();
+        count_message(get_traffic(peer).received, data, size);
+    }
+
+    PacketBuffer::setup(read_buffer, data, size);
 
     protocol::StatusRequest status_request = {};
     protocol::StatusResponse status_response = {};
@@ -290,6 +915,14 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
     protocol::RequestChunk request_chunk = {};
     protocol::GenericSound generic_sound = {};
     protocol::EntitySound entity_sound = {};
+    protocol::ChunkHashes chunk_hashes = {};
+    protocol::ChunkUnchanged chunk_unchanged = {};
+    protocol::ChunkAbsent chunk_absent = {};
+    protocol::EntitySnapshot entity_snapshot = {};
+    protocol::SnapshotAck snapshot_ack = {};
+    protocol::PlayerCommands player_commands = {};
+    protocol::PlayerStateAck player_state_ack = {};
+    protocol::RemoveChunk remove_chunk = {};
     
     auto id = PacketBuffer::read_UI16(read_buffer);
     
@@ -304,6 +937,7 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             status_response.version = PacketBuffer::read_UI32(read_buffer);
             status_response.max_players = PacketBuffer::read_UI16(read_buffer);
             status_response.num_players = PacketBuffer::read_UI16(read_buffer);
+            status_response.busy_time_us = PacketBuffer::read_VUI32(read_buffer);
             status_response.motd = PacketBuffer::read_string(read_buffer);
             globals::dispatcher.trigger(status_response);
             break;
@@ -330,19 +964,15 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             break;
         case protocol::ChunkVoxels::ID:
             chunk_voxels.peer = peer;
-            chunk_voxels.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            chunk_voxels.chunk[0] = PacketBuffer::read_I32(read_buffer);
-            chunk_voxels.chunk[1] = PacketBuffer::read_I32(read_buffer);
-            chunk_voxels.chunk[2] = PacketBuffer::read_I32(read_buffer);
-            read_voxel_storage(read_buffer, chunk_voxels.voxels);
+            chunk_voxels.entity = read_entity(read_buffer);
+            chunk_voxels.chunk = read_chunk_coord(read_buffer);
+            read_voxel_storage(read_buffer, chunk_voxels.encoded, chunk_voxels.voxels);
             globals::dispatcher.trigger(chunk_voxels);
             break;
         case protocol::EntityTransform::ID:
             entity_transform.peer = peer;
-            entity_transform.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            entity_transform.coord.chunk[0] = PacketBuffer::read_I32(read_buffer);
-            entity_transform.coord.chunk[1] = PacketBuffer::read_I32(read_buffer);
-            entity_transform.coord.chunk[2] = PacketBuffer::read_I32(read_buffer);
+            entity_transform.entity = read_entity(read_buffer);
+            entity_transform.coord.chunk = read_chunk_coord(read_buffer);
             entity_transform.coord.local[0] = PacketBuffer::read_FP32(read_buffer);
             entity_transform.coord.local[1] = PacketBuffer::read_FP32(read_buffer);
             entity_transform.coord.local[2] = PacketBuffer::read_FP32(read_buffer);
@@ -353,7 +983,7 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             break;
         case protocol::EntityHead::ID:
             entity_head.peer = peer;
-            entity_head.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
+            entity_head.entity = read_entity(read_buffer);
             entity_head.angles[0] = PacketBuffer::read_FP32(read_buffer);
             entity_head.angles[1] = PacketBuffer::read_FP32(read_buffer);
             entity_head.angles[2] = PacketBuffer::read_FP32(read_buffer);
@@ -361,7 +991,7 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             break;
         case protocol::EntityVelocity::ID:
             entity_velocity.peer = peer;
-            entity_velocity.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
+            entity_velocity.entity = read_entity(read_buffer);
             entity_velocity.angular[0] = PacketBuffer::read_FP32(read_buffer);
             entity_velocity.angular[1] = PacketBuffer::read_FP32(read_buffer);
             entity_velocity.angular[2] = PacketBuffer::read_FP32(read_buffer);
@@ -372,7 +1002,7 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             break;
         case protocol::SpawnPlayer::ID:
             spawn_player.peer = peer;
-            spawn_player.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
+            spawn_player.entity = read_entity(read_buffer);
             globals::dispatcher.trigger(spawn_player);
             break;
         case protocol::ChatMessage::ID:
@@ -384,35 +1014,31 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             break;
         case protocol::SetVoxel::ID:
             set_voxel.peer = peer;
-            set_voxel.coord[0] = PacketBuffer::read_I64(read_buffer);
-            set_voxel.coord[1] = PacketBuffer::read_I64(read_buffer);
-            set_voxel.coord[2] = PacketBuffer::read_I64(read_buffer);
-            set_voxel.voxel = PacketBuffer::read_UI16(read_buffer);
-            set_voxel.flags = PacketBuffer::read_UI16(read_buffer);
+            set_voxel.coord = read_voxel_coord(read_buffer);
+            set_voxel.voxel = static_cast<VoxelID>(PacketBuffer::read_VUI32(read_buffer));
+            set_voxel.flags = static_cast<std::uint16_t>(PacketBuffer::read_VUI32(read_buffer));
             globals::dispatcher.trigger(set_voxel);
             break;
         case protocol::RemoveEntity::ID:
-            request_chunk.peer = peer;
-            remove_entity.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
+            remove_entity.peer = peer;
+            remove_entity.entity = read_entity(read_buffer);
             globals::dispatcher.trigger(remove_entity);
             break;
         case protocol::EntityPlayer::ID:
-            request_chunk.peer = peer;
-            entity_player.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
+            entity_player.peer = peer;
+            entity_player.entity = read_entity(read_buffer);
             globals::dispatcher.trigger(entity_player);
             break;
         case protocol::PlayerListUpdate::ID:
-            request_chunk.peer = peer;
-            player_list_update.names.resize(PacketBuffer::read_UI16(read_buffer));
+            player_list_update.peer = peer;
+            player_list_update.names.resize(read_length(read_buffer));
             for(std::size_t i = 0; i < player_list_update.names.size(); ++i)
                 player_list_update.names[i] = PacketBuffer::read_string(read_buffer);
             globals::dispatcher.trigger(player_list_update);
             break;
         case protocol::RequestChunk::ID:
             request_chunk.peer = peer;
-            request_chunk.coord[0] = PacketBuffer::read_UI32(read_buffer);
-            request_chunk.coord[1] = PacketBuffer::read_UI32(read_buffer);
-            request_chunk.coord[2] = PacketBuffer::read_UI32(read_buffer);
+            request_chunk.coord = read_chunk_coord(read_buffer);
             globals::dispatcher.trigger(request_chunk);
             break;
         case protocol::GenericSound::ID:
@@ -424,15 +1050,216 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             break;
         case protocol::EntitySound::ID:
             entity_sound.peer = peer;
-            entity_sound.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
+            entity_sound.entity = read_entity(read_buffer);
             entity_sound.sound = PacketBuffer::read_string(read_buffer);
             entity_sound.looping = PacketBuffer::read_UI8(read_buffer);
             entity_sound.pitch = PacketBuffer::read_FP32(read_buffer);
             globals::dispatcher.trigger(entity_sound);
             break;
+        case protocol::ChunkHashes::ID:
+            chunk_hashes.peer = peer;
+            chunk_hashes.is_final = PacketBuffer::read_UI8(read_buffer);
+            chunk_hashes.entries.resize(read_length(read_buffer));
+            for(std::size_t i = 0; i < chunk_hashes.entries.size(); ++i) {
+                chunk_hashes.entries[i].coord = read_chunk_coord(read_buffer);
+                chunk_hashes.entries[i].hash = PacketBuffer::read_UI64(read_buffer);
+            }
+            globals::dispatcher.trigger(chunk_hashes);
+            break;
+        case protocol::ChunkUnchanged::ID:
+            chunk_unchanged.peer = peer;
+            chunk_unchanged.entries.resize(read_length(read_buffer));
+            for(std::size_t i = 0; i < chunk_unchanged.entries.size(); ++i) {
+                chunk_unchanged.entries[i].entity = read_entity(read_buffer);
+                chunk_unchanged.entries[i].coord = read_chunk_coord(read_buffer);
+            }
+            globals::dispatcher.trigger(chunk_unchanged);
+            break;
+        case protocol::ChunkAbsent::ID:
+            chunk_absent.peer = peer;
+            chunk_absent.entries.resize(read_length(read_buffer));
+            for(std::size_t i = 0; i < chunk_absent.entries.size(); ++i) {
+                chunk_absent.entries[i].coord = read_chunk_coord(read_buffer);
+                chunk_absent.entries[i].height = PacketBuffer::read_UI16(read_buffer);
+            }
+            globals::dispatcher.trigger(chunk_absent);
+            break;
+        case protocol::EntitySnapshot::ID:
+            entity_snapshot.peer = peer;
+            entity_snapshot.sequence = PacketBuffer::read_VUI32(read_buffer);
+            entity_snapshot.tick = PacketBuffer::read_VUI64(read_buffer);
+            entity_snapshot.baseline = PacketBuffer::read_VUI32(read_buffer);
+            if(read_buffer.read_position < read_buffer.vector.size())
+                entity_snapshot.payload.assign(read_buffer.vector.cbegin() + read_buffer.read_position, read_buffer.vector.cend());
+            globals::dispatcher.trigger(entity_snapshot);
+            break;
+        case protocol::SnapshotAck::ID:
+            snapshot_ack.peer = peer;
+            snapshot_ack.sequence = PacketBuffer::read_VUI32(read_buffer);
+            globals::dispatcher.trigger(snapshot_ack);
+            break;
+        case protocol::PlayerCommands::ID:
+            player_commands.peer = peer;
+            player_commands.commands.resize(cxpr::min(read_length(read_buffer), protocol::MAX_PLAYER_COMMANDS));
+            for(std::size_t i = 0; i < player_commands.commands.size(); ++i) {
+                PlayerCommand &command = player_commands.commands[i];
+                command.sequence = (i ? player_commands.commands[i - 1].sequence : UINT32_C(0)) + PacketBuffer::read_VUI32(read_buffer);
+                command.wish_dir[0] = static_cast<float>(PacketBuffer::read_I8(read_buffer)) / 127.0f;
+                command.wish_dir[1] = 0.0f;
+                command.wish_dir[2] = static_cast<float>(PacketBuffer::read_I8(read_buffer)) / 127.0f;
+                command.head = read_angles(read_buffer);
+                command.jump = PacketBuffer::read_UI8(read_buffer) & 0x01;
+            }
+            globals::dispatcher.trigger(player_commands);
+            break;
+        case protocol::PlayerStateAck::ID:
+            player_state_ack.peer = peer;
+            player_state_ack.sequence = PacketBuffer::read_VUI32(read_buffer);
+            player_state_ack.coord.chunk = read_chunk_coord(read_buffer);
+            player_state_ack.coord.local[0] = PacketBuffer::read_FP32(read_buffer);
+            player_state_ack.coord.local[1] = PacketBuffer::read_FP32(read_buffer);
+            player_state_ack.coord.local[2] = PacketBuffer::read_FP32(read_buffer);
+            player_state_ack.linear[0] = PacketBuffer::read_FP32(read_buffer);
+            player_state_ack.linear[1] = PacketBuffer::read_FP32(read_buffer);
+            player_state_ack.linear[2] = PacketBuffer::read_FP32(read_buffer);
+            player_state_ack.is_grounded = PacketBuffer::read_UI8(read_buffer) & 0x01;
+            globals::dispatcher.trigger(player_state_ack);
+            break;
+        case protocol::RemoveChunk::ID:
+            remove_chunk.peer = peer;
+            remove_chunk.entity = read_entity(read_buffer);
+            globals::dispatcher.trigger(remove_chunk);
+            break;
+    }
+}
+
+void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
+{
+    protocol::split(packet, received_messages);
+
+    for(const protocol::Message &message : received_messages) {
+        receive_message(packet->data + message.offset, message.size, peer);
+    }
+}
+
+void protocol::receive(const ENetPacket *packet, const protocol::Message &message, ENetPeer *peer)
+{
+    receive_message(packet->data + message.offset, message.size, peer);
+}
+
+void protocol::split(const ENetPacket *packet, std::vector<protocol::Message> &messages)
+{
+    messages.clear();
+
+    if((packet->dataLength < 2) || (read_id(packet->data, packet->dataLength) != FRAME_ID)) {
+        protocol::Message message = {};
+        message.id = read_id(packet->data, packet->dataLength);
+        message.offset = 0;
+        message.size = packet->dataLength;
+        messages.push_back(message);
+        return;
+    }
+
+    std::size_t position = 2;
+
+    while((position + 2) <= packet->dataLength) {
+        const std::size_t size = (packet->data[position] << 8U) | packet->data[position + 1];
+
+        if((position + 2 + size) > packet->dataLength) {
+            spdlog::warn("protocol: truncated frame");
+            break;
+        }
+
+        protocol::Message message = {};
+        message.id = read_id(packet->data + position + 2, size);
+        message.offset = position + 2;
+        message.size = size;
+        messages.push_back(message);
+
+        position += 2 + size;
     }
 }
 
+const char *protocol::get_packet_name(std::uint16_t id)
+{
+    switch(id) {
+        case protocol::StatusRequest::ID:
+            return "StatusRequest";
+        case protocol::StatusResponse::ID:
+            return "StatusResponse";
+        case protocol::LoginRequest::ID:
+            return "LoginRequest";
+        case protocol::LoginResponse::ID:
+            return "LoginResponse";
+        case protocol::Disconnect::ID:
+            return "Disconnect";
+        case protocol::ChunkVoxels::ID:
+            return "ChunkVoxels";
+        case protocol::EntityTransform::ID:
+            return "EntityTransform";
+        case protocol::EntityHead::ID:
+            return "EntityHead";
+        case protocol::EntityVelocity::ID:
+            return "EntityVelocity";
+        case protocol::SpawnPlayer::ID:
+            return "SpawnPlayer";
+        case protocol::ChatMessage::ID:
+            return "ChatMessage";
+        case protocol::SetVoxel::ID:
+            return "SetVoxel";
+        case protocol::RemoveEntity::ID:
+            return "RemoveEntity";
+        case protocol::EntityPlayer::ID:
+            return "EntityPlayer";
+        case protocol::PlayerListUpdate::ID:
+            return "PlayerListUpdate";
+        case protocol::RequestChunk::ID:
+            return "RequestChunk";
+        case protocol::GenericSound::ID:
+            return "GenericSound";
+        case protocol::EntitySound::ID:
+            return "EntitySound";
+        case protocol::ChunkHashes::ID:
+            return "ChunkHashes";
+        case protocol::ChunkUnchanged::ID:
+            return "ChunkUnchanged";
+        case protocol::ChunkAbsent::ID:
+            return "ChunkAbsent";
+        case protocol::EntitySnapshot::ID:
+            return "EntitySnapshot";
+        case protocol::SnapshotAck::ID:
+            return "SnapshotAck";
+        case protocol::PlayerCommands::ID:
+            return "PlayerCommands";
+        case protocol::PlayerStateAck::ID:
+            return "PlayerStateAck";
+        case protocol::RemoveChunk::ID:
+            return "RemoveChunk";
+        default:
+            return "unknown";
+    }
+}
+
+const PeerTraffic *protocol::find_traffic(const ENetPeer *peer)
+{
+    const auto it = peer_traffic.find(peer);
+
+    if(it != peer_traffic.end())
+        return &it->second;
+    return nullptr;
+}
+
+std::uint64_t protocol::sum_bytes(const PacketTraffic &traffic, const PacketTraffic &last)
+{
+    std::uint64_t total = 0;
+
+    for(std::size_t i = 0; i < traffic.bytes.size(); ++i) {
+        total += traffic.bytes[i] - last.bytes[i];
+    }
+
+    return total;
+}
+
 void protocol::send_disconnect(ENetPeer *peer, ENetHost *host, const std::string &reason)
 {
     protocol::Disconnect packet = {};
@@ -455,6 +1282,7 @@ void protocol::send_chunk_voxels(ENetPeer *peer, ENetHost *host, entt::entity en
         packet.entity = entity;
         packet.chunk = component->coord;
         packet.voxels = component->chunk->voxels;
+        packet.encoded = component->chunk->encoded;
         protocol::send(peer, host, packet);
     }
 }
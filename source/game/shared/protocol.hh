@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
 #include "mathlib/vec3angles.hh"
+#include "shared/entity/pmove.hh"
 #include "shared/world/chunk.hh"
 #include "shared/world/world_coord.hh"
 
@@ -9,16 +10,61 @@ namespace protocol
 constexpr static std::size_t MAX_CHAT = 16384;
 constexpr static std::size_t MAX_USERNAME = 64;
 constexpr static std::size_t MAX_SOUNDNAME = 1024;
+constexpr static std::size_t MAX_CHUNK_HASHES = 1024;
+constexpr static std::size_t MAX_PLAYER_COMMANDS = 32;
 constexpr static std::uint16_t TICKRATE = 60;
 constexpr static std::uint16_t PORT = 43103;
-constexpr static std::uint32_t VERSION = 14;
+constexpr static std::uint32_t VERSION = 25;
 } // namespace protocol
 
 namespace protocol
 {
-template<std::uint16_t packet_id>
+// Reliable packets are only ordered within their own channel
+// so a lost chunk packet never holds back chat or session traffic;
+// unreliable channels are sequenced and silently drop whatever
+// arrives out of order since a newer state supersedes it anyway
+constexpr static enet_uint8 CHANNEL_DEFAULT = 0; // reliable: session, chat, entities
+constexpr static enet_uint8 CHANNEL_CHUNKS = 1; // reliable: chunks and voxel edits
+constexpr static enet_uint8 CHANNEL_MOVEMENT = 2; // unreliable: transforms, heads, velocities, player commands
+constexpr static enet_uint8 CHANNEL_SNAPSHOTS = 3; // unreliable: entity snapshots
+constexpr static std::size_t NUM_CHANNELS = 4;
+} // namespace protocol
+
+namespace protocol
+{
+// Compression level used for outgoing chunk voxels;
+// zero means uncompressed palette RLE which trades
+// bandwidth for latency and is a good fit for LAN servers
+extern unsigned int chunk_level;
+} // namespace protocol
+
+namespace protocol
+{
+// Packets are still encoded and framed but never handed
+// over to ENet; used to replay recorded traffic offline where
+// the peers exist only as far as the server code can tell
+extern bool discard_sends;
+
+// Held around everything the protocol code does with ENet
+// hosts and peers; only ever set when the host is being
+// serviced on a different thread than the one sending
+extern std::recursive_mutex *host_mutex;
+} // namespace protocol
+
+namespace protocol
+{
+// Packet identifiers are handed out sequentially;
+// telemetry counts anything at or past that as unknown
+constexpr static std::size_t NUM_PACKET_IDS = 0x001A;
+} // namespace protocol
+
+namespace protocol
+{
+template<std::uint16_t packet_id, enet_uint8 packet_channel = CHANNEL_DEFAULT, enet_uint32 packet_flags = ENET_PACKET_FLAG_RELIABLE>
 struct Base {
     constexpr static std::uint16_t ID = packet_id;
+    constexpr static enet_uint8 CHANNEL = packet_channel;
+    constexpr static enet_uint32 FLAGS = packet_flags;
     virtual ~Base(void) = default;
     ENetPeer *peer {nullptr};
 };
@@ -44,6 +90,46 @@ struct PlayerListUpdate;
 struct RequestChunk;
 struct GenericSound;
 struct EntitySound;
+struct ChunkHashes;
+struct ChunkUnchanged;
+struct ChunkAbsent;
+struct EntitySnapshot;
+struct SnapshotAck;
+struct PlayerCommands;
+struct PlayerStateAck;
+struct RemoveChunk;
+} // namespace protocol
+
+namespace protocol
+{
+// Serialises packets without sending them anywhere; the
+// resulting packet can be sent to any number of peers
+ENetPacket *encode(const StatusRequest &packet);
+ENetPacket *encode(const StatusResponse &packet);
+ENetPacket *encode(const LoginRequest &packet);
+ENetPacket *encode(const LoginResponse &packet);
+ENetPacket *encode(const Disconnect &packet);
+ENetPacket *encode(const ChunkVoxels &packet);
+ENetPacket *encode(const EntityTransform &packet);
+ENetPacket *encode(const EntityHead &packet);
+ENetPacket *encode(const EntityVelocity &packet);
+ENetPacket *encode(const SpawnPlayer &packet);
+ENetPacket *encode(const ChatMessage &packet);
+ENetPacket *encode(const SetVoxel &packet);
+ENetPacket *encode(const RemoveEntity &packet);
+ENetPacket *encode(const EntityPlayer &packet);
+ENetPacket *encode(const PlayerListUpdate &packet);
+ENetPacket *encode(const RequestChunk &packet);
+ENetPacket *encode(const GenericSound &packet);
+ENetPacket *encode(const EntitySound &packet);
+ENetPacket *encode(const ChunkHashes &packet);
+ENetPacket *encode(const ChunkUnchanged &packet);
+ENetPacket *encode(const ChunkAbsent &packet);
+ENetPacket *encode(const EntitySnapshot &packet);
+ENetPacket *encode(const SnapshotAck &packet);
+ENetPacket *encode(const PlayerCommands &packet);
+ENetPacket *encode(const PlayerStateAck &packet);
+ENetPacket *encode(const RemoveChunk &packet);
 } // namespace protocol
 
 namespace protocol
@@ -66,11 +152,91 @@ void send(ENetPeer *peer, ENetHost *host, const PlayerListUpdate &packet);
 void send(ENetPeer *peer, ENetHost *host, const RequestChunk &packet);
 void send(ENetPeer *peer, ENetHost *host, const GenericSound &packet);
 void send(ENetPeer *peer, ENetHost *host, const EntitySound &packet);
+void send(ENetPeer *peer, ENetHost *host, const ChunkHashes &packet);
+void send(ENetPeer *peer, ENetHost *host, const ChunkUnchanged &packet);
+void send(ENetPeer *peer, ENetHost *host, const ChunkAbsent &packet);
+void send(ENetPeer *peer, ENetHost *host, const EntitySnapshot &packet);
+void send(ENetPeer *peer, ENetHost *host, const SnapshotAck &packet);
+void send(ENetPeer *peer, ENetHost *host, const PlayerCommands &packet);
+void send(ENetPeer *peer, ENetHost *host, const PlayerStateAck &packet);
+void send(ENetPeer *peer, ENetHost *host, const RemoveChunk &packet);
+} // namespace protocol
+
+namespace protocol
+{
+// Sends an already serialised packet on the channel its
+// packet type is defined to use; broadcasts are destroyed once
+// nothing references them anymore but a packet sent to just one
+// peer can end up copied into a frame, so unless something else
+// holds a reference to it, the caller is to check and release it
+void send(ENetPeer *peer, ENetHost *host, ENetPacket *packet);
+} // namespace protocol
+
+namespace protocol
+{
+// Small packets sent between the two calls are coalesced
+// into frames, one per peer and channel, which are sent out as
+// single datagrams once they're full or the frame has ended
+void begin_frame(void);
+void end_frame(void);
+} // namespace protocol
+
+namespace protocol
+{
+// A single message within a received packet; frames
+// carry several of them, anything else is just the one
+struct Message final {
+    std::uint16_t id {};
+    std::size_t offset {};
+    std::size_t size {};
+};
 } // namespace protocol
 
 namespace protocol
 {
 void receive(const ENetPacket *packet, ENetPeer *peer);
+void receive(const ENetPacket *packet, const Message &message, ENetPeer *peer);
+void split(const ENetPacket *packet, std::vector<Message> &messages);
+} // namespace protocol
+
+// Messages and their sizes as the protocol sees them, that
+// is before being coalesced into frames and without whatever
+// ENet puts on top; the last entry counts unknown identifiers
+struct PacketTraffic final {
+    std::array<std::uint64_t, protocol::NUM_PACKET_IDS + 1> packets {};
+    std::array<std::uint64_t, protocol::NUM_PACKET_IDS + 1> bytes {};
+};
+
+// Traffic exchanged with a single peer over its current
+// connection; counters start over when the slot is reused
+struct PeerTraffic final {
+    enet_uint32 connect_id {};
+    PacketTraffic sent {};
+    PacketTraffic received {};
+};
+
+// Chunk voxels that went through the codec, either encoded
+// to be sent or decoded after being received; the encoded size
+// over the raw size of the voxel storage is the compression ratio
+struct ChunkTraffic final {
+    std::uint64_t chunks {};
+    std::uint64_t raw_bytes {};
+    std::uint64_t encoded_bytes {};
+};
+
+namespace protocol
+{
+extern ChunkTraffic chunk_traffic;
+} // namespace protocol
+
+namespace protocol
+{
+const char *get_packet_name(std::uint16_t id);
+const PeerTraffic *find_traffic(const ENetPeer *peer);
+
+// Bytes counted since the earlier snapshot of the
+// very same counters; PacketTraffic() gives the totals
+std::uint64_t sum_bytes(const PacketTraffic &traffic, const PacketTraffic &last);
 } // namespace protocol
 
 namespace protocol
@@ -102,6 +268,7 @@ struct protocol::StatusResponse final : public protocol::Base<0x0001> {
     std::uint32_t version {};
     std::uint16_t max_players {};
     std::uint16_t num_players {};
+    std::uint32_t busy_time_us {}; // average tick, not counting the sleep
     std::string motd {};
 };
 
@@ -123,24 +290,29 @@ struct protocol::Disconnect final : public protocol::Base<0x0004> {
     std::string reason {};
 };
 
-struct protocol::ChunkVoxels final : public protocol::Base<0x0005> {
+// Voxels are sent encoded by chunk_codec and the leading format
+// byte of the encoded data serves as the encoding tag; when the
+// encoded vector already holds voxels in the format protocol::chunk_level
+// would produce, it is forwarded as-is and the voxels aren't touched
+struct protocol::ChunkVoxels final : public protocol::Base<0x0005, protocol::CHANNEL_CHUNKS> {
     entt::entity entity {};
     ChunkCoord chunk {};
     VoxelStorage voxels {};
+    std::vector<std::uint8_t> encoded {};
 };
 
-struct protocol::EntityTransform final : public protocol::Base<0x0006> {
+struct protocol::EntityTransform final : public protocol::Base<0x0006, protocol::CHANNEL_MOVEMENT, 0> {
     entt::entity entity {};
     WorldCoord coord {};
     Vec3angles angles {};
 };
 
-struct protocol::EntityHead final : public protocol::Base<0x0007> {
+struct protocol::EntityHead final : public protocol::Base<0x0007, protocol::CHANNEL_MOVEMENT, 0> {
     entt::entity entity {};
     Vec3angles angles {};
 };
 
-struct protocol::EntityVelocity final : public protocol::Base<0x0008> {
+struct protocol::EntityVelocity final : public protocol::Base<0x0008, protocol::CHANNEL_MOVEMENT, 0> {
     entt::entity entity {};
     Vec3angles angular {};
     Vec3f linear {};
@@ -160,7 +332,7 @@ struct protocol::ChatMessage final : public protocol::Base<0x000A> {
     std::string message {};
 };
 
-struct protocol::SetVoxel final : public protocol::Base<0x000B> {
+struct protocol::SetVoxel final : public protocol::Base<0x000B, protocol::CHANNEL_CHUNKS> {
     VoxelCoord coord {};
     VoxelID voxel {};
     std::uint16_t flags {};
@@ -178,7 +350,7 @@ struct protocol::PlayerListUpdate final : public protocol::Base<0x000E> {
     std::vector<std::string> names {};
 };
 
-struct protocol::RequestChunk final : public protocol::Base<0x000F> {
+struct protocol::RequestChunk final : public protocol::Base<0x000F, protocol::CHANNEL_CHUNKS> {
     ChunkCoord coord {};
 };
 
@@ -190,7 +362,84 @@ struct protocol::GenericSound final : public protocol::Base<0x0010> {
 
 struct protocol::EntitySound final : public protocol::Base<0x0011> {
     entt::entity entity {};
+
     std::string sound {};
     bool looping {};
     float pitch {};
 };
+
+// Sent by clients once they have spawned; lists content
+// hashes of chunks that were cached during earlier sessions
+// with the server. The server doesn't stream chunks to the
+// client until it has received the packet with is_final set
+struct protocol::ChunkHashes final : public protocol::Base<0x0012, protocol::CHANNEL_CHUNKS> {
+    struct Entry final {
+        ChunkCoord coord {};
+        std::uint64_t hash {};
+    };
+
+    std::vector<Entry> entries {};
+    bool is_final {};
+};
+
+// Cached chunks that match what the server has; the
+// client is expected to load them from its own cache
+struct protocol::ChunkUnchanged final : public protocol::Base<0x0013, protocol::CHANNEL_CHUNKS> {
+    struct Entry final {
+        entt::entity entity {};
+        ChunkCoord coord {};
+    };
+
+    std::vector<Entry> entries {};
+};
+
+// Chunks that don't exist on the server at all; each
+// entry covers a vertical run of chunks starting at the
+// coordinate since absent chunks tend to come in columns
+struct protocol::ChunkAbsent final : public protocol::Base<0x0014, protocol::CHANNEL_CHUNKS> {
+    struct Entry final {
+        ChunkCoord coord {};
+        std::uint16_t height {};
+    };
+
+    std::vector<Entry> entries {};
+};
+
+// Delta-compressed state of entities around the player;
+// the payload is encoded against the baseline snapshot which
+// is the latest one the client has acknowledged receiving;
+// the tick is when the server has captured the states
+struct protocol::EntitySnapshot final : public protocol::Base<0x0015, protocol::CHANNEL_SNAPSHOTS, 0> {
+    std::uint32_t sequence {};
+    std::uint64_t tick {};
+    std::uint32_t baseline {};
+    std::vector<std::uint8_t> payload {};
+};
+
+struct protocol::SnapshotAck final : public protocol::Base<0x0016, protocol::CHANNEL_SNAPSHOTS, 0> {
+    std::uint32_t sequence {};
+};
+
+// Commands issued by the local player that the server is
+// yet to acknowledge, oldest first; commands that changed nothing
+// on the client are never sent and the server doesn't run them either
+struct protocol::PlayerCommands final : public protocol::Base<0x0017, protocol::CHANNEL_MOVEMENT, 0> {
+    std::vector<PlayerCommand> commands {};
+};
+
+// The latest command the server has run for the player
+// and the resulting state; the client compares it to what it
+// has predicted and replays later commands on top if needed
+struct protocol::PlayerStateAck final : public protocol::Base<0x0018, protocol::CHANNEL_MOVEMENT, 0> {
+    std::uint32_t sequence {};
+    WorldCoord coord {};
+    Vec3f linear {};
+    bool is_grounded {};
+};
+
+// Chunk entities are removed on the same channel their voxels
+// are sent on; a RemoveEntity on the default channel could overtake
+// voxels still in flight and leave the client with an orphaned chunk
+struct protocol::RemoveChunk final : public protocol::Base<0x0019, protocol::CHANNEL_CHUNKS> {
+    entt::entity entity {};
+};
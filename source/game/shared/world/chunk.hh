@@ -12,6 +12,17 @@ public:
     entt::entity entity {};
     VoxelStorage voxels {};
 
+    // Voxels exactly as they were read from disk; this
+    // allows saved chunks to be sent over the network and
+    // written back without being re-encoded. Anything that
+    // modifies the voxels must clear this vector
+    std::vector<std::uint8_t> encoded {};
+
+    // Incremented every time the voxels are modified
+    // or the chunk is replaced; anything derived from the
+    // voxels can be tagged with it to detect staleness
+    std::uint64_t version {};
+
 public:
     static Chunk *create(void);
     static void destroy(Chunk *chunk);
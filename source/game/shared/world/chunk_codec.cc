@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "shared/precompiled.hh"
+#include "shared/world/chunk_codec.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/crc64.hh"
+#include "common/packet_buffer.hh"
+
+
+// Format byte plus uncompressed body size
+constexpr static std::size_t HEADER_SIZE = 5;
+
+// Palette size, the palette itself and the worst
+// case of every single voxel being its own run
+constexpr static std::size_t MAX_BODY_SIZE = 2 + 2 * CHUNK_VOLUME + 4 * CHUNK_VOLUME;
+
+static void encode_body(const VoxelStorage &voxels, PacketBuffer &body)
+{
+    emhash8::HashMap<VoxelID, std::uint16_t> palette_map = {};
+    std::vector<VoxelID> palette = {};
+    std::vector<std::pair<std::uint16_t, std::uint16_t>> runs = {};
+
+    // Voxels are laid out in a Y-major order so horizontal
+    // layers of the same voxel (air, stone, water) end up
+    // being long runs of the same value; this is what makes
+    // the format both compact and very quick to decode
+    for(std::size_t i = 0; i < CHUNK_VOLUME;) {
+        const VoxelID voxel = voxels[i];
+        std::size_t length = 1;
+
+        while(((i + length) < CHUNK_VOLUME) && (voxels[i + length] == voxel))
+            length += 1;
+
+        auto it = palette_map.find(voxel);
+
+        if(it == palette_map.end()) {
+            it = palette_map.emplace(voxel, static_cast<std::uint16_t>(palette.size())).first;
+            palette.push_back(voxel);
+        }
+
+        runs.emplace_back(it->second, static_cast<std::uint16_t>(length));
+
+        i += length;
+    }
+
+    body.vector.reserve(2 + 2 * palette.size() + 4 * runs.size());
+
+    PacketBuffer::write_UI16(body, static_cast<std::uint16_t>(palette.size()));
+
+    for(const VoxelID voxel : palette)
+        PacketBuffer::write_UI16(body, voxel);
+
+    if(palette.size() == 1) {
+        // Single-voxel chunks (air, solid stone)
+        // don't need any run information stored
+        return;
+    }
+
+    if(palette.size() <= 256) {
+        for(const auto &run : runs) {
+            PacketBuffer::write_UI8(body, static_cast<std::uint8_t>(run.first));
+            PacketBuffer::write_UI16(body, run.second);
+        }
+    }
+    else {
+        for(const auto &run : runs) {
+            PacketBuffer::write_UI16(body, run.first);
+            PacketBuffer::write_UI16(body, run.second);
+        }
+    }
+}
+
+static bool decode_body(PacketBuffer &body, VoxelStorage &voxels)
+{
+    const std::size_t palette_size = PacketBuffer::read_UI16(body);
+
+    if((palette_size == 0) || (palette_size > CHUNK_VOLUME))
+        return false;
+
+    std::vector<VoxelID> palette = {};
+    palette.resize(palette_size);
+
+    for(std::size_t i = 0; i < palette_size; ++i)
+        palette[i] = PacketBuffer::read_UI16(body);
+
+    if(palette_size == 1) {
+        voxels.fill(palette[0]);
+        return body.read_position == body.vector.size();
+    }
+
+    const bool wide_index = (palette_size > 256);
+    std::size_t position = 0;
+
+    while(position < CHUNK_VOLUME) {
+        std::size_t index;
+
+        if(wide_index)
+            index = PacketBuffer::read_UI16(body);
+        else index = PacketBuffer::read_UI8(body);
+
+        const std::size_t length = PacketBuffer::read_UI16(body);
+
+        if(body.read_position > body.vector.size()) {
+            // Truncated run data
+            return false;
+        }
+
+        if((index >= palette_size) || (length == 0) || ((position + length) > CHUNK_VOLUME)) {
+            // Corrupted run data
+            return false;
+        }
+
+        std::fill_n(voxels.begin() + position, length, palette[index]);
+
+        position += length;
+    }
+
+    return body.read_position == body.vector.size();
+}
+
+static bool decode_legacy(const std::uint8_t *data, std::size_t size, VoxelStorage &voxels)
+{
+    auto out_size = static_cast<mz_ulong>(sizeof(VoxelStorage));
+    auto in_size = static_cast<mz_ulong>(size);
+
+    if(mz_uncompress(reinterpret_cast<unsigned char *>(voxels.data()), &out_size, data, in_size) != MZ_OK)
+        return false;
+    if(out_size != sizeof(VoxelStorage))
+        return false;
+
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+        // Legacy voxels are stored in the network
+        // byte order; just like the older ChunkVoxels did
+        voxels[i] = ENET_NET_TO_HOST_16(voxels[i]);
+    }
+
+    return true;
+}
+
+std::uint8_t chunk_codec::get_format(unsigned int level)
+{
+    if(level == chunk_codec::LEVEL_RLE)
+        return chunk_codec::FORMAT_RLE;
+    return chunk_codec::FORMAT_ZRLE;
+}
+
+std::uint8_t chunk_codec::get_format(const std::vector<std::uint8_t> &buffer)
+{
+    if(buffer.empty())
+        return UINT8_C(0x00);
+    return buffer[0];
+}
+
+bool chunk_codec::encode(const VoxelStorage &voxels, std::vector<std::uint8_t> &buffer, unsigned int level)
+{
+    PacketBuffer body = {};
+    encode_body(voxels, body);
+
+    PacketBuffer header = {};
+    PacketBuffer::write_UI8(header, chunk_codec::get_format(level));
+    PacketBuffer::write_UI32(header, static_cast<std::uint32_t>(body.vector.size()));
+
+    buffer.assign(header.vector.cbegin(), header.vector.cend());
+
+    if(level == chunk_codec::LEVEL_RLE) {
+        buffer.insert(buffer.end(), body.vector.cbegin(), body.vector.cend());
+        return true;
+    }
+
+    auto bound = mz_compressBound(static_cast<mz_ulong>(body.vector.size()));
+    buffer.resize(HEADER_SIZE + bound);
+
+    auto level_value = static_cast<int>(cxpr::min(level, chunk_codec::LEVEL_MAX));
+
+    if(mz_compress2(buffer.data() + HEADER_SIZE, &bound, body.vector.data(), static_cast<mz_ulong>(body.vector.size()), level_value) != MZ_OK) {
+        buffer.clear();
+        return false;
+    }
+
+    // Make sure we're not keeping any excess
+    // data that wasn't used by mz_compress2
+    buffer.resize(HEADER_SIZE + bound);
+
+    return true;
+}
+
+bool chunk_codec::decode(const std::uint8_t *data, std::size_t size, VoxelStorage &voxels)
+{
+    if(size < 1)
+        return false;
+
+    if(data[0] == chunk_codec::FORMAT_LEGACY)
+        return decode_legacy(data, size, voxels);
+
+    if(size < HEADER_SIZE)
+        return false;
+
+    PacketBuffer header = {};
+    PacketBuffer::setup(header, data, HEADER_SIZE);
+
+    const std::uint8_t format = PacketBuffer::read_UI8(header);
+    const std::size_t body_size = PacketBuffer::read_UI32(header);
+
+    if(body_size > MAX_BODY_SIZE)
+        return false;
+
+    PacketBuffer body = {};
+
+    if(format == chunk_codec::FORMAT_RLE) {
+        if((size - HEADER_SIZE) != body_size)
+            return false;
+        PacketBuffer::setup(body, data + HEADER_SIZE, body_size);
+        return decode_body(body, voxels);
+    }
+
+    if(format == chunk_codec::FORMAT_ZRLE) {
+        auto out_size = static_cast<mz_ulong>(body_size);
+        auto in_size = static_cast<mz_ulong>(size - HEADER_SIZE);
+
+        body.read_position = 0;
+        body.vector.resize(body_size);
+
+        if(mz_uncompress(body.vector.data(), &out_size, data + HEADER_SIZE, in_size) != MZ_OK)
+            return false;
+        if(out_size != body_size)
+            return false;
+        return decode_body(body, voxels);
+    }
+
+    return false;
+}
+
+bool chunk_codec::decode(const std::vector<std::uint8_t> &buffer, VoxelStorage &voxels)
+{
+    return chunk_codec::decode(buffer.data(), buffer.size(), voxels);
+}
+
+std::uint64_t chunk_codec::hash(const VoxelStorage &voxels)
+{
+    VoxelStorage net_voxels = {};
+
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i)
+        net_voxels[i] = ENET_HOST_TO_NET_16(voxels[i]);
+    return crc64::get(net_voxels.data(), sizeof(VoxelStorage));
+}
+
+bool chunk_codec::encode_legacy(const VoxelStorage &voxels, std::vector<std::uint8_t> &buffer, unsigned int level)
+{
+    VoxelStorage net_voxels = {};
+
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+        // Convert voxel data into network byte order
+        net_voxels[i] = ENET_HOST_TO_NET_16(voxels[i]);
+    }
+
+    auto bound = mz_compressBound(sizeof(VoxelStorage));
+    buffer.resize(bound);
+
+    auto level_value = static_cast<int>(cxpr::clamp(level, 1U, chunk_codec::LEVEL_MAX));
+
+    if(mz_compress2(buffer.data(), &bound, reinterpret_cast<const unsigned char *>(net_voxels.data()), sizeof(VoxelStorage), level_value) != MZ_OK) {
+        buffer.clear();
+        return false;
+    }
+
+    buffer.resize(bound);
+
+    return true;
+}
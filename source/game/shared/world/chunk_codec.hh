@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk.hh"
+
+// Encoded chunks start with a single format byte; legacy
+// chunks written before the codec existed are raw zlib streams
+// and always start with 0x78 (deflate, 32K window) so they can
+// still be told apart from the newer palette-based formats
+namespace chunk_codec
+{
+constexpr static std::uint8_t FORMAT_RLE = 0x01; // palette + runs
+constexpr static std::uint8_t FORMAT_ZRLE = 0x02; // palette + runs, deflated
+constexpr static std::uint8_t FORMAT_LEGACY = 0x78; // raw voxels, deflated
+} // namespace chunk_codec
+
+namespace chunk_codec
+{
+// Compression level zero produces FORMAT_RLE which is
+// very fast to both encode and decode and is meant for LAN;
+// anything above that is passed to miniz as a deflate level
+constexpr static unsigned int LEVEL_RLE = 0U;
+constexpr static unsigned int LEVEL_DEFAULT = 6U;
+constexpr static unsigned int LEVEL_MAX = 9U;
+} // namespace chunk_codec
+
+namespace chunk_codec
+{
+std::uint8_t get_format(unsigned int level);
+std::uint8_t get_format(const std::vector<std::uint8_t> &buffer);
+} // namespace chunk_codec
+
+namespace chunk_codec
+{
+// Encoding only fails when miniz does; the buffer is
+// left empty then and must not be stored or sent anywhere
+bool encode(const VoxelStorage &voxels, std::vector<std::uint8_t> &buffer, unsigned int level);
+bool decode(const std::uint8_t *data, std::size_t size, VoxelStorage &voxels);
+bool decode(const std::vector<std::uint8_t> &buffer, VoxelStorage &voxels);
+} // namespace chunk_codec
+
+namespace chunk_codec
+{
+// Content hash of the voxels; it doesn't depend on
+// the encoding used nor on the host byte order so it can
+// be compared between peers and with what's stored on disk
+std::uint64_t hash(const VoxelStorage &voxels);
+} // namespace chunk_codec
+
+namespace chunk_codec
+{
+// Legacy encoding; kept around for comparison
+// and for tooling that still deals with old saves
+bool encode_legacy(const VoxelStorage &voxels, std::vector<std::uint8_t> &buffer, unsigned int level);
+} // namespace chunk_codec
@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "shared/precompiled.hh"
+#include "shared/world/journal.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/fstools.hh"
+#include "common/packet_buffer.hh"
+#include "common/strtools.hh"
+
+
+// Reset records don't carry a voxel; they tell the replay
+// code to discard every earlier record for the chunk because
+// its image on disk has been rewritten entirely since then
+constexpr static std::uint16_t RESET_INDEX = UINT16_MAX;
+
+struct Region final {
+    std::vector<std::uint32_t> generations {};
+    std::uint32_t generation {};
+    std::vector<std::uint8_t> pending {};
+    std::size_t size {};
+    JournalRecords records {};
+    bool is_loaded {};
+};
+
+static std::string journal_dir = {};
+static std::uint32_t next_generation = 0;
+static emhash8::HashMap<ChunkCoord, Region> regions = {};
+static std::vector<ChunkCoord> dirty_regions = {};
+
+static std::string journal_filename(const ChunkCoord &region, std::uint32_t generation)
+{
+    auto rx = static_cast<std::uint32_t>(region.get_x());
+    auto ry = static_cast<std::uint32_t>(region.get_y());
+    auto rz = static_cast<std::uint32_t>(region.get_z());
+    return fmt::format("{}/{:08X}-{:08X}-{:08X}-{:08X}.zjrn", journal_dir, rx, ry, rz, generation);
+}
+
+static bool parse_filename(const std::string &filename, ChunkCoord &region, std::uint32_t &generation)
+{
+    const auto parts = strtools::split(filename, "-");
+
+    if(parts.size() != 4)
+        return false;
+    if(parts[3].size() != 13 || parts[3].compare(8, 5, ".zjrn"))
+        return false;
+
+    try {
+        region[0] = static_cast<std::int32_t>(std::stoul(parts[0], nullptr, 16));
+        region[1] = static_cast<std::int32_t>(std::stoul(parts[1], nullptr, 16));
+        region[2] = static_cast<std::int32_t>(std::stoul(parts[2], nullptr, 16));
+        generation = static_cast<std::uint32_t>(std::stoul(parts[3].substr(0, 8), nullptr, 16));
+        return true;
+    }
+    catch(const std::exception &) {
+        return false;
+    }
+}
+
+static void push_record(JournalRecords &records, const ChunkCoord &cpos, std::uint16_t index, VoxelID voxel)
+{
+    if(index == RESET_INDEX) {
+        records.erase(cpos);
+        return;
+    }
+
+    if(index < CHUNK_VOLUME) {
+        JournalRecord record = {};
+        record.index = index;
+        record.voxel = voxel;
+        records[cpos].push_back(record);
+    }
+}
+
+static Region &find_region(const ChunkCoord &rpos)
+{
+    Region &region = regions[rpos];
+
+    if(region.is_loaded)
+        return region;
+
+    std::vector<std::uint8_t> buffer = {};
+
+    region.generation = next_generation;
+
+    for(const std::uint32_t generation : region.generations) {
+        auto path = journal_filename(rpos, generation);
+
+        if(!fstools::read_bytes(path, buffer)) {
+            spdlog::warn("journal: {}: {}", path, fstools::error());
+            continue;
+        }
+
+        journal::parse(buffer.data(), buffer.size(), region.records);
+
+        region.size += buffer.size();
+    }
+
+    region.is_loaded = true;
+
+    return region;
+}
+
+static void write_record(const ChunkCoord &cpos, std::uint16_t index, VoxelID voxel)
+{
+    const auto rpos = journal::get_region(cpos);
+    Region &region = find_region(rpos);
+
+    if(region.pending.empty())
+        dirty_regions.push_back(rpos);
+
+    PacketBuffer writer = {};
+    PacketBuffer::write_I32(writer, cpos[0]);
+    PacketBuffer::write_I32(writer, cpos[1]);
+    PacketBuffer::write_I32(writer, cpos[2]);
+    PacketBuffer::write_UI16(writer, index);
+    PacketBuffer::write_UI16(writer, voxel);
+
+    region.pending.insert(region.pending.end(), writer.vector.cbegin(), writer.vector.cend());
+    region.size += journal::RECORD_SIZE;
+
+    push_record(region.records, cpos, index, voxel);
+}
+
+static void flush_region(const ChunkCoord &rpos, Region &region)
+{
+    if(region.pending.empty())
+        return;
+
+    auto path = journal_filename(rpos, region.generation);
+    auto file = PHYSFS_openAppend(path.c_str());
+
+    if(!file) {
+        spdlog::warn("journal: {}: {}", path, fstools::error());
+        return;
+    }
+
+    PHYSFS_writeBytes(file, region.pending.data(), region.pending.size());
+    PHYSFS_close(file);
+
+    if(region.generations.empty() || (region.generations.back() != region.generation))
+        region.generations.push_back(region.generation);
+    region.pending.clear();
+}
+
+void journal::setup(const std::string &directory)
+{
+    journal_dir = directory;
+    next_generation = 0;
+    regions.clear();
+    dirty_regions.clear();
+
+    if(!PHYSFS_mkdir(journal_dir.c_str())) {
+        spdlog::critical("journal: mkdir {}: {}", journal_dir, fstools::error());
+        std::terminate();
+    }
+
+    char **filenames = PHYSFS_enumerateFiles(journal_dir.c_str());
+
+    for(char **filename = filenames; filename && *filename; ++filename) {
+        ChunkCoord rpos = {};
+        std::uint32_t generation = {};
+
+        if(parse_filename(*filename, rpos, generation)) {
+            regions[rpos].generations.push_back(generation);
+            next_generation = cxpr::max(next_generation, generation + 1U);
+        }
+    }
+
+    PHYSFS_freeList(filenames);
+
+    for(auto &it : regions) {
+        // Generations must be replayed in the
+        // same order they have been written in
+        std::sort(it.second.generations.begin(), it.second.generations.end());
+    }
+}
+
+void journal::flush(void)
+{
+    std::vector<ChunkCoord> retry_regions = {};
+
+    for(const ChunkCoord &rpos : dirty_regions) {
+        Region &region = regions[rpos];
+        flush_region(rpos, region);
+
+        if(!region.pending.empty()) {
+            // Keep the records in memory until
+            // the filesystem lets us write them
+            retry_regions.push_back(rpos);
+        }
+    }
+
+    dirty_regions = std::move(retry_regions);
+}
+
+ChunkCoord journal::get_region(const ChunkCoord &cpos)
+{
+    ChunkCoord result = {};
+    result[0] = cpos[0] >> journal::REGION_SIZE_LOG2;
+    result[1] = cpos[1] >> journal::REGION_SIZE_LOG2;
+    result[2] = cpos[2] >> journal::REGION_SIZE_LOG2;
+    return result;
+}
+
+void journal::append(const ChunkCoord &cpos, std::size_t index, VoxelID voxel)
+{
+    write_record(cpos, static_cast<std::uint16_t>(index), voxel);
+}
+
+void journal::append_reset(const ChunkCoord &cpos)
+{
+    write_record(cpos, RESET_INDEX, NULL_VOXEL);
+}
+
+void journal::write_reset(const ChunkCoord &cpos)
+{
+    const auto rpos = journal::get_region(cpos);
+
+    write_record(cpos, RESET_INDEX, NULL_VOXEL);
+
+    // Whatever else is pending for the region goes out
+    // with it; if the write fails, the next flush retries it
+    flush_region(rpos, regions[rpos]);
+}
+
+bool journal::has_records(const ChunkCoord &cpos)
+{
+    const Region &region = find_region(journal::get_region(cpos));
+    return region.records.contains(cpos);
+}
+
+bool journal::replay(const ChunkCoord &cpos, VoxelStorage &voxels)
+{
+    const Region &region = find_region(journal::get_region(cpos));
+    const auto it = region.records.find(cpos);
+
+    if(it != region.records.cend()) {
+        journal::apply(it->second, voxels);
+        return true;
+    }
+
+    return false;
+}
+
+void journal::parse(const std::uint8_t *data, std::size_t size, JournalRecords &records)
+{
+    PacketBuffer reader = {};
+    PacketBuffer::setup(reader, data, size);
+
+    // A torn trailing record can only be caused by a
+    // crash in the middle of a write; just ignore it
+    while((reader.read_position + journal::RECORD_SIZE) <= reader.vector.size()) {
+        ChunkCoord cpos = {};
+        cpos[0] = PacketBuffer::read_I32(reader);
+        cpos[1] = PacketBuffer::read_I32(reader);
+        cpos[2] = PacketBuffer::read_I32(reader);
+        auto index = PacketBuffer::read_UI16(reader);
+        auto voxel = PacketBuffer::read_UI16(reader);
+        push_record(records, cpos, index, voxel);
+    }
+}
+
+void journal::apply(const std::vector<JournalRecord> &records, VoxelStorage &voxels)
+{
+    for(const JournalRecord &record : records) {
+        voxels[record.index] = record.voxel;
+    }
+}
+
+bool journal::find_oversized(std::size_t limit, ChunkCoord &region)
+{
+    for(const auto &it : regions) {
+        if(it.second.is_loaded && (it.second.size >= limit)) {
+            region = it.first;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void journal::detach(const ChunkCoord &rpos, JournalRecords &records, std::vector<std::string> &files)
+{
+    Region &region = find_region(rpos);
+
+    flush_region(rpos, region);
+
+    records = std::move(region.records);
+    region.records.clear();
+
+    files.clear();
+
+    for(const std::uint32_t generation : region.generations)
+        files.push_back(journal_filename(rpos, generation));
+    region.generations.clear();
+
+    // Records written from now on go into a new
+    // file that is not going to be touched by compaction
+    region.generation = next_generation++;
+    region.size = region.pending.size();
+}
+
+void journal::attach(const ChunkCoord &rpos, JournalRecords &records, const std::vector<std::string> &files)
+{
+    Region &region = find_region(rpos);
+
+    for(const std::string &path : files) {
+        ChunkCoord file_rpos = {};
+        std::uint32_t generation = {};
+
+        if(parse_filename(path.substr(path.rfind('/') + 1), file_rpos, generation)) {
+            region.generations.push_back(generation);
+        }
+    }
+
+    std::sort(region.generations.begin(), region.generations.end());
+
+    // The size isn't brought back; a chunk image that
+    // can't be read would otherwise have compaction retry
+    // the region over and over again until a restart
+    for(auto &it : records) {
+        std::vector<JournalRecord> &chunk_records = region.records[it.first];
+        chunk_records.insert(chunk_records.begin(), it.second.cbegin(), it.second.cend());
+    }
+}
+
+void journal::enumerate(std::vector<JournalFile> &files)
+{
+    journal::flush();
+
+    files.clear();
+
+    for(const auto &it : regions) {
+        for(const std::uint32_t generation : it.second.generations) {
+            PHYSFS_Stat stat = {};
+            JournalFile file = {};
+            file.path = journal_filename(it.first, generation);
+
+            if(!PHYSFS_stat(file.path.c_str(), &stat)) {
+                spdlog::warn("journal: {}: {}", file.path, fstools::error());
+                continue;
+            }
+
+            file.size = static_cast<std::size_t>(stat.filesize);
+            files.push_back(file);
+        }
+    }
+}
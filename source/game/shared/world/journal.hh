@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "shared/world/chunk.hh"
+#include "shared/world/chunk_coord.hh"
+
+struct JournalRecord final {
+    std::uint16_t index {};
+    VoxelID voxel {};
+};
+
+struct JournalFile final {
+    std::string path {};
+    std::size_t size {};
+};
+
+using JournalRecords = emhash8::HashMap<ChunkCoord, std::vector<JournalRecord>>;
+
+// Voxel edits are appended to per-region journal files
+// instead of rewriting entire chunks; a region is a cube of
+// chunks and each region journal is replayed on top of the
+// chunk images stored on disk whenever a chunk is loaded
+namespace journal
+{
+constexpr static std::size_t REGION_SIZE_LOG2 = 4;
+constexpr static std::size_t RECORD_SIZE = 16;
+} // namespace journal
+
+namespace journal
+{
+void setup(const std::string &directory);
+void flush(void);
+} // namespace journal
+
+namespace journal
+{
+ChunkCoord get_region(const ChunkCoord &cpos);
+void append(const ChunkCoord &cpos, std::size_t index, VoxelID voxel);
+void append_reset(const ChunkCoord &cpos);
+
+// Same as append_reset but the record is written out
+// right away instead of waiting for the next flush; meant
+// to follow rewriting a chunk image as closely as possible
+void write_reset(const ChunkCoord &cpos);
+bool has_records(const ChunkCoord &cpos);
+bool replay(const ChunkCoord &cpos, VoxelStorage &voxels);
+void parse(const std::uint8_t *data, std::size_t size, JournalRecords &records);
+void apply(const std::vector<JournalRecord> &records, VoxelStorage &voxels);
+} // namespace journal
+
+namespace journal
+{
+bool find_oversized(std::size_t limit, ChunkCoord &region);
+void detach(const ChunkCoord &region, JournalRecords &records, std::vector<std::string> &files);
+
+// Gives back records that compaction couldn't fold into
+// chunk images along with the detached files holding them;
+// they're replayed before anything written since the detach
+void attach(const ChunkCoord &region, JournalRecords &records, const std::vector<std::string> &files);
+
+// Lists journal files in the order they must be
+// replayed in; sizes are the ones at the time of the call
+void enumerate(std::vector<JournalFile> &files);
+} // namespace journal
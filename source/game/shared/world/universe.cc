@@ -6,10 +6,17 @@
 #include "common/epoch.hh"
 #include "common/fstools.hh"
 #include "common/packet_buffer.hh"
+#include "common/strtools.hh"
 
 #include "shared/entity/chunk.hh"
 #include "shared/entity/inhabited.hh"
 
+#include "shared/event/chunk_update.hh"
+#include "shared/event/chunk_write.hh"
+#include "shared/event/voxel_set.hh"
+
+#include "shared/world/chunk_codec.hh"
+#include "shared/world/journal.hh"
 #include "shared/world/world.hh"
 
 #include "shared/worldgen/worldgen.hh"
@@ -18,29 +25,364 @@
 #include "shared/protocol.hh"
 
 
+bool universe::is_read_only = false;
+
 static Config universe_config = {};
 static std::string universe_dir = {};
 static std::string universe_chunk_dir = {};
 static std::string universe_config_path = {};
 
 static std::uint64_t worldgen_seed = UINT64_MAX;
+static unsigned int deflate_level = chunk_codec::LEVEL_DEFAULT;
+static unsigned int journal_limit = 262144U;
+static unsigned int journal_flush_ms = 250U;
+static unsigned int backup_interval = 0U;
+
+static std::uint64_t last_journal_flush = 0;
+static std::uint64_t last_backup = 0;
+
+// Read-only universes keep chunks that would have
+// been stored in memory so that unloading them and then
+// loading them back doesn't lose anything that happened
+static emhash8::HashMap<ChunkCoord, VoxelStorage> kept_chunks = {};
+
+// Internal flag component; marks chunks whose state
+// is fully described by their image stored on disk and
+// the voxel edits that were written into the journal
+struct JournaledComponent final {};
+
+struct CompactionTask final {
+    ChunkCoord region {};
+    JournalRecords records {};
+    emhash8::HashMap<ChunkCoord, VoxelStorage> loaded {};
+    std::vector<std::string> files {};
+    unsigned int level {};
+
+    // Records the worker couldn't fold into chunk images;
+    // the journal files are kept whenever there are any
+    JournalRecords skipped {};
+};
+
+struct SnapshotTask final {
+    std::string directory {};
+    std::uint64_t begin_time {};
+    unsigned int level {};
+
+    std::vector<ChunkCoord> loaded_coords {};
+    std::vector<ChunkCoord> stored_coords {};
+    std::vector<JournalFile> journal_files {};
+
+    // Chunks that the worker hasn't yet got to; whenever
+    // the tick is about to overwrite one of them, it copies
+    // the contents out first and the worker then uses the copy
+    std::mutex mutex {};
+    emhash8::HashMap<ChunkCoord, const Chunk *> loaded {};
+    emhash8::HashMap<ChunkCoord, VoxelStorage> loaded_copies {};
+    emhash8::HashMap<ChunkCoord, std::string> stored {};
+    emhash8::HashMap<ChunkCoord, std::vector<std::uint8_t>> stored_copies {};
+};
+
+static BS::thread_pool worker_pool = BS::thread_pool(1);
+static std::shared_ptr<CompactionTask> compaction_task = {};
+static std::future<void> compaction_future = {};
+
+static std::shared_ptr<SnapshotTask> snapshot_task = {};
+static std::future<void> snapshot_future = {};
+
+static void compact(std::shared_ptr<CompactionTask> task)
+{
+    std::vector<std::uint8_t> buffer = {};
+    VoxelStorage voxels = {};
+
+    for(auto &it : task->records) {
+        auto path = fmt::format("{}/chunk/{}", universe_dir, universe::get_chunk_filename(it.first));
+        auto loaded = task->loaded.find(it.first);
+
+        if(loaded != task->loaded.cend()) {
+            // The chunk is loaded and its voxels
+            // already include all the journaled edits
+            voxels = loaded->second;
+        }
+        else {
+            if(!fstools::read_bytes(path, buffer) || !chunk_codec::decode(buffer, voxels)) {
+                spdlog::warn("universe: compact: {}: unable to read chunk image", path);
+                task->skipped[it.first] = std::move(it.second);
+                continue;
+            }
+
+            journal::apply(it.second, voxels);
+        }
+
+        if(!chunk_codec::encode(voxels, buffer, task->level)) {
+            spdlog::warn("universe: compact: {}: unable to encode chunk", path);
+            task->skipped[it.first] = std::move(it.second);
+            continue;
+        }
+
+        if(!fstools::write_bytes(path, buffer)) {
+            spdlog::warn("universe: compact: {}: {}", path, fstools::error());
+            task->skipped[it.first] = std::move(it.second);
+            continue;
+        }
+    }
 
-static std::string chunk_filename(const ChunkCoord &cpos)
+    if(!task->skipped.empty()) {
+        // Keeping the journal around means that the skipped
+        // edits are still going to be replayed; records are plain
+        // voxel assignments so replaying the folded ones is harmless
+        spdlog::warn("universe: compact: {} chunks left in the journal", task->skipped.size());
+        return;
+    }
+
+    for(const std::string &path : task->files) {
+        if(!PHYSFS_delete(path.c_str())) {
+            spdlog::warn("universe: compact: {}: {}", path, fstools::error());
+        }
+    }
+}
+
+static void write_snapshot(std::shared_ptr<SnapshotTask> task)
 {
-    auto cx = static_cast<std::uint32_t>(cpos.get_x());
-    auto cy = static_cast<std::uint32_t>(cpos.get_y());
-    auto cz = static_cast<std::uint32_t>(cpos.get_z());
-    return fmt::format("{:08X}-{:08X}-{:08X}.zvox", cx, cy, cz);
+    std::vector<std::uint8_t> buffer = {};
+    JournalRecords records = {};
+    VoxelStorage voxels = {};
+
+    for(const JournalFile &file : task->journal_files) {
+        if(!fstools::read_bytes(file.path, buffer)) {
+            spdlog::warn("universe: backup: {}: {}", file.path, fstools::error());
+            continue;
+        }
+
+        // Anything past the recorded size has been
+        // appended after the snapshot was taken
+        journal::parse(buffer.data(), cxpr::min(buffer.size(), file.size), records);
+    }
+
+    for(const ChunkCoord &cpos : task->loaded_coords) {
+        {
+            std::lock_guard<std::mutex> lock(task->mutex);
+            const auto copy = task->loaded_copies.find(cpos);
+            const auto live = task->loaded.find(cpos);
+
+            if(copy != task->loaded_copies.cend()) {
+                voxels = copy->second;
+                task->loaded_copies.erase(copy);
+            }
+            else if(live != task->loaded.cend()) {
+                voxels = live->second->voxels;
+                task->loaded.erase(live);
+            }
+            else {
+                continue;
+            }
+        }
+
+        auto path = fmt::format("{}/chunk/{}", task->directory, universe::get_chunk_filename(cpos));
+
+        if(!chunk_codec::encode(voxels, buffer, task->level)) {
+            spdlog::warn("universe: backup: {}: unable to encode chunk", path);
+            continue;
+        }
+
+        if(!fstools::write_bytes(path, buffer)) {
+            spdlog::warn("universe: backup: {}: {}", path, fstools::error());
+            continue;
+        }
+    }
+
+    for(const ChunkCoord &cpos : task->stored_coords) {
+        {
+            std::lock_guard<std::mutex> lock(task->mutex);
+            const auto copy = task->stored_copies.find(cpos);
+            const auto live = task->stored.find(cpos);
+
+            if(copy != task->stored_copies.cend()) {
+                buffer = std::move(copy->second);
+                task->stored_copies.erase(copy);
+            }
+            else if(live != task->stored.cend()) {
+                // The lock is held while reading so that
+                // the tick can't overwrite the file halfway
+                auto result = fstools::read_bytes(live->second, buffer);
+                task->stored.erase(live);
+
+                if(!result) {
+                    spdlog::warn("universe: backup: {}: {}", universe::get_chunk_filename(cpos), fstools::error());
+                    continue;
+                }
+            }
+            else {
+                continue;
+            }
+        }
+
+        auto path = fmt::format("{}/chunk/{}", task->directory, universe::get_chunk_filename(cpos));
+        auto it = records.find(cpos);
+
+        if(it != records.cend()) {
+            if(!chunk_codec::decode(buffer, voxels)) {
+                spdlog::warn("universe: backup: {}: corrupted chunk data", universe::get_chunk_filename(cpos));
+                continue;
+            }
+
+            // Backups don't carry journals around
+            journal::apply(it->second, voxels);
+
+            if(!chunk_codec::encode(voxels, buffer, task->level)) {
+                spdlog::warn("universe: backup: {}: unable to encode chunk", path);
+                continue;
+            }
+        }
+
+        if(!fstools::write_bytes(path, buffer)) {
+            spdlog::warn("universe: backup: {}: {}", path, fstools::error());
+            continue;
+        }
+    }
+}
+
+static void copy_stored_chunk(const ChunkCoord &cpos, const std::string &path)
+{
+    if(snapshot_task) {
+        std::lock_guard<std::mutex> lock(snapshot_task->mutex);
+        const auto it = snapshot_task->stored.find(cpos);
+
+        if(it != snapshot_task->stored.cend()) {
+            if(!fstools::read_bytes(path, snapshot_task->stored_copies[cpos]))
+                spdlog::warn("universe: backup: {}: {}", path, fstools::error());
+            snapshot_task->stored.erase(it);
+        }
+    }
+}
+
+// Truncated or otherwise corrupted chunk images are moved
+// out of the way instead of being loaded; the journal can't be
+// replayed on top of anything else so its records are reset too
+static void quarantine_chunk(const ChunkCoord &cpos, const std::string &path, const std::vector<std::uint8_t> &buffer)
+{
+    auto quarantine_path = fmt::format("{}.corrupt", path);
+
+    if(universe::is_read_only) {
+        spdlog::warn("universe::load_chunk: {}: corrupted chunk data", path);
+        return;
+    }
+
+    spdlog::warn("universe::load_chunk: {}: corrupted chunk data; moved to {}", path, quarantine_path);
+
+    if(!fstools::write_bytes(quarantine_path, buffer)) {
+        // Never delete the only copy there is
+        spdlog::warn("universe::load_chunk: {}: {}", quarantine_path, fstools::error());
+    }
+    else if(!PHYSFS_delete(path.c_str())) {
+        spdlog::warn("universe::load_chunk: {}: {}", path, fstools::error());
+    }
+
+    if(journal::has_records(cpos)) {
+        journal::append_reset(cpos);
+    }
+}
+
+static void finish_compaction(void)
+{
+    if(compaction_future.valid()) {
+        compaction_future.get();
+        compaction_future = std::future<void>();
+
+        if(!compaction_task->skipped.empty()) {
+            // Chunks whose images couldn't be rewritten
+            // would otherwise be loaded without their edits
+            journal::attach(compaction_task->region, compaction_task->skipped, compaction_task->files);
+        }
+
+        compaction_task = nullptr;
+    }
+}
+
+static void wait_for_compaction(const ChunkCoord &cpos)
+{
+    if(compaction_task && (journal::get_region(cpos) == compaction_task->region)) {
+        // Chunk images in the region are
+        // being rewritten right now; we must not
+        // read or write them until that is done
+        finish_compaction();
+    }
+}
+
+static void start_compaction(const ChunkCoord &region)
+{
+    auto task = std::make_shared<CompactionTask>();
+    task->region = region;
+    task->level = deflate_level;
+
+    journal::detach(region, task->records, task->files);
+
+    for(const auto &it : task->records) {
+        if(const Chunk *chunk = world::find(it.first)) {
+            // Loaded chunks are copied here because the
+            // tick keeps on modifying them while compacting
+            task->loaded[it.first] = chunk->voxels;
+        }
+    }
+
+    compaction_task = task;
+    compaction_future = worker_pool.submit_task([task](void) { compact(task); });
+}
+
+static void on_chunk_write(const ChunkWriteEvent &event)
+{
+    if(snapshot_task) {
+        std::lock_guard<std::mutex> lock(snapshot_task->mutex);
+        const auto it = snapshot_task->loaded.find(event.coord);
+
+        if((it != snapshot_task->loaded.cend()) && (it->second == event.chunk)) {
+            // The worker hasn't stored the chunk yet
+            snapshot_task->loaded_copies[event.coord] = event.chunk->voxels;
+            snapshot_task->loaded.erase(it);
+        }
+    }
+}
+
+static void on_chunk_update(const ChunkUpdateEvent &event)
+{
+    // The chunk was replaced entirely; it has to be
+    // stored as a whole in order to persist the changes
+    globals::registry.remove<JournaledComponent>(event.chunk->entity);
+}
+
+static void on_voxel_set(const VoxelSetEvent &event)
+{
+    if(globals::registry.all_of<JournaledComponent>(event.chunk->entity)) {
+        journal::append(event.cpos, event.index, event.voxel);
+    }
 }
 
 void universe::setup(const std::string &directory)
 {
+    if(snapshot_future.valid())
+        snapshot_future.wait();
+    snapshot_future = std::future<void>();
+    snapshot_task = nullptr;
+
+    if(compaction_future.valid())
+        compaction_future.wait();
+    compaction_future = std::future<void>();
+    compaction_task = nullptr;
+
     worldgen_seed = epoch::milliseconds();
 
     universe_dir = directory;
     universe_chunk_dir = fmt::format("{}/chunk", universe_dir);
     universe_config_path = fmt::format("{}/universe.conf", universe_dir);
 
+    kept_chunks.clear();
+
+    if(universe::is_read_only && !PHYSFS_exists(universe_config_path.c_str())) {
+        // There's no way to make up a world that
+        // isn't stored anywhere without writing it out
+        spdlog::critical("universe: {}: not an existing universe", universe_dir);
+        std::terminate();
+    }
+
     if(!PHYSFS_mkdir(universe_dir.c_str())) {
         spdlog::critical("universe: mkdir {}: {}", universe_dir, fstools::error());
         std::terminate();
@@ -52,18 +394,156 @@ void universe::setup(const std::string &directory)
     }
 
     Config::add(universe_config, "worldgen.seed", worldgen_seed);
+    Config::add(universe_config, "universe.deflate_level", deflate_level);
+    Config::add(universe_config, "universe.journal_limit", journal_limit);
+    Config::add(universe_config, "universe.journal_flush_ms", journal_flush_ms);
+    Config::add(universe_config, "universe.backup_interval", backup_interval);
     
     worldgen::setup(universe_config);
 
     Config::load(universe_config, universe_config_path);
 
+    deflate_level = cxpr::min(deflate_level, chunk_codec::LEVEL_MAX);
+
     worldgen::setup_late();
+
+    journal::setup(fmt::format("{}/journal", universe_dir));
+
+    last_journal_flush = epoch::milliseconds();
+    last_backup = epoch::seconds();
+
+    globals::dispatcher.sink<ChunkWriteEvent>().connect<&on_chunk_write>();
+    globals::dispatcher.sink<ChunkUpdateEvent>().connect<&on_chunk_update>();
+    globals::dispatcher.sink<VoxelSetEvent>().connect<&on_voxel_set>();
+}
+
+void universe::update_late(void)
+{
+    if(universe::is_read_only) {
+        // No journal flushes, backups or compaction
+        return;
+    }
+
+    auto curtime = epoch::milliseconds();
+
+    if(curtime >= (last_journal_flush + journal_flush_ms)) {
+        // Edits are batched and written out all at
+        // once; this keeps the number of writes down
+        // while still keeping crash recovery cheap
+        journal::flush();
+        last_journal_flush = curtime;
+    }
+
+    if(snapshot_future.valid()) {
+        if(snapshot_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            // Compacting would rewrite the chunk images
+            // and delete the journals the backup relies on
+            return;
+        }
+
+        snapshot_future.get();
+        snapshot_future = std::future<void>();
+
+        spdlog::info("universe: backup: {} done in {} ms", snapshot_task->directory, epoch::milliseconds() - snapshot_task->begin_time);
+
+        snapshot_task = nullptr;
+    }
+
+    if(backup_interval && (epoch::seconds() >= (last_backup + 60U * backup_interval))) {
+        universe::backup(fmt::format("backup/{}-{}", universe_dir, epoch::seconds()));
+        last_backup = epoch::seconds();
+        return;
+    }
+
+    if(compaction_future.valid()) {
+        if(compaction_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        finish_compaction();
+    }
+
+    ChunkCoord region = {};
+
+    if(journal::find_oversized(journal_limit, region)) {
+        start_compaction(region);
+    }
+}
+
+bool universe::backup(const std::string &directory)
+{
+    if(universe::is_read_only) {
+        spdlog::warn("universe: backup: {}: the universe is read-only", directory);
+        return false;
+    }
+
+    if(snapshot_future.valid()) {
+        spdlog::warn("universe: backup: {}: another backup is still running", directory);
+        return false;
+    }
+
+    auto chunk_dir = fmt::format("{}/chunk", directory);
+
+    if(!PHYSFS_mkdir(chunk_dir.c_str())) {
+        spdlog::warn("universe: backup: mkdir {}: {}", chunk_dir, fstools::error());
+        return false;
+    }
+
+    finish_compaction();
+
+    auto task = std::make_shared<SnapshotTask>();
+    task->directory = directory;
+    task->begin_time = epoch::milliseconds();
+    task->level = deflate_level;
+
+    if(!Config::save(universe_config, fmt::format("{}/universe.conf", directory))) {
+        spdlog::warn("universe: backup: {}: unable to save universe.conf", directory);
+        return false;
+    }
+
+    journal::enumerate(task->journal_files);
+
+    auto group = globals::registry.group(entt::get<ChunkComponent, InhabitedComponent>);
+
+    for(auto [entity, chunk] : group.each()) {
+        task->loaded[chunk.coord] = chunk.chunk;
+        task->loaded_coords.push_back(chunk.coord);
+    }
+
+    char **filenames = PHYSFS_enumerateFiles(universe_chunk_dir.c_str());
+
+    for(char **filename = filenames; filename && *filename; ++filename) {
+        ChunkCoord cpos = {};
+
+        if(universe::parse_chunk_filename(*filename, cpos) && !task->loaded.contains(cpos)) {
+            task->stored[cpos] = fmt::format("{}/{}", universe_chunk_dir, *filename);
+            task->stored_coords.push_back(cpos);
+        }
+    }
+
+    PHYSFS_freeList(filenames);
+
+    spdlog::info("universe: backup: {}: {} loaded and {} stored chunks", directory, task->loaded_coords.size(), task->stored_coords.size());
+
+    snapshot_task = task;
+    snapshot_future = worker_pool.submit_task([task](void) { write_snapshot(task); });
+
+    return true;
 }
 
 void universe::save_everything(void)
 {
+    if(universe::is_read_only)
+        return;
+
     universe::save_all_chunks();
 
+    journal::flush();
+
+    finish_compaction();
+
+    if(snapshot_future.valid()) {
+        snapshot_future.wait();
+    }
+
     Config::save(universe_config, universe_config_path);
 }
 
@@ -76,23 +556,41 @@ Chunk *universe::load_chunk(const ChunkCoord &cpos)
         return chunk;
     }
 
-    auto path = fmt::format("{}/chunk/{}", universe_dir, chunk_filename(cpos));
+    auto path = fmt::format("{}/chunk/{}", universe_dir, universe::get_chunk_filename(cpos));
     auto buffer = std::vector<std::uint8_t>();
 
-    if(fstools::read_bytes(path, buffer)) {
+    if(const auto kept = kept_chunks.find(cpos); kept != kept_chunks.cend()) {
         auto chunk = Chunk::create();
         chunk->entity = globals::registry.create();
+        chunk->voxels = kept->second;
+
+        world::emplace_or_replace(cpos, chunk);
+
+        globals::registry.emplace_or_replace<InhabitedComponent>(chunk->entity);
+
+        return chunk;
+    }
+
+    wait_for_compaction(cpos);
+
+    if(fstools::read_bytes(path, buffer)) {
+        auto chunk = Chunk::create();
         chunk->voxels.fill(NULL_VOXEL);
 
-        auto size = static_cast<mz_ulong>(sizeof(VoxelStorage));
-        auto bound = static_cast<mz_ulong>(buffer.size());
+        if(!chunk_codec::decode(buffer, chunk->voxels)) {
+            Chunk::destroy(chunk);
+            quarantine_chunk(cpos, path, buffer);
+            return worldgen::generate(cpos);
+        }
 
-        mz_uncompress(reinterpret_cast<unsigned char *>(chunk->voxels.data()), &size, buffer.data(), bound);
+        // Keep the stored data around so it can
+        // be forwarded to clients without re-encoding
+        chunk->entity = globals::registry.create();
+        chunk->encoded = std::move(buffer);
 
-        for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
-            // Compressed voxels are stored in the network
-            // byte order; just like voxels in ChunkVoxels packet
-            chunk->voxels[i] = ENET_NET_TO_HOST_16(chunk->voxels[i]);
+        if(journal::replay(cpos, chunk->voxels)) {
+            // Stored image is now outdated
+            chunk->encoded.clear();
         }
 
         world::emplace_or_replace(cpos, chunk);
@@ -100,6 +598,12 @@ Chunk *universe::load_chunk(const ChunkCoord &cpos)
         // Ensure the loaded chunk is marked as inhabited as-is
         globals::registry.emplace_or_replace<InhabitedComponent>(chunk->entity);
 
+        if(!universe::is_read_only) {
+            // Edits to chunks of a read-only universe
+            // must not end up in its journal either
+            globals::registry.emplace_or_replace<JournaledComponent>(chunk->entity);
+        }
+
         return chunk;
     }
 
@@ -109,28 +613,47 @@ Chunk *universe::load_chunk(const ChunkCoord &cpos)
 void universe::save_chunk(const ChunkCoord &cpos)
 {
     if(auto chunk = world::find(cpos)) {
-        VoxelStorage voxels = {};
+        if(universe::is_read_only) {
+            kept_chunks[cpos] = chunk->voxels;
+            return;
+        }
 
-        for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
-            // Compressed voxels are stored in the network
-            // byte order; just like voxels in ChunkVoxels packet
-            voxels[i] = ENET_HOST_TO_NET_16(chunk->voxels[i]);
+        if(globals::registry.all_of<JournaledComponent>(chunk->entity)) {
+            // Everything that happened to the chunk
+            // since it was last stored is in the journal
+            return;
         }
 
-        auto bound = mz_compressBound(sizeof(VoxelStorage));
-        auto buffer = std::vector<std::uint8_t>(bound, UINT8_C(0x00));
-        mz_compress(buffer.data(), &bound, reinterpret_cast<const unsigned char *>(voxels.data()), sizeof(VoxelStorage));
+        wait_for_compaction(cpos);
 
-        // Make sure we're not writing any excess
-        // data that didn't wasn't used by mz_compress
-        buffer.resize(bound);
+        auto path = fmt::format("{}/chunk/{}", universe_dir, universe::get_chunk_filename(cpos));
 
-        auto path = fmt::format("{}/chunk/{}", universe_dir, chunk_filename(cpos));
+        if(chunk_codec::get_format(chunk->encoded) != chunk_codec::get_format(deflate_level)) {
+            // The chunk was either modified or loaded
+            // from a save that uses a different format
+            if(!chunk_codec::encode(chunk->voxels, chunk->encoded, deflate_level)) {
+                // The chunk stays unsaved and
+                // is retried on the next save
+                spdlog::warn("universe::save_chunk: {}: unable to encode chunk", path);
+                return;
+            }
+        }
 
-        if(!fstools::write_bytes(path, buffer)) {
+        copy_stored_chunk(cpos, path);
+
+        if(!fstools::write_bytes(path, chunk->encoded)) {
             spdlog::warn("universe::save_chunk: {}: {}", path, fstools::error());
             return;
         }
+
+        if(journal::has_records(cpos)) {
+            // Earlier edits must not be replayed on top
+            // of the image we've just written; a crash before
+            // the next flush would otherwise roll the chunk back
+            journal::write_reset(cpos);
+        }
+
+        globals::registry.emplace_or_replace<JournaledComponent>(chunk->entity);
     }
 }
 
@@ -142,3 +665,31 @@ void universe::save_all_chunks(void)
         universe::save_chunk(chunk.coord);
     }
 }
+
+std::string universe::get_chunk_filename(const ChunkCoord &cpos)
+{
+    auto cx = static_cast<std::uint32_t>(cpos.get_x());
+    auto cy = static_cast<std::uint32_t>(cpos.get_y());
+    auto cz = static_cast<std::uint32_t>(cpos.get_z());
+    return fmt::format("{:08X}-{:08X}-{:08X}.zvox", cx, cy, cz);
+}
+
+bool universe::parse_chunk_filename(const std::string &filename, ChunkCoord &cpos)
+{
+    const auto parts = strtools::split(filename, "-");
+
+    if(parts.size() != 3)
+        return false;
+    if(parts[2].size() != 13 || parts[2].compare(8, 5, ".zvox"))
+        return false;
+
+    try {
+        cpos[0] = static_cast<std::int32_t>(std::stoul(parts[0], nullptr, 16));
+        cpos[1] = static_cast<std::int32_t>(std::stoul(parts[1], nullptr, 16));
+        cpos[2] = static_cast<std::int32_t>(std::stoul(parts[2].substr(0, 8), nullptr, 16));
+        return true;
+    }
+    catch(const std::exception &) {
+        return false;
+    }
+}
@@ -3,10 +3,20 @@
 #include "shared/world/chunk.hh"
 #include "shared/world/chunk_coord.hh"
 
+// Read-only universes are never written to; chunks that
+// would have been stored are kept in memory instead and the
+// universe must exist already since it can't be created
+namespace universe
+{
+extern bool is_read_only;
+} // namespace universe
+
 namespace universe
 {
 void setup(const std::string &directory);
+void update_late(void);
 void save_everything(void);
+bool backup(const std::string &directory);
 } // namespace universe
 
 namespace universe
@@ -15,3 +25,9 @@ Chunk *load_chunk(const ChunkCoord &cpos);
 void save_chunk(const ChunkCoord &cpos);
 void save_all_chunks(void);
 } // namespace universe
+
+namespace universe
+{
+std::string get_chunk_filename(const ChunkCoord &cpos);
+bool parse_chunk_filename(const std::string &filename, ChunkCoord &cpos);
+} // namespace universe
@@ -6,6 +6,7 @@
 
 #include "shared/event/chunk_create.hh"
 #include "shared/event/chunk_update.hh"
+#include "shared/event/chunk_write.hh"
 #include "shared/event/voxel_set.hh"
 
 #include "shared/world/local_coord.hh"
@@ -16,9 +17,19 @@
 
 static emhash8::HashMap<ChunkCoord, Chunk *> chunks = {};
 
+static void trigger_write(const ChunkCoord &cpos, Chunk *chunk)
+{
+    ChunkWriteEvent event = {};
+    event.coord = cpos;
+    event.chunk = chunk;
+
+    globals::dispatcher.trigger(event);
+}
+
 static void on_destroy_chunk(entt::registry &registry, entt::entity entity)
 {
     ChunkComponent &component = registry.get<ChunkComponent>(entity);
+    trigger_write(component.coord, component.chunk);
     chunks.erase(component.coord);
     Chunk::destroy(component.chunk);
 }
@@ -33,12 +44,15 @@ void world::emplace_or_replace(const ChunkCoord &cpos, Chunk *chunk)
     auto it = chunks.find(cpos);
 
     if(it != chunks.end()) {
+        trigger_write(cpos, it->second);
+
         ChunkComponent &component = globals::registry.get<ChunkComponent>(it->second->entity);
         component.chunk = chunk;
         component.coord = cpos;
 
         if(chunk->entity != it->second->entity)
             chunk->entity = it->second->entity;
+        chunk->version = it->second->version + 1;
         Chunk::destroy(it->second);
         it->second = chunk;
 
@@ -118,7 +132,11 @@ bool world::set_voxel(VoxelID voxel, const ChunkCoord &cpos, const LocalCoord &l
     const auto index = LocalCoord::to_index(rlpos);
 
     if(Chunk *chunk = world::find(rcpos)) {
+        trigger_write(rcpos, chunk);
+
         chunk->voxels[index] = voxel;
+        chunk->encoded.clear();
+        chunk->version += 1;
 
         VoxelSetEvent event = {};
         event.cpos = rcpos;
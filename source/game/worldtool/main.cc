@@ -0,0 +1,503 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include "worldtool/precompiled.hh"
+
+#include "mathlib/constexpr.hh"
+
+#include "common/cmdline.hh"
+#include "common/epoch.hh"
+#include "common/fstools.hh"
+
+#include "shared/world/chunk_codec.hh"
+#include "shared/world/journal.hh"
+#include "shared/world/universe.hh"
+
+#include "shared/setup.hh"
+
+
+struct StoredChunk final {
+    ChunkCoord cpos {};
+    std::string path {};
+};
+
+static std::string universe_dir = {};
+static std::vector<StoredChunk> stored_chunks = {};
+static std::vector<JournalFile> journal_files = {};
+static JournalRecords journal_records = {};
+
+static unsigned int get_level(void)
+{
+    std::string value = {};
+
+    if(cmdline::get_value("level", value)) {
+        try {
+            return cxpr::min(static_cast<unsigned int>(std::stoul(value)), chunk_codec::LEVEL_MAX);
+        }
+        catch(const std::exception &) {
+            spdlog::warn("worldtool: {}: invalid compression level", value);
+        }
+    }
+
+    return chunk_codec::LEVEL_DEFAULT;
+}
+
+static bool encode(const VoxelStorage &voxels, std::vector<std::uint8_t> &buffer, unsigned int level)
+{
+    if(cmdline::contains("legacy")) {
+        // Saves that have to be read by
+        // older versions of the game and tools
+        return chunk_codec::encode_legacy(voxels, buffer, level);
+    }
+
+    return chunk_codec::encode(voxels, buffer, level);
+}
+
+static void enumerate_universe(void)
+{
+    auto chunk_dir = fmt::format("{}/chunk", universe_dir);
+    char **filenames = PHYSFS_enumerateFiles(chunk_dir.c_str());
+
+    for(char **filename = filenames; filename && *filename; ++filename) {
+        StoredChunk chunk = {};
+
+        if(!universe::parse_chunk_filename(*filename, chunk.cpos)) {
+            spdlog::warn("worldtool: {}/{}: not a chunk file", chunk_dir, *filename);
+            continue;
+        }
+
+        chunk.path = fmt::format("{}/{}", chunk_dir, *filename);
+        stored_chunks.push_back(chunk);
+    }
+
+    PHYSFS_freeList(filenames);
+
+    journal::setup(fmt::format("{}/journal", universe_dir));
+    journal::enumerate(journal_files);
+
+    std::vector<std::uint8_t> buffer = {};
+
+    for(const JournalFile &file : journal_files) {
+        if(!fstools::read_bytes(file.path, buffer)) {
+            spdlog::warn("worldtool: {}: {}", file.path, fstools::error());
+            continue;
+        }
+
+        journal::parse(buffer.data(), buffer.size(), journal_records);
+    }
+}
+
+// Records for chunks that have no stored image can't be folded
+// into anything, so journal files that hold them are kept; chunks
+// that have been folded get a reset record instead so that whatever
+// the kept files say about them is never replayed on top of the new images
+static std::size_t delete_journals(void)
+{
+    std::unordered_set<ChunkCoord> stored = {};
+    std::unordered_set<ChunkCoord> orphans = {};
+    std::unordered_set<ChunkCoord> folded = {};
+
+    for(const StoredChunk &chunk : stored_chunks) {
+        stored.insert(chunk.cpos);
+    }
+
+    std::vector<std::uint8_t> buffer = {};
+    std::size_t deleted_count = 0;
+    JournalRecords records = {};
+
+    for(const JournalFile &file : journal_files) {
+        if(!fstools::read_bytes(file.path, buffer)) {
+            spdlog::warn("worldtool: {}: {}; keeping it", file.path, fstools::error());
+            continue;
+        }
+
+        records.clear();
+        journal::parse(buffer.data(), buffer.size(), records);
+
+        bool has_orphans = false;
+
+        for(const auto &it : records) {
+            if(!stored.count(it.first) && journal_records.contains(it.first)) {
+                orphans.insert(it.first);
+                has_orphans = true;
+            }
+        }
+
+        if(has_orphans) {
+            for(const auto &it : records) {
+                if(stored.count(it.first)) {
+                    folded.insert(it.first);
+                }
+            }
+
+            continue;
+        }
+
+        if(!PHYSFS_delete(file.path.c_str())) {
+            spdlog::warn("worldtool: {}: {}", file.path, fstools::error());
+            continue;
+        }
+
+        deleted_count += 1;
+    }
+
+    if(orphans.empty())
+        return deleted_count;
+
+    for(const ChunkCoord &cpos : folded) {
+        journal::append_reset(cpos);
+    }
+
+    journal::flush();
+
+    spdlog::warn("worldtool: {} journal files kept; they hold edits to {} chunks that have no stored image",
+        journal_files.size() - deleted_count, orphans.size());
+
+    return deleted_count;
+}
+
+static bool load_chunk(const StoredChunk &chunk, std::vector<std::uint8_t> &buffer, VoxelStorage &voxels)
+{
+    if(!fstools::read_bytes(chunk.path, buffer)) {
+        spdlog::warn("worldtool: {}: {}", chunk.path, fstools::error());
+        return false;
+    }
+
+    if(!chunk_codec::decode(buffer, voxels)) {
+        spdlog::warn("worldtool: {}: corrupted chunk data", chunk.path);
+        return false;
+    }
+
+    const auto it = journal_records.find(chunk.cpos);
+
+    if(it != journal_records.cend()) {
+        // The stored image is outdated and must
+        // be brought up to date with the journal
+        journal::apply(it->second, voxels);
+    }
+
+    return true;
+}
+
+static int run_convert(void)
+{
+    std::string output_dir = {};
+
+    if(!cmdline::get_value("output", output_dir))
+        output_dir = universe_dir;
+    const bool in_place = (output_dir == universe_dir);
+
+    auto chunk_dir = fmt::format("{}/chunk", output_dir);
+
+    if(!PHYSFS_mkdir(chunk_dir.c_str())) {
+        spdlog::critical("worldtool: mkdir {}: {}", chunk_dir, fstools::error());
+        return 1;
+    }
+
+    if(!in_place) {
+        std::vector<std::uint8_t> config = {};
+        auto source = fmt::format("{}/universe.conf", universe_dir);
+        auto target = fmt::format("{}/universe.conf", output_dir);
+
+        if(!fstools::read_bytes(source, config) || !fstools::write_bytes(target, config)) {
+            spdlog::critical("worldtool: {}: {}", target, fstools::error());
+            return 1;
+        }
+    }
+
+    const auto level = get_level();
+
+    std::vector<std::uint8_t> buffer = {};
+    std::size_t failed_count = 0;
+    VoxelStorage voxels = {};
+
+    for(const StoredChunk &chunk : stored_chunks) {
+        if(!load_chunk(chunk, buffer, voxels)) {
+            failed_count += 1;
+            continue;
+        }
+
+        auto path = fmt::format("{}/{}", chunk_dir, universe::get_chunk_filename(chunk.cpos));
+
+        if(!encode(voxels, buffer, level)) {
+            spdlog::critical("worldtool: {}: unable to encode chunk", path);
+            return 1;
+        }
+
+        if(!fstools::write_bytes(path, buffer)) {
+            spdlog::critical("worldtool: {}: {}", path, fstools::error());
+            return 1;
+        }
+    }
+
+    if(in_place && !failed_count) {
+        // Journal records have been folded into the
+        // chunk images and replaying them is pointless
+        delete_journals();
+    }
+
+    spdlog::info("worldtool: convert: {} chunks written to {}, {} failed", stored_chunks.size() - failed_count, output_dir, failed_count);
+
+    return failed_count ? 1 : 0;
+}
+
+static int run_compact(void)
+{
+    const auto level = get_level();
+
+    std::vector<std::uint8_t> buffer = {};
+    std::size_t compacted_count = 0;
+    VoxelStorage voxels = {};
+
+    for(const StoredChunk &chunk : stored_chunks) {
+        if(!journal_records.contains(chunk.cpos)) {
+            // Nothing to fold into this chunk
+            continue;
+        }
+
+        if(!load_chunk(chunk, buffer, voxels)) {
+            spdlog::critical("worldtool: compact: {}: keeping journals intact", chunk.path);
+            return 1;
+        }
+
+        if(!encode(voxels, buffer, level)) {
+            spdlog::critical("worldtool: compact: {}: unable to encode chunk; keeping journals intact", chunk.path);
+            return 1;
+        }
+
+        if(!fstools::write_bytes(chunk.path, buffer)) {
+            spdlog::critical("worldtool: {}: {}", chunk.path, fstools::error());
+            return 1;
+        }
+
+        compacted_count += 1;
+    }
+
+    const std::size_t deleted_count = delete_journals();
+
+    spdlog::info("worldtool: compact: {} chunks rewritten, {} journal files removed", compacted_count, deleted_count);
+
+    return 0;
+}
+
+static int run_verify(void)
+{
+    std::vector<std::uint8_t> buffer = {};
+    std::size_t error_count = 0;
+    VoxelStorage voxels = {};
+
+    for(const StoredChunk &chunk : stored_chunks) {
+        if(!fstools::read_bytes(chunk.path, buffer)) {
+            spdlog::error("worldtool: verify: {}: {}", chunk.path, fstools::error());
+            error_count += 1;
+            continue;
+        }
+
+        if(!chunk_codec::decode(buffer, voxels)) {
+            // The game silently keeps whatever was
+            // decoded; that's a world corruption waiting to happen
+            spdlog::error("worldtool: verify: {}: truncated or corrupted chunk data", chunk.path);
+            error_count += 1;
+            continue;
+        }
+    }
+
+    for(const JournalFile &file : journal_files) {
+        if(file.size % journal::RECORD_SIZE) {
+            spdlog::warn("worldtool: verify: {}: torn trailing record", file.path);
+        }
+    }
+
+    for(const auto &it : journal_records) {
+        auto found = std::find_if(stored_chunks.cbegin(), stored_chunks.cend(), [&it](const StoredChunk &chunk) {
+            return chunk.cpos == it.first;
+        });
+
+        if(found == stored_chunks.cend()) {
+            spdlog::error("worldtool: verify: {}: journal records without a chunk image", universe::get_chunk_filename(it.first));
+            error_count += 1;
+        }
+    }
+
+    spdlog::info("worldtool: verify: {} chunks, {} journal files, {} errors", stored_chunks.size(), journal_files.size(), error_count);
+
+    return error_count ? 1 : 0;
+}
+
+static int run_stats(void)
+{
+    std::vector<std::uint8_t> buffer = {};
+    std::map<std::uint8_t, std::pair<std::size_t, std::size_t>> formats = {};
+    std::map<std::size_t, std::size_t> palettes = {};
+    std::size_t total_bytes = 0;
+    std::size_t palette_total = 0;
+    std::size_t palette_max = 0;
+    std::size_t chunk_count = 0;
+    VoxelStorage voxels = {};
+
+    for(const StoredChunk &chunk : stored_chunks) {
+        if(!load_chunk(chunk, buffer, voxels))
+            continue;
+        std::sort(voxels.begin(), voxels.end());
+
+        auto palette_size = static_cast<std::size_t>(std::unique(voxels.begin(), voxels.end()) - voxels.begin());
+        auto palette_bucket = std::size_t(1);
+
+        // Bucket palette sizes into powers of two
+        while(palette_bucket < palette_size)
+            palette_bucket *= 2;
+        palettes[palette_bucket] += 1;
+
+        auto &format = formats[chunk_codec::get_format(buffer)];
+        format.first += 1;
+        format.second += buffer.size();
+
+        palette_total += palette_size;
+        palette_max = cxpr::max(palette_max, palette_size);
+        total_bytes += buffer.size();
+        chunk_count += 1;
+    }
+
+    std::size_t record_count = 0;
+    std::size_t journal_bytes = 0;
+
+    for(const auto &it : journal_records)
+        record_count += it.second.size();
+    for(const JournalFile &file : journal_files)
+        journal_bytes += file.size;
+
+    spdlog::info("worldtool: stats: {}", universe_dir);
+    spdlog::info("  chunks:    {} ({} bytes, {:.02f} bytes/chunk)", chunk_count, total_bytes, chunk_count ? static_cast<double>(total_bytes) / chunk_count : 0.0);
+    spdlog::info("  journals:  {} files ({} bytes), {} records over {} chunks", journal_files.size(), journal_bytes, record_count, journal_records.size());
+    spdlog::info("  palettes:  {:.02f} voxels average, {} max", chunk_count ? static_cast<double>(palette_total) / chunk_count : 0.0, palette_max);
+
+    for(const auto &it : formats)
+        spdlog::info("  format {:02X}: {} chunks, {} bytes", it.first, it.second.first, it.second.second);
+    for(const auto &it : palettes)
+        spdlog::info("  palette <= {:<4}: {} chunks", it.first, it.second);
+
+    return 0;
+}
+
+static int run_benchmark(void)
+{
+    std::vector<std::vector<std::uint8_t>> buffers = {};
+    std::vector<VoxelStorage> chunks = {};
+    std::size_t read_bytes = 0;
+
+    buffers.resize(stored_chunks.size());
+    chunks.resize(stored_chunks.size());
+
+    auto read_begin = epoch::microseconds();
+
+    for(std::size_t i = 0; i < stored_chunks.size(); ++i) {
+        if(!fstools::read_bytes(stored_chunks[i].path, buffers[i])) {
+            spdlog::critical("worldtool: {}: {}", stored_chunks[i].path, fstools::error());
+            return 1;
+        }
+
+        read_bytes += buffers[i].size();
+    }
+
+    auto decode_begin = epoch::microseconds();
+
+    for(std::size_t i = 0; i < stored_chunks.size(); ++i) {
+        if(!chunk_codec::decode(buffers[i], chunks[i])) {
+            spdlog::critical("worldtool: {}: corrupted chunk data", stored_chunks[i].path);
+            return 1;
+        }
+    }
+
+    auto encode_begin = epoch::microseconds();
+
+    const auto level = get_level();
+
+    for(std::size_t i = 0; i < stored_chunks.size(); ++i) {
+        if(!encode(chunks[i], buffers[i], level)) {
+            spdlog::critical("worldtool: {}: unable to encode chunk", stored_chunks[i].path);
+            return 1;
+        }
+    }
+
+    auto write_begin = epoch::microseconds();
+
+    // Chunks are written into a scratch directory
+    // so that the benchmark doesn't modify the save
+    auto scratch_dir = fmt::format("{}.benchmark", universe_dir);
+    std::size_t write_bytes = 0;
+
+    if(!PHYSFS_mkdir(scratch_dir.c_str())) {
+        spdlog::critical("worldtool: mkdir {}: {}", scratch_dir, fstools::error());
+        return 1;
+    }
+
+    for(std::size_t i = 0; i < stored_chunks.size(); ++i) {
+        auto path = fmt::format("{}/{}", scratch_dir, universe::get_chunk_filename(stored_chunks[i].cpos));
+
+        if(!fstools::write_bytes(path, buffers[i])) {
+            spdlog::critical("worldtool: {}: {}", path, fstools::error());
+            return 1;
+        }
+
+        write_bytes += buffers[i].size();
+    }
+
+    auto write_end = epoch::microseconds();
+
+    for(const StoredChunk &chunk : stored_chunks) {
+        auto path = fmt::format("{}/{}", scratch_dir, universe::get_chunk_filename(chunk.cpos));
+        PHYSFS_delete(path.c_str());
+    }
+
+    PHYSFS_delete(scratch_dir.c_str());
+
+    const auto report = [](const char *name, std::size_t count, std::size_t bytes, std::uint64_t time_us) {
+        auto seconds = cxpr::max(static_cast<double>(time_us), 1.0) / 1000000.0;
+        auto rate = static_cast<double>(count) / seconds;
+        auto throughput = static_cast<double>(bytes) / seconds / 1048576.0;
+        spdlog::info("  {:<8} {:>10.02f} chunks/s {:>8.02f} MiB/s", name, rate, throughput);
+    };
+
+    const auto raw_bytes = stored_chunks.size() * sizeof(VoxelStorage);
+
+    spdlog::info("worldtool: benchmark: {} chunks, level {}", stored_chunks.size(), level);
+    report("read", stored_chunks.size(), read_bytes, decode_begin - read_begin);
+    report("decode", stored_chunks.size(), raw_bytes, encode_begin - decode_begin);
+    report("encode", stored_chunks.size(), raw_bytes, write_begin - encode_begin);
+    report("write", stored_chunks.size(), write_bytes, write_end - write_begin);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    cmdline::append(argc, argv);
+
+    shared::setup(argc, argv);
+
+    if(!cmdline::get_value("universe", universe_dir) || universe_dir.empty()) {
+        spdlog::critical("usage: vworldtool -universe <name> [-convert|-compact|-verify|-stats|-benchmark]");
+        spdlog::critical("options: -output <name>, -level <0-9>, -legacy");
+        shared::desetup();
+        return 1;
+    }
+
+    enumerate_universe();
+
+    int result = 0;
+
+    // Multiple commands can be given at once
+    // and they are always executed in this order
+    if(!result && cmdline::contains("verify"))
+        result = run_verify();
+    if(!result && cmdline::contains("stats"))
+        result = run_stats();
+    if(!result && cmdline::contains("benchmark"))
+        result = run_benchmark();
+    if(!result && cmdline::contains("compact"))
+        result = run_compact();
+    if(!result && cmdline::contains("convert"))
+        result = run_convert();
+
+    shared::desetup();
+
+    return result;
+}